@@ -1,5 +1,4 @@
 from maya import cmds
-from maya import mel
 from maya.api import OpenMaya as om
 from maya.api import OpenMayaAnim as anim
 from maya.OpenMayaUI import MQtUtil
@@ -18,7 +17,44 @@ from collections import OrderedDict
 from collections import namedtuple
 
 
-JointInfo = namedtuple("JointInfo", "dagPath dependNode availableStyles")
+# Joints are identified by full DAG path; name is the shortest path suffix
+# that is unique among the palette's joints.
+JointInfo = namedtuple("JointInfo", "fullPath name availableStyles")
+
+
+PaletteRow = namedtuple("PaletteRow", "joints style")
+
+# Channel bits of the -keyStatus and -dirtyJoints queries; X, Y and Z are
+# the low to high bits of each group.
+TRANSLATE_CHANNELS = 0x07
+ROTATE_CHANNELS = 0x38
+
+# Flags of a -dirtyJoints batch.
+BATCH_TIME_CHANGED = 0x01
+BATCH_FULL_REFRESH = 0x02
+
+
+RowWidget = namedtuple("RowWidget", "container panels")
+
+
+class JointPanel(object):
+    """A constituent panel widget and the joint it's currently bound to.
+    Panels are recycled as rows scroll in and out of view, so the joint is
+    rebound instead of fixed at creation.
+
+    :type gui: QWidget
+    :type style: str
+    :type drags: list[DragWidget]
+    :type dagPath: om.MDagPath | None
+    :type nodeName: str | None
+    """
+
+    def __init__(self, gui, style, drags):
+        self.gui = gui
+        self.style = style
+        self.drags = drags
+        self.dagPath = None
+        self.nodeName = None
 
 
 class ResizeEventFilter(QObject):
@@ -26,10 +62,12 @@ class ResizeEventFilter(QObject):
         super(ResizeEventFilter, self).__init__()
         self.source = None
         self.target = None
+        self.callback = None
 
-    def install(self, source, target):
+    def install(self, source, target, callback=None):
         self.source = source
         self.target = target
+        self.callback = callback
         self.source.installEventFilter(self)
 
     def remove(self):
@@ -37,6 +75,7 @@ class ResizeEventFilter(QObject):
             self.source.removeEventFilter(self)
         self.source = None
         self.target = None
+        self.callback = None
 
     def eventFilter(self, widget, event):
         if (event.type() == QEvent.Resize and
@@ -47,6 +86,8 @@ class ResizeEventFilter(QObject):
             minWidth = self.target.minimumWidth()
             geometry.setWidth(max(sourceWidth, minWidth))
             self.target.setGeometry(geometry)
+            if self.callback is not None:
+                self.callback()
             return True
 
         return QWidget.eventFilter(self, widget, event)
@@ -55,23 +96,23 @@ class ResizeEventFilter(QObject):
 class FocusEventFilter(QObject):
     def __init__(self):
         super(FocusEventFilter, self).__init__()
-        self.panels = {}
+        self.panels = []
 
-    def install(self, panels):
-        self.panels = panels.copy()
-        for panel in self.panels.itervalues():
-            panel.groupBox.installEventFilter(self)
+    def install(self, panel):
+        self.panels.append(panel)
+        panel.gui.groupBox.installEventFilter(self)
 
     def remove(self):
-        for panel in self.panels.itervalues():
-            panel.groupBox.removeEventFilter(self)
-        self.panels = {}
+        for panel in self.panels:
+            panel.gui.groupBox.removeEventFilter(self)
+        self.panels = []
 
     def eventFilter(self, widget, event):
         if event.type() == QEvent.MouseButtonPress:
-            for (nodeId, panel) in self.panels.iteritems():
-                if panel.groupBox == widget:
-                    self.selectNode(nodeId)  # Note: id is tuple (name, style).
+            for panel in self.panels:
+                if panel.gui.groupBox == widget:
+                    if panel.nodeName is not None:
+                        self.selectNode((panel.nodeName, panel.style))
                     return True
             return True
 
@@ -86,49 +127,91 @@ class FocusEventFilter(QObject):
 
 class MannequinToolPanel:
     """
+    Only the rows that are scrolled into view have widgets; the rest of the
+    palette is a flat list of rows. Row widgets that scroll out of view go
+    back into a pool and are rebound to whichever rows scroll in, so opening
+    and scrolling the palette cost the same no matter how many joints the
+    rigs have.
+
     :type callbacks: list[om.MCallbackId]
     :type jobs: list[int]
     :type parent: QWidget
     :type gui: QWidget
+    :type scrollArea: QScrollArea
     :type searchField: QLineEdit
     :type prefixTrim: int
-    :type dagPaths: dict[str, om.MDagPath]
     :type panels: dict[(str, str), QWidget]
-    :type updateQueue: list[(str, str)]
+    :type rows: list[PaletteRow]
+    :type visibleRows: list[PaletteRow]
+    :type rowIndices: dict[(str, str), int]
+    :type rowWidgets: dict[int, RowWidget]
+    :type rowPool: dict[(int, str), list[RowWidget]]
+    :type jointIndices: dict[str, int]
+    :type jointNames: dict[(int, int), str]
+    :type keyStatus: list[int]
+    :type keyStatusPending: bool
+    :type templates: dict[str, QByteArray]
+    :type selected: (str, str) | None
+    :type searchText: str
     :type validator: QDoubleValidator
     """
 
+    # Height of every row; panel_single.ui is fixed at this height.
+    ROW_HEIGHT = 110
+    # Rows bound beyond each edge of the view so that slow scrolling doesn't
+    # rebind on every step.
+    ROW_OVERSCAN = 1
+
     def __init__(self):
         self.loader = QUiLoader()
         self.resizeEventFilter = ResizeEventFilter()
         self.focusEventFilter = FocusEventFilter()
+        self.templates = {}
 
         self.callbacks = []
         self.jobs = []
         self.parent = None
         self.gui = None
+        self.scrollArea = None
         self.searchField = None
         self.prefixTrim = 0
-        self.dagPaths = {}
         self.panels = {}
-        self.updateQueue = []
+        self.rows = []
+        self.visibleRows = []
+        self.rowIndices = {}
+        self.rowWidgets = {}
+        self.rowPool = {}
+        self.jointIndices = {}
+        self.jointNames = {}
+        self.keyStatus = []
+        self.keyStatusPending = False
+        self.selected = None
+        self.searchText = ""
         self.validator = None
 
     def reset(self,
               parent=None,
               gui=None,
+              scrollArea=None,
               searchField=None,
-              prefixTrim=0):
+              prefixTrim=0,
+              jointOrder=None):
         """Configures the tool panel object for the given UI widgets.
 
         :param parent: the closest ancestor widget that was created by Maya
         :type parent: QWidget
         :param gui: the custom widget created in Qt that serves as the panel UI
         :type gui: QWidget
+        :param scrollArea: the Maya scroll layout that contains the panel UI
+        :type scrollArea: QScrollArea
         :param searchField: the text box created in Qt that does type-to-search
         :type searchField: QLineEdit
         :param prefixTrim: the number of characters to trim from panel titles
         :type prefixTrim: int
+        :param jointOrder: the rig ID, joint ID and full DAG path of all
+                           joints, in the order that the mannequinContext
+                           command returns them
+        :type jointOrder: list[(int, int, str)]
         """
 
         # Cleanup callbacks.
@@ -140,14 +223,35 @@ class MannequinToolPanel:
             cmds.scriptJob(kill=x)
         self.jobs = []
 
+        if self.scrollArea is not None:
+            scrollBar = self.scrollArea.verticalScrollBar()
+            try:
+                scrollBar.valueChanged.disconnect(self.updateVisibleRows)
+                scrollBar.rangeChanged.disconnect(self.updateVisibleRows)
+            except RuntimeError:
+                pass  # The scroll layout has already been deleted.
+
         # Reset everything.
         self.parent = parent
         self.gui = gui
+        self.scrollArea = scrollArea
         self.searchField = searchField
         self.prefixTrim = prefixTrim
-        self.dagPaths = {}
         self.panels = {}
-        self.updateQueue = []
+        self.rows = []
+        self.visibleRows = []
+        self.rowIndices = {}
+        self.rowWidgets = {}
+        self.rowPool = {}
+        self.jointIndices = {}
+        self.jointNames = {}
+        for (i, (rigId, jointId, nodeName)) in enumerate(jointOrder or []):
+            self.jointIndices[nodeName] = i
+            self.jointNames[(rigId, jointId)] = nodeName
+        self.keyStatus = []
+        self.keyStatusPending = False
+        self.selected = None
+        self.searchText = ""
 
         self.resizeEventFilter.remove()
         self.focusEventFilter.remove()
@@ -159,34 +263,36 @@ class MannequinToolPanel:
             self.validator = QDoubleValidator(gui)
             self.validator.setDecimals(3)
 
-    def select(self, dagPath, targetStyle=None):
-        """ Highlights the panel for the given DAG path and ensures it's visible.
+    def select(self, fullPathName, targetStyle=None):
+        """ Highlights the panel for the given joint and ensures it's visible.
 
-        :param dagPath: the DAG path that was selected (or None if no selection)
-        :type dagPath: om.MDagPath | None
+        :param fullPathName: the full DAG path of the joint that was selected
+                             (or None if no selection)
+        :type fullPathName: str | None
         :param targetStyle: the presentation style currently in use, e.g.
                             "r" for rotation or "t" for translation
         :type targetStyle: str
         """
 
-        if dagPath is None:
-            selectedPanel = ""
+        if fullPathName is None:
+            self.selected = None
         else:
-            selectedPanel = dagPath.fullPathName()
+            self.selected = (fullPathName, targetStyle)
 
-        for ((nodeName, style), panel) in self.panels.iteritems():
-            isTheOne = nodeName == selectedPanel and style == targetStyle
-            panel.groupBox.setFlat(isTheOne)
+        for (nodeId, panelGui) in self.panels.iteritems():
+            panelGui.groupBox.setFlat(nodeId == self.selected)
 
-            if isTheOne and panel.isVisible():
-                y = panel.parentWidget().pos().y()
-                height = panel.parentWidget().height()
-                self.scrollEnsureVisible(y, height)
+        # The selected row may not have widgets yet; scrolling to it binds it.
+        if self.selected in self.rowIndices:
+            y = self.contentOffset() + \
+                self.rowIndices[self.selected] * self.ROW_HEIGHT
+            self.scrollEnsureVisible(y, self.ROW_HEIGHT)
 
     def layoutJointGroup(self, jointGroup):
-        """Lays out all the UI for the given joint group. Multiple joint
-        display rows will be created if the group supports several presentation
-        styles.
+        """Adds the rows for the given joint group to the palette. Multiple
+        joint display rows will be added if the group supports several
+        presentation styles. No widgets are created until a row is scrolled
+        into view.
 
         :param jointGroup: a group of JointInfos that should be displayed
                            together
@@ -195,85 +301,81 @@ class MannequinToolPanel:
 
         availableStyles = jointGroup[0].availableStyles
         for style in availableStyles:
-            self.layoutJointDisplayRow(jointGroup, style)
+            self.rows.append(PaletteRow(jointGroup, style))
 
-    def layoutJointDisplayRow(self, jointGroup, style):
-        """Creates a row in the Mannequin panel and inserts all the
-        constituent panels.
+    def loadTemplate(self, fileName):
+        """Instantiates one of the .ui templates next to this script. Each
+        template is only read from disk once.
 
-        :param jointGroup: a group of JointInfos that should be displayed in the
-                           same row
-        :type jointGroup: list[JointInfo]
+        :param fileName: the name of the .ui file
+        :type fileName: str
+        :returns: the root widget of the new instance
+        :rtype: QWidget
+        """
+
+        if fileName not in self.templates:
+            uiFile = QFile(os.path.join(os.path.dirname(__file__), fileName))
+            uiFile.open(QFile.ReadOnly)
+            self.templates[fileName] = uiFile.readAll()
+            uiFile.close()
+
+        uiBuffer = QBuffer(self.templates[fileName])
+        uiBuffer.open(QIODevice.ReadOnly)
+        widget = self.loader.load(uiBuffer)
+        uiBuffer.close()
+        return widget
+
+    def createRow(self, numPanels, style):
+        """Creates a row widget with empty panels, ready to be bound.
+
+        :param numPanels: the number of constituent panels in the row
+        :type numPanels: int
         :param style: the presentation for the row (e.g. "t" for translate or
                       "r" for rotate)
         :type style: str
+        :rtype: RowWidget
         """
 
-        uiFile = QFile(os.path.join(os.path.dirname(__file__),
-                                    "panel_double.ui"))
-        uiFile.open(QFile.ReadOnly)
-        container = self.loader.load(uiFile)
-        uiFile.close()
-
-        # Add child panels.
-        for jointInfo in jointGroup:
-            self.insertJointDisplayPanel(jointInfo, style, container)
+        container = self.loadTemplate("panel_double.ui")
+        container.setParent(self.gui)
 
-        # Add container to UI tree.
-        self.gui.layout().addWidget(container)
+        panels = [self.createPanel(style, container)
+                  for _ in range(numPanels)]
+        return RowWidget(container, panels)
 
-    def insertJointDisplayPanel(self, jointInfo, style, container):
-        """Creates a constituent panel within a Mannequin display row.
+    def createPanel(self, style, container):
+        """Creates a constituent panel within a Mannequin display row. The
+        panel isn't bound to any joint yet.
 
-        :param jointInfo: the joint that the panel will control
-        :type jointInfo: JointInfo
         :param style: the presentation style (rotate, translate, etc.) for
                       the panel
         :type style: str
         :param container: the row container that houses this constituent panel
         :type container: QWidget
+        :rtype: JointPanel
         """
 
-        uiFile = QFile(os.path.join(os.path.dirname(__file__),
-                                    "panel_single.ui"))
-        uiFile.open(QFile.ReadOnly)
-        panelGui = self.loader.load(uiFile)
-        uiFile.close()
-
-        # Register panels according to DAG path.
-        dagPath = jointInfo.dagPath
-        nodeName = dagPath.fullPathName()
-        self.dagPaths[nodeName] = dagPath
-        self.panels[(nodeName, style)] = panelGui
+        panelGui = self.loadTemplate("panel_single.ui")
 
         # Setup panel validators.
         panelGui.xEdit.setValidator(self.validator)
         panelGui.yEdit.setValidator(self.validator)
         panelGui.zEdit.setValidator(self.validator)
 
-        # Setup panel title.
-        displayName = dagPath.partialPathName()
-        if len(displayName) > self.prefixTrim:
-            trimmedName = displayName[self.prefixTrim:]
-        else:
-            trimmedName = displayName
-        panelGui.groupBox.setTitle(trimmedName)
-
         # Set up drag-label UI.
+        drags = []
         if style == "r":
-            rotateXDrag = DragRotationWidget("rotate X", dagPath, 0)
-            rotateYDrag = DragRotationWidget("rotate Y", dagPath, 1)
-            rotateZDrag = DragRotationWidget("rotate Z", dagPath, 2)
-            panelGui.xLabel.layout().addWidget(rotateXDrag, 0, 0)
-            panelGui.yLabel.layout().addWidget(rotateYDrag, 0, 0)
-            panelGui.zLabel.layout().addWidget(rotateZDrag, 0, 0)
+            drags = [DragRotationWidget("rotate X", None, 0),
+                     DragRotationWidget("rotate Y", None, 1),
+                     DragRotationWidget("rotate Z", None, 2)]
         elif style == "t":
-            translateXDrag = DragTranslationWidget("translate X", dagPath, 0)
-            translateYDrag = DragTranslationWidget("translate Y", dagPath, 1)
-            translateZDrag = DragTranslationWidget("translate Z", dagPath, 2)
-            panelGui.xLabel.layout().addWidget(translateXDrag, 0, 0)
-            panelGui.yLabel.layout().addWidget(translateYDrag, 0, 0)
-            panelGui.zLabel.layout().addWidget(translateZDrag, 0, 0)
+            drags = [DragTranslationWidget("translate X", None, 0),
+                     DragTranslationWidget("translate Y", None, 1),
+                     DragTranslationWidget("translate Z", None, 2)]
+        if drags:
+            panelGui.xLabel.layout().addWidget(drags[0], 0, 0)
+            panelGui.yLabel.layout().addWidget(drags[1], 0, 0)
+            panelGui.zLabel.layout().addWidget(drags[2], 0, 0)
 
         # Set color based on presentation style.
         if style == "r":
@@ -281,259 +383,382 @@ class MannequinToolPanel:
         elif style == "t":
             panelGui.groupBox.setStyleSheet(MannequinStylesheets.STYLE_GREEN)
 
-        # Set current object properties.
-        if style == "r":
-            self.updatePanelRotation(panelGui, dagPath)
-        elif style == "t":
-            self.updatePanelTranslation(panelGui, dagPath)
+        panel = JointPanel(panelGui, style, drags)
 
-        # Register signal for text box editing.
-        if style == "r":
-            panelGui.xEdit.editingFinished.connect(
-                partial(self.setRotation, dagPath=dagPath, index=0))
-            panelGui.yEdit.editingFinished.connect(
-                partial(self.setRotation, dagPath=dagPath, index=1))
-            panelGui.zEdit.editingFinished.connect(
-                partial(self.setRotation, dagPath=dagPath, index=2))
-        elif style == "t":
-            panelGui.xEdit.editingFinished.connect(
-                partial(self.setTranslation, dagPath=dagPath, index=0))
-            panelGui.yEdit.editingFinished.connect(
-                partial(self.setTranslation, dagPath=dagPath, index=1))
-            panelGui.zEdit.editingFinished.connect(
-                partial(self.setTranslation, dagPath=dagPath, index=2))
-
-        # Register callback for attribute update.
-        callbackId = om.MNodeMessage.addNodeDirtyPlugCallback(
-            jointInfo.dependNode,
-            self.dirtyPlugCallback,
-            None)
-        self.callbacks.append(callbackId)
+        # Register signal for text box editing; the handler looks up whichever
+        # joint the panel is bound to at the time.
+        panelGui.xEdit.editingFinished.connect(
+            partial(self.panelEdited, panel=panel, index=0))
+        panelGui.yEdit.editingFinished.connect(
+            partial(self.panelEdited, panel=panel, index=1))
+        panelGui.zEdit.editingFinished.connect(
+            partial(self.panelEdited, panel=panel, index=2))
+
+        self.focusEventFilter.install(panel)
 
         # Finally add widget to container.
         container.layout().addWidget(panelGui)
+        return panel
+
+    def bindRow(self, index):
+        """Gives the visible row at the given index a widget, reusing one from
+        the pool if possible. The panels' values are left for the caller to
+        sync, so that binding many rows takes one query.
+
+        :param index: the index of the row in the search results
+        :type index: int
+        :returns: the full DAG paths of the joints bound
+        :rtype: list[str]
+        """
+
+        row = self.visibleRows[index]
+        key = (len(row.joints), row.style)
+        pool = self.rowPool.get(key)
+        if pool:
+            rowWidget = pool.pop()
+        else:
+            rowWidget = self.createRow(len(row.joints), row.style)
+
+        for panel, jointInfo in zip(rowWidget.panels, row.joints):
+            self.bindPanel(panel, jointInfo)
+
+        self.rowWidgets[index] = rowWidget
+        rowWidget.container.show()
+        return [panel.nodeName for panel in rowWidget.panels
+                if panel.nodeName is not None]
+
+    def bindPanel(self, panel, jointInfo):
+        """Points a constituent panel at the given joint and refreshes its
+        title and key status.
+
+        :param panel: the panel to rebind
+        :type panel: JointPanel
+        :param jointInfo: the joint that the panel will control
+        :type jointInfo: JointInfo
+        """
+
+        # Only the joints in view need a DAG path for their drag widgets.
+        nodeName = jointInfo.fullPath
+        selList = om.MSelectionList()
+        selList.add(nodeName)
+        dagPath = selList.getDagPath(0)
+        panelGui = panel.gui
+        style = panel.style
+
+        panel.dagPath = dagPath
+        panel.nodeName = nodeName
+        for drag in panel.drags:
+            drag.dagPath = dagPath
+
+        # Register panels according to DAG path.
+        self.panels[(nodeName, style)] = panelGui
+
+        # Setup panel title.
+        displayName = jointInfo.name
+        if len(displayName) > self.prefixTrim:
+            trimmedName = displayName[self.prefixTrim:]
+        else:
+            trimmedName = displayName
+        panelGui.groupBox.setTitle(trimmedName)
+        panelGui.groupBox.setFlat((nodeName, style) == self.selected)
+        panelGui.setVisible((nodeName, style) in self.rowIndices)
+
+        self.updatePanelKeyStatus(panelGui, style,
+                                  self.jointKeyStatus(nodeName))
+
+    def releaseRow(self, index):
+        """Returns the widget of the row at the given index to the pool.
+
+        :param index: the index of the row in the search results
+        :type index: int
+        """
+
+        rowWidget = self.rowWidgets.pop(index)
+        rowWidget.container.hide()
+
+        for panel in rowWidget.panels:
+            if panel.nodeName is None:
+                continue
+
+            self.panels.pop((panel.nodeName, panel.style), None)
+
+            panel.dagPath = None
+            panel.nodeName = None
+            for drag in panel.drags:
+                drag.dagPath = None
+
+        key = (len(rowWidget.panels), rowWidget.panels[0].style)
+        self.rowPool.setdefault(key, []).append(rowWidget)
+
+    def updateVisibleRows(self, *args):
+        """Binds the rows that are in view and releases the ones that aren't.
+        Called whenever the palette scrolls or resizes.
+        """
+
+        if self.gui is None:
+            return
+
+        if self.scrollArea is None:
+            top = 0
+            bottom = self.gui.height()
+        else:
+            top = self.scrollArea.verticalScrollBar().value() - \
+                self.contentOffset()
+            bottom = top + self.scrollArea.viewport().height()
+
+        first = max(0, top // self.ROW_HEIGHT - self.ROW_OVERSCAN)
+        last = min(len(self.visibleRows),
+                   bottom // self.ROW_HEIGHT + 1 + self.ROW_OVERSCAN)
+
+        for index in self.rowWidgets.keys():
+            if index < first or index >= last:
+                self.releaseRow(index)
+
+        boundNodeNames = []
+        for index in range(first, last):
+            if index not in self.rowWidgets:
+                boundNodeNames.extend(self.bindRow(index))
+        self.syncPanels(boundNodeNames)
+
+        width = self.gui.width()
+        for (index, rowWidget) in self.rowWidgets.iteritems():
+            rowWidget.container.setGeometry(0,
+                                            index * self.ROW_HEIGHT,
+                                            width,
+                                            self.ROW_HEIGHT)
+
+    def contentOffset(self):
+        """Gets the top of the panel UI, measured from the top of the scroller.
+
+        :rtype: int
+        """
+
+        if self.scrollArea is None or self.scrollArea.widget() is None:
+            return 0
+
+        return self.gui.mapTo(self.scrollArea.widget(), QPoint(0, 0)).y()
 
     def finishLayout(self):
         """This must be called to prepare the UI after all of the display rows
-        and panels have been inserted.
+        have been added.
         """
 
         # Setup resize event filter.
-        self.resizeEventFilter.install(self.parent, self.gui)
+        self.resizeEventFilter.install(self.parent, self.gui,
+                                       self.updateVisibleRows)
 
-        # Setup focus event filter.
-        self.focusEventFilter.install(self.panels)
+        # Rebind rows whenever the view moves or changes height.
+        if self.scrollArea is not None:
+            scrollBar = self.scrollArea.verticalScrollBar()
+            scrollBar.valueChanged.connect(self.updateVisibleRows)
+            scrollBar.rangeChanged.connect(self.updateVisibleRows)
 
-        # Setup animation curve callback and time changed callback.
+        # Setup animation curve callback.
         callbackId = anim.MAnimMessage.addAnimKeyframeEditedCallback(
             self.animKeyframeCallback
         )
         self.callbacks.append(callbackId)
 
-        jobId = cmds.scriptJob(event=("timeChanged", self.timeChangedCallback))
-        self.jobs.append(jobId)
+        # Follow the tool's selection, joint edits and time changes; the
+        # events are posted once Maya is idle, and throttled during playback.
+        callbackId = om.MUserEventMessage.addUserEventCallback(
+            "mannequinSelectionChanged",
+            mannequinSelectionChanged
+        )
+        self.callbacks.append(callbackId)
+
+        callbackId = om.MUserEventMessage.addUserEventCallback(
+            "mannequinJointsChanged",
+            self.jointsChangedCallback
+        )
+        self.callbacks.append(callbackId)
 
         # Setup the rest of the UI and show it.
+        self.updateAllKeyStatuses()
         self.searchField.textChanged.connect(self.search)
-        self.gui.layout().setAlignment(Qt.AlignTop)
-        self.relayout()
+        self.search(self.searchField.text())
         self.gui.show()
 
-    def dirtyPlugCallback(self, node, plug, clientData):
-        """Callback function for when a joint node's plugs have changed.
+    def jointsChangedCallback(self, clientData=None):
+        """Listener for the mannequinJointsChanged user event, which the C++
+        MannequinContext posts once Maya is idle after joints are edited or
+        the time changes. Each edited joint is listed once per event, however
+        often it changed. While the timeline plays or scrubs, the events are
+        limited to the context's palette rate, and a full refresh is
+        requested once it stops.
 
-        :param node: the node whose plugs have changed
-        :type node: om.MObject
-        :param plug: the plug that has changed on the node
-        :type plug: om.MPlug
-        :param clientData: extra client data passed from the callback
-                           constructor; unused at this time
+        :param clientData: unused
         """
 
-        dagNode = om.MFnDagNode(node)
-        nodeName = dagNode.fullPathName()
-        attrName = plug.partialName(False, False, False, False, False, True)
-
-        if attrName[:6] == "rotate" and (nodeName, "r") in self.panels:
-            self.updateQueue.append((nodeName, "r"))
-            if len(self.updateQueue) == 1:
-                cmds.evalDeferred(self.deferredUpdate, low=True)
-        elif attrName[:9] == "translate" and (nodeName, "t") in self.panels:
-            self.updateQueue.append((nodeName, "t"))
-            if len(self.updateQueue) == 1:
-                cmds.evalDeferred(self.deferredUpdate, low=True)
-
-    def deferredUpdate(self):
-        """Helper function for updating the panel UI after the dirty-plug
-        callback.
-
-        This is necessary because the plug's data might not be available yet
-        for querying until the next deferred update occurs.
-        """
-
-        for nodeName, style in self.updateQueue:
-            if nodeName not in self.dagPaths:
-                continue
-            if (nodeName, style) not in self.panels:
+        currentContext = cmds.currentCtx()
+        if cmds.contextInfo(currentContext, c=True) != "mannequinContext":
+            return
+
+        # The batch flags, then three ints per joint: rig ID, joint ID and the
+        # dirtied channels.
+        changes = cmds.mannequinContext(currentContext,
+                                        q=True,
+                                        dirtyJoints=True) or [0]
+        flags = changes[0]
+
+        if flags & BATCH_FULL_REFRESH:
+            self.updateAllPanels()
+            self.updateAllKeyStatuses()
+            return
+
+        if flags & BATCH_TIME_CHANGED:
+            self.updateAllKeyStatuses()
+
+        changedNodeNames = []
+        for i in range(1, len(changes), 3):
+            nodeName = self.jointNames.get((changes[i], changes[i + 1]))
+            channels = changes[i + 2]
+            if nodeName is None:
                 continue
 
-            panelGui = self.panels[(nodeName, style)]
-            dagPath = self.dagPaths[nodeName]
+            if ((channels & ROTATE_CHANNELS and
+                    (nodeName, "r") in self.panels) or
+                    (channels & TRANSLATE_CHANNELS and
+                     (nodeName, "t") in self.panels)):
+                changedNodeNames.append(nodeName)
+        self.syncPanels(changedNodeNames)
 
-            if style == "r":
-                self.updatePanelRotation(panelGui, dagPath)
-            elif style == "t":
-                self.updatePanelTranslation(panelGui, dagPath)
+    def updateAllPanels(self):
+        """Refreshes the values of every panel in view."""
 
-        self.updateQueue = []
+        self.syncPanels(set(nodeName for (nodeName, _) in self.panels))
 
-    def animKeyframeCallback(self, objects, data):
-        self.updateAllKeyStatuses()
+    def syncPanels(self, nodeNames):
+        """Refreshes the values of the panels in view for the given joints
+        with one mannequinPose query.
 
-    def timeChangedCallback(self):
-        self.updateAllKeyStatuses()
+        :param nodeNames: the full DAG paths of the joints
+        :type nodeNames: collections.Iterable[str]
+        """
 
-    def updateAllKeyStatuses(self):
-        currentTime = cmds.currentTime(query=True)
-        timeRange = (currentTime, currentTime)
-        for ((nodeName, style), panel) in self.panels.iteritems():
-            if style == "r":
-                xKeyed = cmds.keyframe("{0}.rotateX".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-                yKeyed = cmds.keyframe("{0}.rotateY".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-                zKeyed = cmds.keyframe("{0}.rotateZ".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-            elif style == "t":
-                xKeyed = cmds.keyframe("{0}.translateX".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-                yKeyed = cmds.keyframe("{0}.translateY".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-                zKeyed = cmds.keyframe("{0}.translateZ".format(nodeName),
-                                       time=timeRange,
-                                       query=True,
-                                       keyframeCount=True)
-            else:
-                continue
+        nodeNames = list(nodeNames)
+        if not nodeNames:
+            return
 
-            panel.xEdit.setStyleSheet(MannequinStylesheets.STYLE_FIELD_KEYED
-                                      if xKeyed > 0 else "")
-            panel.yEdit.setStyleSheet(MannequinStylesheets.STYLE_FIELD_KEYED
-                                      if yKeyed > 0 else "")
-            panel.zEdit.setStyleSheet(MannequinStylesheets.STYLE_FIELD_KEYED
-                                      if zKeyed > 0 else "")
+        # Six values per joint: translate X/Y/Z, then rotate X/Y/Z.
+        values = cmds.mannequinPose(nodeNames, q=True) or []
+        for (i, nodeName) in enumerate(nodeNames):
+            panelGui = self.panels.get((nodeName, "t"))
+            if panelGui is not None:
+                self.updatePanelValues(panelGui, values[i * 6:i * 6 + 3])
+            panelGui = self.panels.get((nodeName, "r"))
+            if panelGui is not None:
+                self.updatePanelValues(panelGui, values[i * 6 + 3:i * 6 + 6])
 
-    @staticmethod
-    def updatePanelRotation(panelGui, dagPath):
-        """Sets the panel rotation in internal units (probably radians).
+    def animKeyframeCallback(self, objects, data):
+        # Wait until the edit is done so that the index sees the new keys; one
+        # refresh covers every key edited in the meantime.
+        if not self.keyStatusPending:
+            self.keyStatusPending = True
+            cmds.evalDeferred(self.updateAllKeyStatuses, low=True)
 
-        :param panelGui: the panel widget whose rotation data needs updating
-        :type panelGui: QWidget
-        :param dagPath: the DAG path of the transform to get data from
-        :type dagPath: om.MDagPath
-        :return:
+    def updateAllKeyStatuses(self):
+        """Fetches the keyed channels of every joint in one query and marks
+        the fields of the panels in view.
         """
 
-        objectXform = om.MFnTransform(dagPath)
-        rotation = objectXform.rotation()
+        self.keyStatusPending = False
+
+        currentContext = cmds.currentCtx()
+        if cmds.contextInfo(currentContext, c=True) != "mannequinContext":
+            return
 
-        xx = om.MAngle.internalToUI(rotation.x)
-        panelGui.xEdit.setText("{:.3f}".format(xx))
+        self.keyStatus = cmds.mannequinContext(currentContext,
+                                               q=True,
+                                               keyStatus=True) or []
+        for ((nodeName, style), panel) in self.panels.iteritems():
+            self.updatePanelKeyStatus(panel, style,
+                                      self.jointKeyStatus(nodeName))
 
-        yy = om.MAngle.internalToUI(rotation.y)
-        panelGui.yEdit.setText("{:.3f}".format(yy))
+    def jointKeyStatus(self, nodeName):
+        """Gets the keyed channels of a joint from the last key status query.
 
-        zz = om.MAngle.internalToUI(rotation.z)
-        panelGui.zEdit.setText("{:.3f}".format(zz))
+        :param nodeName: the full DAG path of the joint
+        :type nodeName: str
+        :returns: a bitmask with bits 0-2 for translate X/Y/Z and 3-5 for
+                  rotate X/Y/Z
+        :rtype: int
+        """
+
+        index = self.jointIndices.get(nodeName)
+        if index is None or index >= len(self.keyStatus):
+            return 0
+        return self.keyStatus[index]
 
     @staticmethod
-    def updatePanelTranslation(panelGui, dagPath):
-        """Sets the panel translation in internal units (probably cm).
+    def updatePanelKeyStatus(panelGui, style, keyedChannels):
+        """Marks the panel's fields whose channels are keyed.
 
-        :param panelGui: the panel widget whose translation data needs updating
+        :param panelGui: the panel widget whose key status needs updating
         :type panelGui: QWidget
-        :param dagPath: the DAG path of the transform to get data from
-        :type dagPath: om.MDagPath
-        :return:
+        :param style: the presentation style of the panel
+        :type style: str
+        :param keyedChannels: the joint's bitmask from the key status query
+        :type keyedChannels: int
         """
 
-        objectXform = om.MFnTransform(dagPath)
-        translation = objectXform.translation(om.MSpace.kTransform)
+        if style == "r":
+            shift = 3
+        elif style == "t":
+            shift = 0
+        else:
+            return
 
-        xx = om.MDistance.internalToUI(translation.x)
-        panelGui.xEdit.setText("{:.3f}".format(xx))
+        edits = (panelGui.xEdit, panelGui.yEdit, panelGui.zEdit)
+        for (i, edit) in enumerate(edits):
+            keyed = keyedChannels & (1 << (shift + i))
+            edit.setStyleSheet(MannequinStylesheets.STYLE_FIELD_KEYED
+                               if keyed else "")
 
-        yy = om.MDistance.internalToUI(translation.y)
-        panelGui.yEdit.setText("{:.3f}".format(yy))
+    @staticmethod
+    def updatePanelValues(panelGui, values):
+        """Shows a joint's rotation or translation in the panel.
 
-        zz = om.MDistance.internalToUI(translation.z)
-        panelGui.zEdit.setText("{:.3f}".format(zz))
+        :param panelGui: the panel widget whose values need updating
+        :type panelGui: QWidget
+        :param values: the X, Y and Z values in UI units
+        :type values: list[float]
+        """
 
-    def setRotation(self, dagPath, index):
-        """Updates a joint's rotation from its corresponding panel.
+        edits = (panelGui.xEdit, panelGui.yEdit, panelGui.zEdit)
+        for (edit, value) in zip(edits, values):
+            edit.setText("{:.3f}".format(value))
 
-        :param dagPath: the DAG path to update
-        :type dagPath: om.MDagPath
-        :param index: the component of the object's rotation that needs
-                      updating, e.g. 0=X, 1=Y, 2=Z
-        :type index: int
-        """
+    def panelEdited(self, panel, index):
+        """Applies a text box edit to the joint the panel is bound to.
 
-        nodeName = dagPath.fullPathName()
-        panelGui = self.panels[(nodeName, "r")]
-
-        # Because I'm lazy, I'm going to use the setAttr command!
-        # This means that we won't have to convert units -- they should already
-        # be in the UI units, which MEL expects.
-        if index == 0 and panelGui.xEdit.isModified():
-            x = float(panelGui.xEdit.text())
-            mel.eval("setAttr {0}.rotateX {1}".format(nodeName, x))
-        elif index == 1 and panelGui.yEdit.isModified():
-            y = float(panelGui.yEdit.text())
-            mel.eval("setAttr {0}.rotateY {1}".format(nodeName, y))
-        elif index == 2 and panelGui.zEdit.isModified():
-            z = float(panelGui.zEdit.text())
-            mel.eval("setAttr {0}.rotateZ {1}".format(nodeName, z))
-
-        self.updatePanelRotation(panelGui, dagPath)
-
-    def setTranslation(self, dagPath, index):
-        """Updates a joint's translation from its corresponding panel.
-
-        :param dagPath: the DAG path to update
-        :type dagPath: om.MDagPath
-        :param index: the component of the object's translation that needs
-                      updating, e.g. 0=X, 1=Y, 2=Z
+        :param panel: the panel that was edited
+        :type panel: JointPanel
+        :param index: the component that was edited, e.g. 0=X, 1=Y, 2=Z
         :type index: int
         """
 
-        nodeName = dagPath.fullPathName()
-        panelGui = self.panels[(nodeName, "t")]
+        if panel.nodeName is None:
+            return
+
+        if panel.style == "r":
+            flags = {"rotate": True}
+        elif panel.style == "t":
+            flags = {"translate": True}
+        else:
+            return
 
-        # Because I'm lazy, I'm going to use the setAttr command!
-        # This means that we won't have to convert units -- they should already
-        # be in the UI units, which MEL expects.
-        if index == 0 and panelGui.xEdit.isModified():
-            x = float(panelGui.xEdit.text())
-            mel.eval("setAttr {0}.translateX {1}".format(nodeName, x))
-        elif index == 1 and panelGui.yEdit.isModified():
-            y = float(panelGui.yEdit.text())
-            mel.eval("setAttr {0}.translateY {1}".format(nodeName, y))
-        elif index == 2 and panelGui.zEdit.isModified():
-            z = float(panelGui.zEdit.text())
-            mel.eval("setAttr {0}.translateZ {1}".format(nodeName, z))
+        # Write back the other components as they are rather than as the
+        # rounded text in their fields; mannequinPose skips them since they
+        # haven't changed.
+        panelGui = panel.gui
+        edit = (panelGui.xEdit, panelGui.yEdit, panelGui.zEdit)[index]
+        if edit.isModified():
+            values = cmds.mannequinPose(panel.nodeName, q=True, **flags)
+            values[index] = float(edit.text())
+            cmds.mannequinPose(panel.nodeName, e=True, values=values, **flags)
 
-        self.updatePanelTranslation(panelGui, dagPath)
+        self.syncPanels([panel.nodeName])
 
     def search(self, text):
         """Performs type-to-search using the given textual substring.
@@ -542,26 +767,46 @@ class MannequinToolPanel:
         :type text: str
         """
 
-        for panel in self.panels.itervalues():
-            displayName = panel.groupBox.title()
-            if text.lower() in displayName.lower():
-                panel.show()
-            else:
-                panel.hide()
+        self.searchText = text.lower()
+
+        # Keep rows where any joint matches; non-matching joints in a kept
+        # row are hidden when the row is bound.
+        self.visibleRows = []
+        self.rowIndices = {}
+        for row in self.rows:
+            matches = []
+            for jointInfo in row.joints:
+                displayName = jointInfo.name
+                if len(displayName) > self.prefixTrim:
+                    displayName = displayName[self.prefixTrim:]
+                if self.searchText in displayName.lower():
+                    matches.append(jointInfo)
+
+            if not matches:
+                continue
+
+            for jointInfo in matches:
+                nodeId = (jointInfo.fullPath, row.style)
+                self.rowIndices[nodeId] = len(self.visibleRows)
+            self.visibleRows.append(row)
+
+        # Row indices changed, so every bound row needs rebinding.
+        for index in self.rowWidgets.keys():
+            self.releaseRow(index)
 
-        self.gui.layout().activate()
         self.relayout()
-        QTimer.singleShot(0, self.relayout)
+        self.updateVisibleRows()
 
     def relayout(self):
-        """This function needs to be called whenever joint display panels are
-        hidden or shown inside the Mannequin panel.
+        """This function needs to be called whenever the number of visible
+        rows inside the Mannequin panel changes.
         """
 
-        self.gui.setMinimumHeight(self.gui.sizeHint().height())
-        self.gui.setMaximumHeight(self.gui.sizeHint().height())
-        self.parent.setMinimumHeight(self.gui.sizeHint().height())
-        self.parent.setMaximumHeight(self.gui.sizeHint().height())
+        height = len(self.visibleRows) * self.ROW_HEIGHT
+        self.gui.setMinimumHeight(height)
+        self.gui.setMaximumHeight(height)
+        self.parent.setMinimumHeight(height)
+        self.parent.setMaximumHeight(height)
 
     @staticmethod
     def scrollEnsureVisible(y, height, margin=50):
@@ -616,12 +861,15 @@ def setupMannequinUI():
     """Sets up the side panel UI for the Mannequin plugin."""
 
     currentContext = cmds.currentCtx()
-    influenceObjectsStr = cmds.mannequinContext(currentContext,
-                                                q=True,
-                                                io=True)
-    ioTokens = influenceObjectsStr.split(" ")
-    ioDagPaths = ioTokens[::2]
-    ioAvailableStyles = ioTokens[1::2]
+    # Five strings per joint: rig ID, joint ID, parent ID, styles, full path.
+    jointInfo = cmds.mannequinContext(currentContext,
+                                      q=True,
+                                      jointInfo=True) or []
+    # The parent ID isn't needed here.
+    ioRigIds = [int(x) for x in jointInfo[0::5]]
+    ioJointIds = [int(x) for x in jointInfo[1::5]]
+    ioAvailableStyles = jointInfo[3::5]
+    ioDagPaths = jointInfo[4::5]
 
     mannequinDockPtr = MQtUtil.findLayout("mannequinPaletteDock")
     mannequinDock = wrapInstance(long(mannequinDockPtr), QWidget)
@@ -638,26 +886,29 @@ def setupMannequinUI():
     gui = mannequinToolPanel.loader.load(uiFile, parentWidget=mannequinLayout)
     uiFile.close()
 
-    selList = om.MSelectionList()
-    for obj in ioDagPaths:
-        selList.add(obj)
+    # Characters that share a skeleton list the same joint once per rig, but
+    # the palette shows each joint once.
+    uniquePaths = OrderedDict()
+    for fullPath, styles in zip(ioDagPaths, ioAvailableStyles):
+        uniquePaths.setdefault(fullPath, styles)
 
-    joints = []
-    for i in range(selList.length()):
-        dagPath = selList.getDagPath(i)
-        dependNode = selList.getDependNode(i)
-        styles = ioAvailableStyles[i]
-
-        joints.append(JointInfo(dagPath, dependNode, styles))
+    names = shortNames(uniquePaths.keys())
+    joints = [JointInfo(fullPath, names[fullPath], styles)
+              for fullPath, styles in uniquePaths.items()]
 
     # Alphabetize joints by full DAG path; should sort slightly better.
-    joints = sorted(joints, key=lambda j: j.dagPath.fullPathName())
+    joints = sorted(joints, key=lambda j: j.fullPath)
+
+    mannequinScrollPtr = MQtUtil.findLayout("mannequinScrollLayout")
+    mannequinScroll = wrapInstance(long(mannequinScrollPtr), QScrollArea)
 
     prefixTrim = commonPrefix(joints)
     mannequinToolPanel.reset(mannequinLayout,
                              gui,
+                             mannequinScroll,
                              mannequinSearch,
-                             prefixTrim)
+                             prefixTrim,
+                             zip(ioRigIds, ioJointIds, ioDagPaths))
 
     jointDisplays = organizeJoints(joints)
     for jointDisplay in jointDisplays:
@@ -703,8 +954,7 @@ def organizeJoints(joints):
         return count
 
     # Combine joints with similar names.
-    strippedJointNames = [stripName(x.dagPath.partialPathName())
-                          for x in joints]
+    strippedJointNames = [stripName(x.name) for x in joints]
     jointGroups = OrderedDict()
     for i in range(len(strippedJointNames)):
         strippedName = strippedJointNames[i]
@@ -738,14 +988,8 @@ def organizeJoints(joints):
         # Determine if the group is a true left-right pair using Maya's
         # joint labels. If possible, insert a left-right double panel.
         # side: 0=center, 1=left, 2=right, 3=none
-        dependNode0 = om.MFnDependencyNode(joint0.dependNode)
-        dependNode1 = om.MFnDependencyNode(joint1.dependNode)
-        attr0 = dependNode0.attribute("side")
-        attr1 = dependNode1.attribute("side")
-        plug0 = dependNode0.findPlug(attr0, True)
-        plug1 = dependNode1.findPlug(attr1, True)
-        side0 = plug0.asInt()
-        side1 = plug1.asInt()
+        side0 = jointSide(joint0.fullPath)
+        side1 = jointSide(joint1.fullPath)
         if side0 == 1 and side1 == 2:  # left, right
             jointPairs.append([joint0, joint1])
             continue
@@ -755,10 +999,10 @@ def organizeJoints(joints):
 
         # If joint labels are not conclusive, then try to use a heuristic
         # based on the joint names.
-        lfHeuristic0 = leftHeuristic(joint0.dagPath.partialPathName())
-        lfHeuristic1 = leftHeuristic(joint1.dagPath.partialPathName())
-        rtHeuristic0 = rightHeuristic(joint0.dagPath.partialPathName())
-        rtHeuristic1 = rightHeuristic(joint1.dagPath.partialPathName())
+        lfHeuristic0 = leftHeuristic(joint0.name)
+        lfHeuristic1 = leftHeuristic(joint1.name)
+        rtHeuristic0 = rightHeuristic(joint0.name)
+        rtHeuristic1 = rightHeuristic(joint1.name)
 
         if lfHeuristic0 >= lfHeuristic1 and rtHeuristic1 >= rtHeuristic0:
             jointPairs.append([joint0, joint1])
@@ -783,30 +1027,75 @@ def commonPrefix(joints):
               or 0 if there is no such prefix
     :rtype: int
     """
-    jointNames = [x.dagPath.partialPathName() for x in joints]
+    jointNames = [x.name for x in joints]
     prefix = os.path.commonprefix(jointNames)
     return len(prefix)
 
 
-def mannequinSelectionChanged(dagString, style):
-    """Callback from the C++ MannequinContext when its selection changes.
+def shortNames(fullPaths):
+    """Finds the shortest suffix of each full DAG path that no other path in
+    the list ends with, like MDagPath.partialPathName() does within the list.
 
-    This callback may be the result of a Python-initiated selection change.
+    :param fullPaths: unique full DAG paths
+    :type fullPaths: list[str]
+    :returns: the short name of each full DAG path
+    :rtype: dict[str, str]
+    """
 
-    :param dagString: the full DAG path of the new selection, or the empty
-                      string if there is no selection
-    :type dagString: str
-    :param style: either the string "r" or "t" indicating the current
-                  presentation style for the selection
-    :type style: str
+    names = {}
+    pending = list(fullPaths)
+    depth = 1
+    while pending:
+        suffixes = {}
+        for fullPath in pending:
+            suffix = "|".join(fullPath.split("|")[-depth:])
+            suffixes.setdefault(suffix, []).append(fullPath)
+
+        pending = []
+        for suffix, matches in suffixes.items():
+            if len(matches) == 1 or depth >= matches[0].count("|"):
+                for fullPath in matches:
+                    names[fullPath] = suffix.lstrip("|")
+            else:
+                pending += matches
+        depth += 1
+
+    return names
+
+
+def jointSide(fullPath):
+    """Reads the side of a joint's Maya joint label.
+
+    :param fullPath: the full DAG path of the joint
+    :type fullPath: str
+    :returns: 0 for center, 1 for left, 2 for right, or 3 for none or if the
+              node isn't a joint
+    :rtype: int
     """
 
-    try:
-        selList = om.MSelectionList()
-        selList.add(dagString)
-        dagPath = selList.getDagPath(0)
-        mannequinToolPanel.select(dagPath, style)
-    except:
+    if not cmds.attributeQuery("side", node=fullPath, exists=True):
+        return 3
+    return cmds.getAttr(fullPath + ".side")
+
+
+def mannequinSelectionChanged(clientData=None):
+    """Listener for the mannequinSelectionChanged user event, which the C++
+    MannequinContext posts once Maya is idle after its selection changes.
+
+    The event may be the result of a Python-initiated selection change.
+
+    :param clientData: unused
+    """
+
+    currentContext = cmds.currentCtx()
+    if cmds.contextInfo(currentContext, c=True) != "mannequinContext":
+        return
+
+    # Either [fullPathName, style] or empty if nothing is selected.
+    selection = cmds.mannequinContext(currentContext, q=True, sel=True)
+    if selection:
+        mannequinToolPanel.select(selection[0], selection[1])
+    else:
         mannequinToolPanel.select(None)
 
 
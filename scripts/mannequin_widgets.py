@@ -1,5 +1,4 @@
 from maya import cmds
-from maya import mel
 from maya.api import OpenMaya as om
 
 from PySide.QtCore import *
@@ -98,18 +97,13 @@ class DragRotationWidget(DragWidget):
         objectXform = om.MFnTransform(self.dagPath)
         objectXform.setRotation(self.originalRotation, om.MSpace.kTransform)
 
-        # Argggh, have to convert between degrees and radians.
+        # Set it again as one undoable edit; mannequinPose takes UI units and
+        # skips the components that didn't change.
         if not self.newRotation.isEquivalent(self.originalRotation):
-            nodeName = self.dagPath.partialPathName()
-            if self.index == 0:
-                x = om.MAngle.internalToUI(self.newRotation.x)
-                mel.eval("setAttr {0}.rotateX {1}".format(nodeName, x))
-            elif self.index == 1:
-                y = om.MAngle.internalToUI(self.newRotation.y)
-                mel.eval("setAttr {0}.rotateY {1}".format(nodeName, y))
-            elif self.index == 2:
-                z = om.MAngle.internalToUI(self.newRotation.z)
-                mel.eval("setAttr {0}.rotateZ {1}".format(nodeName, z))
+            values = [om.MAngle.internalToUI(self.newRotation[i])
+                      for i in range(3)]
+            cmds.mannequinPose(self.dagPath.fullPathName(), e=True,
+                               rotate=True, values=values)
 
         self.originalRotation = None
         self.newRotation = None
@@ -151,18 +145,13 @@ class DragTranslationWidget(DragWidget):
         objectXform.setTranslation(self.originalTranslation,
                                    om.MSpace.kTransform)
 
-        # Argggh, have to convert between cms and display distance units.
+        # Set it again as one undoable edit; mannequinPose takes UI units and
+        # skips the components that didn't change.
         if not self.newTranslation.isEquivalent(self.originalTranslation):
-            nodeName = self.dagPath.partialPathName()
-            if self.index == 0:
-                x = om.MDistance.internalToUI(self.newTranslation.x)
-                mel.eval("setAttr {0}.translateX {1}".format(nodeName, x))
-            elif self.index == 1:
-                y = om.MDistance.internalToUI(self.newTranslation.y)
-                mel.eval("setAttr {0}.translateY {1}".format(nodeName, y))
-            elif self.index == 2:
-                z = om.MDistance.internalToUI(self.newTranslation.z)
-                mel.eval("setAttr {0}.translateZ {1}".format(nodeName, z))
+            values = [om.MDistance.internalToUI(self.newTranslation[i])
+                      for i in range(3)]
+            cmds.mannequinPose(self.dagPath.fullPathName(), e=True,
+                               translate=True, values=values)
 
         self.originalTranslation = None
         self.newTranslation = None
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <limits>
+
+// A point in time after which interruptible work should give up and let the
+// caller fall back to an older result. A budget of zero or less never
+// expires.
+class Deadline {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  explicit Deadline(double budgetMs)
+    : _limited(budgetMs > 0.0),
+      _expired(false) {
+    if (_limited) {
+      _end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(budgetMs));
+    }
+  }
+
+  // Reads the clock, so callers in tight loops should only check every so
+  // often. Once expired, stays expired.
+  bool expired() {
+    if (_limited && !_expired) {
+      _expired = Clock::now() >= _end;
+    }
+    return _expired;
+  }
+
+  // Gives up early, e.g. when the work is known not to fit.
+  void expire() {
+    _expired = _limited;
+  }
+
+  bool wasExceeded() const {
+    return _expired;
+  }
+
+  double remainingMs() const {
+    if (!_limited) {
+      return std::numeric_limits<double>::max();
+    }
+
+    std::chrono::duration<double, std::milli> remaining = _end - Clock::now();
+    return remaining.count();
+  }
+
+private:
+  bool _limited;
+  bool _expired;
+  Clock::time_point _end;
+};
@@ -0,0 +1,341 @@
+#include "face_cache.h"
+#include "face_influences.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#include <sys/stat.h>
+#if defined(_MSC_VER)
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <maya/MArrayDataHandle.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MDataHandle.h>
+#include <maya/MFnSkinCluster.h>
+#include <maya/MGlobal.h>
+#include <maya/MPlug.h>
+#include <maya/MStringArray.h>
+
+namespace {
+  const char MAGIC[4] = { 'M', 'Q', 'F', 'C' };
+
+  static_assert(sizeof(int) == sizeof(int32_t),
+    "face tables are stored as int32");
+
+  // The face table follows the header directly as numFaces int32 values.
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;
+    uint32_t numFaces;
+    uint32_t numInfluences;
+  };
+
+  MString cacheDirectory() {
+    MString userAppDir;
+    MGlobal::executeCommand("internalVar -userAppDir", userAppDir);
+    return userAppDir + "mannequin/faceCache/";
+  }
+
+  // Every rig edit writes a new entry, so the directory is trimmed back to
+  // these limits after each save, least recently used first.
+  const unsigned int MAX_ENTRIES = 64;
+  const uint64_t MAX_BYTES = 256ULL * 1024 * 1024;
+
+  struct CacheEntry {
+    MString path;
+    time_t mtime;
+    uint64_t size;
+  };
+
+  MString cachePath(uint64_t fingerprint) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mfc",
+      (unsigned long long)fingerprint);
+    return cacheDirectory() + name;
+  }
+
+  // Deletes the oldest entries, by modification time, until the directory is
+  // within MAX_ENTRIES and MAX_BYTES. Loads touch their entry, so the
+  // modification time doubles as the last use.
+  void evict(const MString& keepPath) {
+    MString directory = cacheDirectory();
+    MStringArray names;
+    MGlobal::executeCommand("getFileList -folder \"" + directory +
+      "\" -filespec \"*.mfc\"", names);
+
+    std::vector<CacheEntry> entries;
+    uint64_t totalSize = 0;
+    for (unsigned int i = 0; i < names.length(); ++i) {
+      CacheEntry entry;
+      entry.path = directory + names[i];
+
+      struct stat info;
+      if (stat(entry.path.asChar(), &info) != 0) {
+        continue;
+      }
+
+      entry.mtime = info.st_mtime;
+      entry.size = (uint64_t)info.st_size;
+      totalSize += entry.size;
+      entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(),
+      [](const CacheEntry& a, const CacheEntry& b) {
+        return a.mtime < b.mtime;
+      });
+
+    size_t numEntries = entries.size();
+    for (const CacheEntry& entry : entries) {
+      if (numEntries <= MAX_ENTRIES && totalSize <= MAX_BYTES) {
+        break;
+      }
+
+      // Never evict the entry that was just written.
+      if (entry.path == keepPath) {
+        continue;
+      }
+
+      if (std::remove(entry.path.asChar()) == 0) {
+        --numEntries;
+        totalSize -= entry.size;
+      }
+    }
+  }
+
+  // Hashes the weightList straight out of the skin's data block, which is
+  // a single pass without building a plug per weight.
+  MStatus hashWeights(MObject skinObj, Fingerprint& fingerprint) {
+    MStatus err;
+    MFnSkinCluster skin(skinObj, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    MPlug weightListPlug = skin.findPlug("weightList", &err);
+    if (err.error()) {
+      return err;
+    }
+
+    MObject weightsAttr = skin.attribute("weights", &err);
+    if (err.error()) {
+      return err;
+    }
+
+    MDataHandle weightListData = weightListPlug.asMDataHandle(
+      MDGContext::fsNormal, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    do {
+      MArrayDataHandle weightListArray(weightListData, &err);
+      if (err.error()) {
+        break;
+      }
+
+      unsigned int numVertices = weightListArray.elementCount();
+      for (unsigned int i = 0; i < numVertices; ++i) {
+        weightListArray.jumpToArrayElement(i);
+        uint32_t vtx = weightListArray.elementIndex();
+
+        MArrayDataHandle weightsArray(
+          weightListArray.inputValue().child(weightsAttr), &err);
+        if (err.error()) {
+          break;
+        }
+
+        unsigned int numWeights = weightsArray.elementCount();
+        for (unsigned int j = 0; j < numWeights; ++j) {
+          weightsArray.jumpToArrayElement(j);
+          double weight = weightsArray.inputValue().asDouble();
+          if (weight == 0.0) {
+            continue;
+          }
+
+          uint32_t logical = weightsArray.elementIndex();
+          fingerprint.add(vtx);
+          fingerprint.add(logical);
+          fingerprint.add(weight);
+        }
+      }
+    } while (false);
+
+    weightListPlug.destructHandle(weightListData);
+    return err;
+  }
+}
+
+Fingerprint::Fingerprint() : _hash(14695981039346656037ULL) {}
+
+void Fingerprint::add(const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    _hash ^= bytes[i];
+    _hash *= 1099511628211ULL;
+  }
+}
+
+void Fingerprint::add(const MString& string) {
+  uint32_t length = string.length();
+  add(length);
+  add(string.asChar(), length);
+}
+
+uint64_t Fingerprint::value() const {
+  return _hash;
+}
+
+MStatus FaceCache::fingerprint(const MeshTopology& topology, MObject skinObj,
+  uint64_t& result) {
+  MStatus err;
+  MFnSkinCluster skin(skinObj, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  Fingerprint fingerprint;
+  fingerprint.add(FORMAT_VERSION);
+
+  const std::vector<unsigned int>& faceOffsets = topology.faceOffsets();
+  const std::vector<unsigned int>& faceVertices = topology.faceVertices();
+  fingerprint.add(uint64_t(faceOffsets.size()));
+  fingerprint.add(faceOffsets.data(),
+    faceOffsets.size() * sizeof(unsigned int));
+  fingerprint.add(faceVertices.data(),
+    faceVertices.size() * sizeof(unsigned int));
+
+  // The influence order and logical indices decide which influence each
+  // stored index refers to, so they're part of the key too.
+  MDagPathArray influenceObjects;
+  unsigned int numInfluences = skin.influenceObjects(influenceObjects, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  fingerprint.add(numInfluences);
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    uint32_t logical = skin.indexForInfluenceObject(influenceObjects[i], &err);
+    if (err.error()) {
+      return err;
+    }
+
+    fingerprint.add(influenceObjects[i].fullPathName());
+    fingerprint.add(logical);
+  }
+
+  err = hashWeights(skinObj, fingerprint);
+  if (err.error()) {
+    return err;
+  }
+
+  result = fingerprint.value();
+  return MS::kSuccess;
+}
+
+bool FaceCache::load(uint64_t fingerprint, unsigned int numFaces,
+  unsigned int numInfluences, std::vector<int>& maxInfluences) {
+  using namespace boost::interprocess;
+
+  MString path = cachePath(fingerprint);
+  std::ifstream probe(path.asChar(), std::ios::binary);
+  if (!probe.good()) {
+    return false;
+  }
+  probe.close();
+
+  try {
+    file_mapping file(path.asChar(), read_only);
+    mapped_region region(file, read_only);
+
+    size_t expectedSize =
+      sizeof(FileHeader) + size_t(numFaces) * sizeof(int32_t);
+    if (region.get_size() != expectedSize) {
+      return false;
+    }
+
+    const char* data = static_cast<const char*>(region.get_address());
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(FileHeader));
+
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.version != FORMAT_VERSION ||
+        header.fingerprint != fingerprint ||
+        header.numFaces != numFaces ||
+        header.numInfluences != numInfluences) {
+      return false;
+    }
+
+    const int32_t* faces =
+      reinterpret_cast<const int32_t*>(data + sizeof(FileHeader));
+
+    // Reject out-of-range entries rather than trusting a damaged file.
+    for (unsigned int i = 0; i < numFaces; ++i) {
+      if (faces[i] < 0 || (unsigned int)faces[i] >= numInfluences) {
+        return false;
+      }
+    }
+
+    maxInfluences.assign(faces, faces + numFaces);
+  } catch (const interprocess_exception&) {
+    return false;
+  }
+
+  // Mark the entry as recently used so that evict() keeps it. This happens
+  // after the mapping is gone because Windows won't touch a mapped file.
+  utime(path.asChar(), nullptr);
+  return true;
+}
+
+MStatus FaceCache::save(uint64_t fingerprint, unsigned int numInfluences,
+  const std::vector<int>& maxInfluences) {
+  MString directory = cacheDirectory();
+  MGlobal::executeCommand("sysFile -makeDir \"" + directory + "\"");
+
+  FileHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = FORMAT_VERSION;
+  header.fingerprint = fingerprint;
+  header.numFaces = (uint32_t)maxInfluences.size();
+  header.numInfluences = numInfluences;
+
+  // Write to a temporary file and move it into place so that readers never
+  // see a partially written entry.
+  MString path = cachePath(fingerprint);
+  MString tempPath = path + ".tmp";
+  {
+    std::ofstream out(tempPath.asChar(), std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+      return MS::kFailure;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+    out.write(reinterpret_cast<const char*>(maxInfluences.data()),
+      maxInfluences.size() * sizeof(int32_t));
+
+    if (!out.good()) {
+      out.close();
+      std::remove(tempPath.asChar());
+      return MS::kFailure;
+    }
+  }
+
+  std::remove(path.asChar());
+  if (std::rename(tempPath.asChar(), path.asChar()) != 0) {
+    std::remove(tempPath.asChar());
+    return MS::kFailure;
+  }
+
+  evict(path);
+  return MS::kSuccess;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <maya/MObject.h>
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+
+class MeshTopology;
+
+// Incremental 64-bit FNV-1a hash.
+class Fingerprint {
+public:
+  Fingerprint();
+  void add(const void* data, size_t size);
+  void add(const MString& string);
+  uint64_t value() const;
+
+  template<typename T>
+  void add(const T& value) {
+    add(&value, sizeof(T));
+  }
+
+private:
+  uint64_t _hash;
+};
+
+// Persistent per-face max influence tables, one file per rig under the user
+// app directory. Entries are keyed by a fingerprint of the mesh topology, the
+// influence list and the skin weights, so any edit to the rig simply misses
+// the cache instead of returning stale data. Saving trims the directory back
+// to a fixed number of entries and bytes, least recently used first.
+namespace FaceCache {
+  // Bump whenever the file layout or the face classification rules change.
+  const uint32_t FORMAT_VERSION = 1;
+
+  MStatus fingerprint(const MeshTopology& topology, MObject skinObj,
+    uint64_t& result);
+  bool load(uint64_t fingerprint, unsigned int numFaces,
+    unsigned int numInfluences, std::vector<int>& maxInfluences);
+  MStatus save(uint64_t fingerprint, unsigned int numInfluences,
+    const std::vector<int>& maxInfluences);
+}
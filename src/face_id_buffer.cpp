@@ -0,0 +1,261 @@
+#include "face_id_buffer.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace {
+  const int TILE_SIZE = 32;
+
+  // Vertices this close to or behind the eye can't be projected; triangles
+  // using them are skipped instead of clipped.
+  const float MIN_CLIP_W = 1e-6f;
+
+  inline float edge(const float* a, const float* b, float x, float y) {
+    return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+  }
+}
+
+FaceIdBuffer::FaceIdBuffer()
+  : _width(0),
+    _height(0),
+    _geometryVersion(0),
+    _numRebuilds(0),
+    _lastReason(kNone),
+    _lastRebuildTime(0.0) {}
+
+FaceIdBuffer::Reason FaceIdBuffer::staleReason(const MMatrix& worldToClip,
+  int width, int height, unsigned int geometryVersion) const {
+  if (_faces.empty() || width != _width || height != _height) {
+    return kViewport;
+  }
+
+  if (worldToClip != _worldToClip) {
+    return kCamera;
+  }
+
+  if (geometryVersion != _geometryVersion) {
+    return kGeometry;
+  }
+
+  return kNone;
+}
+
+void FaceIdBuffer::rebuild(const MMatrix& worldToClip, int width, int height,
+  unsigned int geometryVersion,
+  const std::vector<float>& points,
+  const std::vector<unsigned int>& triangleVertices,
+  const std::vector<int>& triangleFaces,
+  unsigned int numThreads,
+  Reason reason) {
+  auto start = std::chrono::steady_clock::now();
+
+  _worldToClip = worldToClip;
+  _width = std::max(width, 0);
+  _height = std::max(height, 0);
+  _geometryVersion = geometryVersion;
+  _faces.assign(size_t(_width) * _height, -1);
+
+  // Project every vertex to window coordinates plus NDC depth. Maya
+  // matrices multiply row vectors from the left.
+  unsigned int numVertices = (unsigned int)points.size() / 3;
+  std::vector<float> screen(numVertices * 3);
+  std::vector<unsigned char> visible(numVertices);
+  Parallel::forRange(numVertices, 4096, numThreads,
+    [&](unsigned int thread, unsigned int begin, unsigned int end) {
+      for (unsigned int v = begin; v < end; ++v) {
+        const float* p = &points[v * 3];
+        double clip[4];
+        for (int i = 0; i < 4; ++i) {
+          clip[i] = p[0] * worldToClip(0, i) + p[1] * worldToClip(1, i) +
+            p[2] * worldToClip(2, i) + worldToClip(3, i);
+        }
+
+        visible[v] = clip[3] > MIN_CLIP_W;
+        if (visible[v]) {
+          screen[v * 3] = float((clip[0] / clip[3] * 0.5 + 0.5) * _width);
+          screen[v * 3 + 1] = float((clip[1] / clip[3] * 0.5 + 0.5) * _height);
+          screen[v * 3 + 2] = float(clip[2] / clip[3]);
+        }
+      }
+    });
+
+  // Bin the triangles into screen tiles so that each tile can be drawn by
+  // one thread without touching any other tile's pixels.
+  int tilesX = (_width + TILE_SIZE - 1) / TILE_SIZE;
+  int tilesY = (_height + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned int numTiles = (unsigned int)(tilesX * tilesY);
+  unsigned int numTriangles = (unsigned int)triangleFaces.size();
+
+  auto tileRange = [&](unsigned int triangle,
+    int& x0, int& y0, int& x1, int& y1) {
+    const unsigned int* tri = &triangleVertices[triangle * 3];
+    if (!visible[tri[0]] || !visible[tri[1]] || !visible[tri[2]]) {
+      return false;
+    }
+
+    const float* a = &screen[tri[0] * 3];
+    const float* b = &screen[tri[1] * 3];
+    const float* c = &screen[tri[2] * 3];
+    float minX = std::min(a[0], std::min(b[0], c[0]));
+    float maxX = std::max(a[0], std::max(b[0], c[0]));
+    float minY = std::min(a[1], std::min(b[1], c[1]));
+    float maxY = std::max(a[1], std::max(b[1], c[1]));
+    if (maxX < 0.0f || maxY < 0.0f || minX >= _width || minY >= _height) {
+      return false;
+    }
+
+    x0 = std::max(0, int(minX)) / TILE_SIZE;
+    y0 = std::max(0, int(minY)) / TILE_SIZE;
+    x1 = std::min(_width - 1, int(maxX)) / TILE_SIZE;
+    y1 = std::min(_height - 1, int(maxY)) / TILE_SIZE;
+    return true;
+  };
+
+  std::vector<unsigned int> tileOffsets(numTiles + 1, 0);
+  for (unsigned int t = 0; t < numTriangles; ++t) {
+    int x0, y0, x1, y1;
+    if (tileRange(t, x0, y0, x1, y1)) {
+      for (int ty = y0; ty <= y1; ++ty) {
+        for (int tx = x0; tx <= x1; ++tx) {
+          ++tileOffsets[ty * tilesX + tx + 1];
+        }
+      }
+    }
+  }
+  for (unsigned int tile = 0; tile < numTiles; ++tile) {
+    tileOffsets[tile + 1] += tileOffsets[tile];
+  }
+
+  std::vector<unsigned int> tileTriangles(tileOffsets[numTiles]);
+  std::vector<unsigned int> next(tileOffsets.begin(), tileOffsets.end() - 1);
+  for (unsigned int t = 0; t < numTriangles; ++t) {
+    int x0, y0, x1, y1;
+    if (tileRange(t, x0, y0, x1, y1)) {
+      for (int ty = y0; ty <= y1; ++ty) {
+        for (int tx = x0; tx <= x1; ++tx) {
+          tileTriangles[next[ty * tilesX + tx]++] = t;
+        }
+      }
+    }
+  }
+
+  // Draw the tiles in parallel, each with its own depth buffer.
+  std::vector<std::vector<float>> depths(
+    Parallel::resolveThreadCount(numThreads));
+  Parallel::forRange(numTiles, 1, (unsigned int)depths.size(),
+    [&](unsigned int thread, unsigned int begin, unsigned int end) {
+      std::vector<float>& depth = depths[thread];
+      depth.resize(TILE_SIZE * TILE_SIZE);
+
+      for (unsigned int tile = begin; tile < end; ++tile) {
+        int tileX0 = int(tile % tilesX) * TILE_SIZE;
+        int tileY0 = int(tile / tilesX) * TILE_SIZE;
+        int tileX1 = std::min(tileX0 + TILE_SIZE, _width);
+        int tileY1 = std::min(tileY0 + TILE_SIZE, _height);
+        std::fill(depth.begin(), depth.end(),
+          std::numeric_limits<float>::max());
+
+        for (unsigned int i = tileOffsets[tile]; i < tileOffsets[tile + 1];
+            ++i) {
+          unsigned int t = tileTriangles[i];
+          const unsigned int* tri = &triangleVertices[t * 3];
+          const float* a = &screen[tri[0] * 3];
+          const float* b = &screen[tri[1] * 3];
+          const float* c = &screen[tri[2] * 3];
+
+          float area = edge(a, b, c[0], c[1]);
+          if (area == 0.0f) {
+            continue;
+          }
+          float invArea = 1.0f / area;
+
+          int x0 = std::max(tileX0,
+            int(std::floor(std::min(a[0], std::min(b[0], c[0])))));
+          int x1 = std::min(tileX1 - 1,
+            int(std::ceil(std::max(a[0], std::max(b[0], c[0])))));
+          int y0 = std::max(tileY0,
+            int(std::floor(std::min(a[1], std::min(b[1], c[1])))));
+          int y1 = std::min(tileY1 - 1,
+            int(std::ceil(std::max(a[1], std::max(b[1], c[1])))));
+
+          // Sample pixel centers; dividing by the signed area makes both
+          // windings come out positive inside the triangle.
+          for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            for (int x = x0; x <= x1; ++x) {
+              float px = x + 0.5f;
+              float w0 = edge(b, c, px, py) * invArea;
+              float w1 = edge(c, a, px, py) * invArea;
+              float w2 = edge(a, b, px, py) * invArea;
+              if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                continue;
+              }
+
+              float z = w0 * a[2] + w1 * b[2] + w2 * c[2];
+              float& pixelDepth =
+                depth[(y - tileY0) * TILE_SIZE + (x - tileX0)];
+              if (z >= -1.0f && z <= 1.0f && z < pixelDepth) {
+                pixelDepth = z;
+                _faces[size_t(y) * _width + x] = triangleFaces[t];
+              }
+            }
+          }
+        }
+      }
+    });
+
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  _lastRebuildTime = elapsed.count();
+  _lastReason = reason;
+  ++_numRebuilds;
+}
+
+void FaceIdBuffer::clear() {
+  _width = 0;
+  _height = 0;
+  _geometryVersion = 0;
+  _faces.clear();
+}
+
+int FaceIdBuffer::faceAt(int x, int y) const {
+  if (x < 0 || y < 0 || x >= _width || y >= _height) {
+    return -1;
+  }
+
+  return _faces[size_t(y) * _width + x];
+}
+
+unsigned int FaceIdBuffer::numRebuilds() const {
+  return _numRebuilds;
+}
+
+FaceIdBuffer::Reason FaceIdBuffer::lastReason() const {
+  return _lastReason;
+}
+
+double FaceIdBuffer::lastRebuildTime() const {
+  return _lastRebuildTime;
+}
+
+int FaceIdBuffer::width() const {
+  return _width;
+}
+
+int FaceIdBuffer::height() const {
+  return _height;
+}
+
+const char* FaceIdBuffer::reasonName(Reason reason) {
+  switch (reason) {
+    case kNone: return "none";
+    case kViewport: return "viewport";
+    case kCamera: return "camera";
+    case kGeometry: return "geometry";
+  }
+
+  return "unknown";
+}
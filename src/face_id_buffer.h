@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MMatrix.h>
+
+// Polygon indices rasterized on the CPU at viewport resolution, so that
+// hovering becomes a single buffer read. The buffer stores faces rather than
+// influences so that weight edits don't invalidate it; it only has to be
+// redrawn when the camera, the viewport size or the deformed points change.
+class FaceIdBuffer {
+public:
+  enum Reason { kNone, kViewport, kCamera, kGeometry };
+
+  FaceIdBuffer();
+  Reason staleReason(const MMatrix& worldToClip, int width, int height,
+    unsigned int geometryVersion) const;
+  void rebuild(const MMatrix& worldToClip, int width, int height,
+    unsigned int geometryVersion,
+    const std::vector<float>& points,
+    const std::vector<unsigned int>& triangleVertices,
+    const std::vector<int>& triangleFaces,
+    unsigned int numThreads,
+    Reason reason);
+  void clear();
+
+  // Polygon under the pixel, or -1 for the background.
+  int faceAt(int x, int y) const;
+
+  unsigned int numRebuilds() const;
+  Reason lastReason() const;
+  double lastRebuildTime() const;
+  int width() const;
+  int height() const;
+
+  static const char* reasonName(Reason reason);
+
+private:
+  MMatrix _worldToClip;
+  int _width;
+  int _height;
+  unsigned int _geometryVersion;
+  std::vector<int> _faces;
+
+  unsigned int _numRebuilds;
+  Reason _lastReason;
+  double _lastRebuildTime;
+};
@@ -0,0 +1,395 @@
+#include "face_influence_map.h"
+#include "face_cache.h"
+
+#include <algorithm>
+
+#include <maya/MDagPathArray.h>
+#include <maya/MFnSkinCluster.h>
+#include <maya/MGlobal.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MPolyMessage.h>
+
+FaceInfluenceMap::FaceInfluenceMap()
+  : _influenceFingerprint(0),
+    _numInfluences(0),
+    _version(0),
+    _allWeightsDirty(false),
+    _topologyDirty(false),
+    _editCallback(nullptr),
+    _editClientData(nullptr) {}
+
+FaceInfluenceMap::~FaceInfluenceMap() {
+  unwatch();
+}
+
+MStatus FaceInfluenceMap::build(const MDagPath& meshDagPath, MObject skinObj,
+  unsigned int numThreads, bool useCache) {
+  clear();
+
+  MStatus err;
+  MFnSkinCluster skin(skinObj, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MDagPathArray influenceObjects;
+  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+
+  err = _topology.read(meshDagPath);
+  if (err.error()) {
+    clear();
+    return err;
+  }
+
+  _meshDagPath = meshDagPath;
+  _skinObject = skinObj;
+  _influenceFingerprint = influenceFingerprint(skinObj);
+  _numInfluences = numInfluences;
+
+  // A rig that was classified in an earlier session can skip building the
+  // weight table and classifying entirely. The weights are only read later
+  // if the rig gets edited.
+  uint64_t fingerprint = 0;
+  useCache = useCache &&
+    !FaceCache::fingerprint(_topology, skinObj, fingerprint).error();
+  if (useCache && FaceCache::load(fingerprint, _topology.numFaces(),
+      numInfluences, _maxInfluences)) {
+    buildInfluenceFaces();
+    watch();
+    return MS::kSuccess;
+  }
+
+  err = classifyAll(numThreads);
+  if (err.error()) {
+    clear();
+    return err;
+  }
+
+  if (useCache) {
+    err = FaceCache::save(fingerprint, numInfluences, _maxInfluences);
+    if (err.error()) {
+      MGlobal::displayWarning("Could not write the Mannequin face cache");
+    }
+  }
+
+  watch();
+  return MS::kSuccess;
+}
+
+bool FaceInfluenceMap::isBuiltFor(const MDagPath& meshDagPath,
+  MObject skinObj) const {
+  // Adding or removing influences renumbers them, so that needs a rebuild.
+  return _callbacks.length() != 0 &&
+    _meshDagPath == meshDagPath &&
+    _skinObject == skinObj &&
+    _influenceFingerprint == influenceFingerprint(skinObj);
+}
+
+void FaceInfluenceMap::update(unsigned int numThreads) {
+  if (!_topologyDirty && !_allWeightsDirty && _dirtyVertices.empty()) {
+    return;
+  }
+
+  MStatus err;
+  do {
+    if (_topologyDirty) {
+      err = _topology.read(_meshDagPath);
+      if (err.error()) {
+        break;
+      }
+
+      _vertexFaceOffsets.clear();
+      _vertexFaces.clear();
+      _allWeightsDirty = true;
+    }
+
+    // Once a good part of the mesh is dirty, the parallel full pass wins.
+    if (_allWeightsDirty ||
+        _maxInfluences.size() != _topology.numFaces() ||
+        _dirtyVertices.size() * 4 > _topology.numFaces()) {
+      err = classifyAll(numThreads);
+      break;
+    }
+
+    // Tables loaded from the face cache come without weights.
+    if (_skinWeights.numVertices() == 0) {
+      err = _skinWeights.read(_meshDagPath, _skinObject);
+    } else {
+      err = _skinWeights.updateRows(_skinObject, _dirtyVertices);
+    }
+
+    if (err.error()) {
+      break;
+    }
+
+    // Without a weightList indexed by mesh vertex, the dirty indices don't
+    // say which faces changed.
+    if (!_skinWeights.canUpdateRows()) {
+      err = classifyAll(numThreads);
+      break;
+    }
+
+    if (_vertexFaceOffsets.empty()) {
+      buildVertexFaces();
+    }
+
+    std::vector<unsigned int> faces;
+    unsigned int numVertices = (unsigned int)_vertexFaceOffsets.size() - 1;
+    for (unsigned int vtx : _dirtyVertices) {
+      if (vtx < numVertices) {
+        faces.insert(faces.end(),
+          _vertexFaces.begin() + _vertexFaceOffsets[vtx],
+          _vertexFaces.begin() + _vertexFaceOffsets[vtx + 1]);
+      }
+    }
+
+    std::sort(faces.begin(), faces.end());
+    faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+
+    // The general kernel is safe for any row length and skips the kernel
+    // calibration, which would cost more than a handful of faces.
+    FaceClassifier classifier(_topology, _skinWeights,
+      FaceClassifier::kGeneral);
+    for (unsigned int face : faces) {
+      setFaceInfluence(face, classifier.classify(face));
+    }
+  } while (false);
+
+  if (err.error()) {
+    _maxInfluences.clear();
+    buildInfluenceFaces();
+  }
+
+  for (unsigned int vtx : _dirtyVertices) {
+    _vertexDirty[vtx] = false;
+  }
+  _dirtyVertices.clear();
+  _allWeightsDirty = false;
+  _topologyDirty = false;
+}
+
+void FaceInfluenceMap::clear() {
+  unwatch();
+
+  _meshDagPath = MDagPath();
+  _skinObject = MObject::kNullObj;
+  _influenceFingerprint = 0;
+  _numInfluences = 0;
+
+  _topology.clear();
+  _skinWeights.clear();
+  _maxInfluences.clear();
+  _influenceFaces.clear();
+  _facePositions.clear();
+  ++_version;
+  _vertexFaceOffsets.clear();
+  _vertexFaces.clear();
+
+  _dirtyVertices.clear();
+  _vertexDirty.clear();
+  _allWeightsDirty = false;
+  _topologyDirty = false;
+}
+
+void FaceInfluenceMap::setEditCallback(EditCallback callback,
+  void* clientData) {
+  _editCallback = callback;
+  _editClientData = clientData;
+}
+
+const std::vector<int>& FaceInfluenceMap::maxInfluences() const {
+  return _maxInfluences;
+}
+
+const std::vector<int>& FaceInfluenceMap::facesForInfluence(
+  int influence) const {
+  static const std::vector<int> empty;
+  if (influence < 0 || influence >= (int)_influenceFaces.size()) {
+    return empty;
+  }
+
+  return _influenceFaces[influence];
+}
+
+unsigned int FaceInfluenceMap::version() const {
+  return _version;
+}
+
+MStatus FaceInfluenceMap::classifyAll(unsigned int numThreads) {
+  MStatus err = _skinWeights.read(_meshDagPath, _skinObject);
+  if (err.error()) {
+    return err;
+  }
+
+  FaceInfluences::classifyAll(_topology, _skinWeights, numThreads,
+    _maxInfluences);
+  buildInfluenceFaces();
+  return MS::kSuccess;
+}
+
+void FaceInfluenceMap::buildInfluenceFaces() {
+  unsigned int numFaces = (unsigned int)_maxInfluences.size();
+
+  // Size each list exactly before filling it.
+  std::vector<unsigned int> counts(_numInfluences, 0);
+  for (int influence : _maxInfluences) {
+    if (influence >= 0 && influence < (int)_numInfluences) {
+      ++counts[influence];
+    }
+  }
+
+  _influenceFaces.resize(_numInfluences);
+  for (unsigned int i = 0; i < _numInfluences; ++i) {
+    _influenceFaces[i].clear();
+    _influenceFaces[i].reserve(counts[i]);
+  }
+
+  _facePositions.resize(numFaces);
+  for (unsigned int face = 0; face < numFaces; ++face) {
+    int influence = _maxInfluences[face];
+    if (influence < 0 || influence >= (int)_numInfluences) {
+      continue;
+    }
+
+    std::vector<int>& faces = _influenceFaces[influence];
+    _facePositions[face] = (unsigned int)faces.size();
+    faces.push_back(face);
+  }
+
+  ++_version;
+}
+
+void FaceInfluenceMap::setFaceInfluence(unsigned int face, int influence) {
+  int oldInfluence = _maxInfluences[face];
+  if (influence == oldInfluence) {
+    return;
+  }
+
+  // Fill the face's old slot with the last face of that influence.
+  std::vector<int>& oldFaces = _influenceFaces[oldInfluence];
+  unsigned int position = _facePositions[face];
+  int movedFace = oldFaces.back();
+  oldFaces[position] = movedFace;
+  _facePositions[movedFace] = position;
+  oldFaces.pop_back();
+
+  std::vector<int>& newFaces = _influenceFaces[influence];
+  _facePositions[face] = (unsigned int)newFaces.size();
+  newFaces.push_back(face);
+  _maxInfluences[face] = influence;
+  ++_version;
+}
+
+void FaceInfluenceMap::markVertexDirty(unsigned int vtx) {
+  if (vtx >= _vertexDirty.size()) {
+    _vertexDirty.resize(vtx + 1, false);
+  }
+
+  if (!_vertexDirty[vtx]) {
+    _vertexDirty[vtx] = true;
+    _dirtyVertices.push_back(vtx);
+  }
+}
+
+void FaceInfluenceMap::notifyEdit() {
+  if (_editCallback) {
+    _editCallback(_editClientData);
+  }
+}
+
+void FaceInfluenceMap::buildVertexFaces() {
+  const std::vector<unsigned int>& faceVertices = _topology.faceVertices();
+  unsigned int numVertices = 0;
+  for (unsigned int vtx : faceVertices) {
+    numVertices = std::max(numVertices, vtx + 1);
+  }
+
+  _vertexFaceOffsets.assign(numVertices + 1, 0);
+  for (unsigned int vtx : faceVertices) {
+    ++_vertexFaceOffsets[vtx + 1];
+  }
+  for (unsigned int vtx = 0; vtx < numVertices; ++vtx) {
+    _vertexFaceOffsets[vtx + 1] += _vertexFaceOffsets[vtx];
+  }
+
+  _vertexFaces.resize(faceVertices.size());
+  std::vector<unsigned int> next(_vertexFaceOffsets.begin(),
+    _vertexFaceOffsets.end() - 1);
+  for (unsigned int face = 0; face < _topology.numFaces(); ++face) {
+    for (unsigned int i = _topology.faceBegin(face);
+        i < _topology.faceEnd(face); ++i) {
+      _vertexFaces[next[faceVertices[i]]++] = face;
+    }
+  }
+}
+
+uint64_t FaceInfluenceMap::influenceFingerprint(MObject skinObj) {
+  MStatus err;
+  MFnSkinCluster skin(skinObj, &err);
+  if (err.error()) {
+    return 0;
+  }
+
+  MDagPathArray influenceObjects;
+  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+
+  Fingerprint fingerprint;
+  fingerprint.add(numInfluences);
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    fingerprint.add(influenceObjects[i].fullPathName());
+  }
+
+  return fingerprint.value();
+}
+
+void FaceInfluenceMap::watch() {
+  MFnSkinCluster skin(_skinObject);
+  _weightListAttr = skin.attribute("weightList");
+  _weightsAttr = skin.attribute("weights");
+
+  MObject meshObj = _meshDagPath.node();
+  _callbacks.append(MNodeMessage::addNodeDirtyPlugCallback(_skinObject,
+    FaceInfluenceMap::skinDirtyCallback, this));
+  _callbacks.append(MPolyMessage::addPolyTopologyChangedCallback(meshObj,
+    FaceInfluenceMap::topologyChangedCallback, this));
+}
+
+void FaceInfluenceMap::unwatch() {
+  if (_callbacks.length() != 0) {
+    MMessage::removeCallbacks(_callbacks);
+    _callbacks.clear();
+  }
+}
+
+void FaceInfluenceMap::skinDirtyCallback(MObject& node, MPlug& plug,
+  void* clientData) {
+  FaceInfluenceMap* map = static_cast<FaceInfluenceMap*>(clientData);
+  if (map->_allWeightsDirty) {
+    return;
+  }
+
+  // Weights live at weightList[vtx].weights[influence]; anything else on the
+  // skinCluster (e.g. the joint matrices while posing) doesn't matter here.
+  MObject attr = plug.attribute();
+  if (attr == map->_weightsAttr) {
+    MPlug vtxPlug = plug.isElement() ? plug.array().parent() : plug.parent();
+    map->markVertexDirty(vtxPlug.logicalIndex());
+  } else if (attr == map->_weightListAttr) {
+    if (plug.isElement()) {
+      map->markVertexDirty(plug.logicalIndex());
+    } else {
+      map->_allWeightsDirty = true;
+    }
+  } else {
+    return;
+  }
+
+  map->notifyEdit();
+}
+
+void FaceInfluenceMap::topologyChangedCallback(MObject& node,
+  void* clientData) {
+  FaceInfluenceMap* map = static_cast<FaceInfluenceMap*>(clientData);
+  map->_topologyDirty = true;
+  map->notifyEdit();
+}
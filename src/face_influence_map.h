@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <maya/MCallbackIdArray.h>
+#include <maya/MDagPath.h>
+#include <maya/MObject.h>
+#include <maya/MPlug.h>
+#include <maya/MStatus.h>
+
+#include "face_influences.h"
+#include "skin_weights.h"
+
+// The influence that owns each face of a skinned mesh, kept up to date while
+// the rig is edited. Weight edits are collected from the skinCluster's dirty
+// plugs and only the faces touching the edited vertices get reclassified;
+// topology changes and edits to the whole weightList rebuild everything.
+// Edits are applied lazily by update(), so a paint stroke that dirties the
+// same vertices many times is only reclassified once.
+// An inverted index lists the faces owned by each influence, so that finding
+// a joint's faces costs as much as the joint's share of the mesh.
+class FaceInfluenceMap {
+public:
+  typedef void (*EditCallback)(void* clientData);
+
+  FaceInfluenceMap();
+  ~FaceInfluenceMap();
+
+  MStatus build(const MDagPath& meshDagPath, MObject skinObj,
+    unsigned int numThreads, bool useCache);
+  bool isBuiltFor(const MDagPath& meshDagPath, MObject skinObj) const;
+  void update(unsigned int numThreads);
+  void clear();
+  // Called from the dirty callbacks whenever update() has work waiting. It
+  // runs inside Maya's dirty propagation, so it should only schedule the
+  // update, not do it.
+  void setEditCallback(EditCallback callback, void* clientData);
+
+  const std::vector<int>& maxInfluences() const;
+  const std::vector<int>& facesForInfluence(int influence) const;
+
+  // Bumped whenever any face changes influence, for consumers that cache
+  // data derived from the face lists.
+  unsigned int version() const;
+
+private:
+  static void skinDirtyCallback(MObject& node, MPlug& plug, void* clientData);
+  static void topologyChangedCallback(MObject& node, void* clientData);
+
+  static uint64_t influenceFingerprint(MObject skinObj);
+  MStatus classifyAll(unsigned int numThreads);
+  void buildInfluenceFaces();
+  void setFaceInfluence(unsigned int face, int influence);
+  void markVertexDirty(unsigned int vtx);
+  void notifyEdit();
+  void buildVertexFaces();
+  void watch();
+  void unwatch();
+
+  MDagPath _meshDagPath;
+  MObject _skinObject;
+  MObject _weightListAttr;
+  MObject _weightsAttr;
+  uint64_t _influenceFingerprint;
+
+  MeshTopology _topology;
+  SkinWeights _skinWeights;
+  unsigned int _numInfluences;
+  std::vector<int> _maxInfluences;
+
+  // Faces of each influence in no particular order, plus each face's slot in
+  // its influence's list so that moving a face is a swap-remove.
+  std::vector<std::vector<int>> _influenceFaces;
+  std::vector<unsigned int> _facePositions;
+  unsigned int _version;
+
+  // Faces around each vertex in CSR form, built on the first partial update.
+  std::vector<unsigned int> _vertexFaceOffsets;
+  std::vector<unsigned int> _vertexFaces;
+
+  std::vector<unsigned int> _dirtyVertices;
+  std::vector<bool> _vertexDirty;
+  bool _allWeightsDirty;
+  bool _topologyDirty;
+
+  EditCallback _editCallback;
+  void* _editClientData;
+  MCallbackIdArray _callbacks;
+};
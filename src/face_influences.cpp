@@ -0,0 +1,435 @@
+#include "face_influences.h"
+#include "skin_weights.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+
+#include <maya/MFnMesh.h>
+#include <maya/MIntArray.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SIMD_ALIGN __declspec(align(16))
+#else
+#define SIMD_ALIGN __attribute__((aligned(16)))
+#endif
+
+namespace Simd {
+
+  // Position of the lowest set bit of a nonzero mask.
+  inline unsigned int lowestSetBit(int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctz((unsigned int)mask);
+#endif
+  }
+
+  // Largest value in the array, or -infinity if it's empty.
+  inline double maxOf(const double* values, unsigned int count) {
+    double result = -std::numeric_limits<double>::infinity();
+    unsigned int i = 0;
+
+#if defined(__AVX2__)
+    __m256d maxes = _mm256_set1_pd(result);
+    for (; i + 4 <= count; i += 4) {
+      maxes = _mm256_max_pd(maxes, _mm256_loadu_pd(values + i));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, maxes);
+    for (double lane : lanes) {
+      result = std::max(result, lane);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d maxes = _mm_set1_pd(result);
+    for (; i + 2 <= count; i += 2) {
+      maxes = _mm_max_pd(maxes, _mm_loadu_pd(values + i));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, maxes);
+    for (double lane : lanes) {
+      result = std::max(result, lane);
+    }
+#endif
+
+    for (; i < count; ++i) {
+      result = std::max(result, values[i]);
+    }
+
+    return result;
+  }
+
+  // Index of the first slot equal to value, or Capacity if there is none.
+  // Capacity must be a multiple of 4 and slots must be 16-byte aligned.
+  template<unsigned int Capacity>
+  inline unsigned int find(const unsigned int* slots, unsigned int value) {
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i needle = _mm_set1_epi32(int(value));
+    for (unsigned int i = 0; i < Capacity; i += 4) {
+      __m128i haystack = _mm_load_si128((const __m128i*)(slots + i));
+      int mask = _mm_movemask_ps(
+        _mm_castsi128_ps(_mm_cmpeq_epi32(haystack, needle)));
+      if (mask != 0) {
+        return i + lowestSetBit(mask);
+      }
+    }
+
+    return Capacity;
+#else
+    unsigned int i = 0;
+    while (i < Capacity && slots[i] != value) {
+      ++i;
+    }
+
+    return i;
+#endif
+  }
+
+}
+
+MeshTopology::MeshTopology() {}
+
+MStatus MeshTopology::read(const MDagPath& meshDagPath) {
+  clear();
+
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MIntArray vertexCounts;
+  MIntArray vertexList;
+  err = mesh.getVertices(vertexCounts, vertexList);
+  if (err.error()) {
+    return err;
+  }
+
+  unsigned int numFaces = vertexCounts.length();
+  _faceOffsets.resize(numFaces + 1);
+  _faceOffsets[0] = 0;
+  for (unsigned int i = 0; i < numFaces; ++i) {
+    _faceOffsets[i + 1] = _faceOffsets[i] + vertexCounts[i];
+  }
+
+  _faceVertices.resize(vertexList.length());
+  for (unsigned int i = 0; i < vertexList.length(); ++i) {
+    _faceVertices[i] = vertexList[i];
+  }
+
+  return MS::kSuccess;
+}
+
+void MeshTopology::clear() {
+  _faceOffsets.clear();
+  _faceVertices.clear();
+}
+
+unsigned int MeshTopology::numFaces() const {
+  return _faceOffsets.empty() ? 0 : (unsigned int)_faceOffsets.size() - 1;
+}
+
+const std::vector<unsigned int>& MeshTopology::faceOffsets() const {
+  return _faceOffsets;
+}
+
+const std::vector<unsigned int>& MeshTopology::faceVertices() const {
+  return _faceVertices;
+}
+
+FaceClassifier::FaceClassifier(const MeshTopology& topology,
+  const SkinWeights& weights,
+  Kernel kernel)
+  : _topology(topology),
+    _weights(weights),
+    _kernel(kernel == kAuto ? chooseKernel(topology, weights) : kernel) {
+  if (_kernel == kGeneral || _kernel == kDense) {
+    _weightSums.assign(weights.numInfluences(), 0.0);
+  }
+}
+
+FaceClassifier::Kernel FaceClassifier::kernel() const {
+  return _kernel;
+}
+
+FaceClassifier::Kernel FaceClassifier::chooseKernel(
+  const MeshTopology& topology,
+  const SkinWeights& weights) {
+  std::vector<Kernel> candidates;
+  candidates.push_back(kGeneral);
+
+  unsigned int maxRowLength = weights.maxRowLength();
+  if (maxRowLength <= 4) {
+    candidates.push_back(kUpTo4);
+  } else if (maxRowLength <= 8) {
+    candidates.push_back(kUpTo8);
+  }
+
+  // The dense scan only has a chance once a typical face touches a good
+  // fraction of all the influences.
+  unsigned int numVertices = weights.numVertices();
+  unsigned int numFaces = topology.numFaces();
+  if (numVertices != 0 && numFaces != 0) {
+    double rowLength = double(weights.numNonzeros()) / numVertices;
+    double faceSize = double(topology.faceVertices().size()) / numFaces;
+    if (rowLength * faceSize * 4.0 >= weights.numInfluences()) {
+      candidates.push_back(kDense);
+    }
+  }
+
+  // Which of the eligible kernels wins depends on the rig and the CPU, so
+  // time each one on a sample of faces and keep the fastest.
+  static const unsigned int SAMPLE_FACES = 4096;
+  unsigned int sampleFaces = std::min(numFaces, SAMPLE_FACES);
+  if (candidates.size() == 1 || sampleFaces == 0) {
+    return candidates[0];
+  }
+
+  std::vector<int> sample(sampleFaces);
+  Kernel bestKernel = kGeneral;
+  double bestTime = std::numeric_limits<double>::max();
+
+  for (Kernel kernel : candidates) {
+    FaceClassifier classifier(topology, weights, kernel);
+    for (int run = 0; run < 2; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      classifier.classifyRange(0, sampleFaces, sample.data());
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+      if (elapsed.count() < bestTime) {
+        bestTime = elapsed.count();
+        bestKernel = kernel;
+      }
+    }
+  }
+
+  return bestKernel;
+}
+
+const char* FaceClassifier::kernelName(Kernel kernel) {
+  switch (kernel) {
+    case kAuto: return "auto";
+    case kUpTo4: return "upTo4";
+    case kUpTo8: return "upTo8";
+    case kGeneral: return "general";
+    case kDense: return "dense";
+  }
+
+  return "unknown";
+}
+
+int FaceClassifier::classify(unsigned int face) {
+  switch (_kernel) {
+    case kUpTo4: return classifySmall<4>(face);
+    case kUpTo8: return classifySmall<8>(face);
+    case kDense: return classifyDense(face);
+    default: return classifyGeneral(face);
+  }
+}
+
+void FaceClassifier::classifyRange(unsigned int begin,
+  unsigned int end,
+  int* out) {
+  // Dispatch once per range so that the kernels inline into their loops.
+  switch (_kernel) {
+    case kUpTo4:
+      for (unsigned int face = begin; face < end; ++face) {
+        out[face] = classifySmall<4>(face);
+      }
+      break;
+    case kUpTo8:
+      for (unsigned int face = begin; face < end; ++face) {
+        out[face] = classifySmall<8>(face);
+      }
+      break;
+    case kDense:
+      for (unsigned int face = begin; face < end; ++face) {
+        out[face] = classifyDense(face);
+      }
+      break;
+    default:
+      for (unsigned int face = begin; face < end; ++face) {
+        out[face] = classifyGeneral(face);
+      }
+      break;
+  }
+}
+
+template<unsigned int MaxPerVertex>
+int FaceClassifier::classifySmall(unsigned int face) {
+  // Triangles and quads; other faces are rare enough to send down the
+  // general path.
+  static const unsigned int MAX_FACE_VERTICES = 4;
+  static const unsigned int CAPACITY = MaxPerVertex * MAX_FACE_VERTICES;
+
+  unsigned int faceBegin = _topology.faceBegin(face);
+  unsigned int faceEnd = _topology.faceEnd(face);
+  if (faceEnd - faceBegin > MAX_FACE_VERTICES) {
+    return classifyGeneral(face);
+  }
+
+  unsigned int numVertices = _weights.numVertices();
+  const std::vector<unsigned int>& faceVertices = _topology.faceVertices();
+  const unsigned int* influences = _weights.influences().data();
+  const float* weights = _weights.weights().data();
+
+  // Unused slots hold an influence index that can't occur, so that lookups
+  // can compare against every slot at once.
+  SIMD_ALIGN unsigned int candidates[CAPACITY];
+  double weightSums[CAPACITY];
+  std::fill(candidates, candidates + CAPACITY, ~0u);
+  unsigned int numCandidates = 0;
+
+  for (unsigned int i = faceBegin; i < faceEnd; ++i) {
+    unsigned int vtxId = faceVertices[i];
+    if (vtxId >= numVertices) {
+      continue;
+    }
+
+    unsigned int rowEnd = _weights.rowEnd(vtxId);
+    for (unsigned int j = _weights.rowBegin(vtxId); j < rowEnd; ++j) {
+      unsigned int influence = influences[j];
+      unsigned int k = Simd::find<CAPACITY>(candidates, influence);
+
+      if (k >= numCandidates) {
+        k = numCandidates++;
+        candidates[k] = influence;
+        weightSums[k] = 0.0;
+      }
+      weightSums[k] += weights[j];
+    }
+  }
+
+  double maxWeight = std::numeric_limits<double>::min();
+  int maxIndex = 0;
+  for (unsigned int k = 0; k < numCandidates; ++k) {
+    if (weightSums[k] > maxWeight ||
+        (weightSums[k] == maxWeight && int(candidates[k]) < maxIndex)) {
+      maxWeight = weightSums[k];
+      maxIndex = candidates[k];
+    }
+  }
+
+  return maxIndex;
+}
+
+int FaceClassifier::classifyGeneral(unsigned int face) {
+  if (_weightSums.empty()) {
+    _weightSums.assign(_weights.numInfluences(), 0.0);
+  }
+
+  unsigned int numVertices = _weights.numVertices();
+  const std::vector<unsigned int>& faceVertices = _topology.faceVertices();
+  const std::vector<unsigned int>& influences = _weights.influences();
+  const std::vector<float>& weights = _weights.weights();
+
+  unsigned int faceEnd = _topology.faceEnd(face);
+  for (unsigned int i = _topology.faceBegin(face); i < faceEnd; ++i) {
+    unsigned int vtxId = faceVertices[i];
+    if (vtxId >= numVertices) {
+      continue;
+    }
+
+    unsigned int rowEnd = _weights.rowEnd(vtxId);
+    for (unsigned int j = _weights.rowBegin(vtxId); j < rowEnd; ++j) {
+      unsigned int influence = influences[j];
+      if (_weightSums[influence] == 0.0) {
+        _touched.push_back(influence);
+      }
+      _weightSums[influence] += weights[j];
+    }
+  }
+
+  // Ties go to the lowest influence index, and faces without any weight
+  // go to influence 0, same as a dense scan in influence order.
+  double maxWeight = std::numeric_limits<double>::min();
+  int maxIndex = 0;
+  for (unsigned int influence : _touched) {
+    double weightSum = _weightSums[influence];
+    if (weightSum > maxWeight ||
+        (weightSum == maxWeight && int(influence) < maxIndex)) {
+      maxWeight = weightSum;
+      maxIndex = influence;
+    }
+    _weightSums[influence] = 0.0;
+  }
+  _touched.clear();
+
+  return maxIndex;
+}
+
+int FaceClassifier::classifyDense(unsigned int face) {
+  unsigned int numVertices = _weights.numVertices();
+  unsigned int numInfluences = _weights.numInfluences();
+  const std::vector<unsigned int>& faceVertices = _topology.faceVertices();
+  const unsigned int* influences = _weights.influences().data();
+  const float* weights = _weights.weights().data();
+  double* weightSums = _weightSums.data();
+
+  unsigned int faceEnd = _topology.faceEnd(face);
+  for (unsigned int i = _topology.faceBegin(face); i < faceEnd; ++i) {
+    unsigned int vtxId = faceVertices[i];
+    if (vtxId >= numVertices) {
+      continue;
+    }
+
+    unsigned int rowEnd = _weights.rowEnd(vtxId);
+    for (unsigned int j = _weights.rowBegin(vtxId); j < rowEnd; ++j) {
+      weightSums[influences[j]] += weights[j];
+    }
+  }
+
+  // Find the largest sum, then the first influence holding it.
+  double maxWeight = Simd::maxOf(weightSums, numInfluences);
+  int maxIndex = 0;
+  if (maxWeight > std::numeric_limits<double>::min()) {
+    while (weightSums[maxIndex] != maxWeight) {
+      ++maxIndex;
+    }
+  }
+
+  std::fill(weightSums, weightSums + numInfluences, 0.0);
+  return maxIndex;
+}
+
+void FaceInfluences::classifyAll(const MeshTopology& topology,
+  const SkinWeights& weights,
+  unsigned int numThreads,
+  std::vector<int>& maxInfluences,
+  FaceClassifier::Kernel kernel) {
+  unsigned int numFaces = topology.numFaces();
+  maxInfluences.resize(numFaces);
+
+  if (kernel == FaceClassifier::kAuto) {
+    kernel = FaceClassifier::chooseKernel(topology, weights);
+  }
+
+  // Classifiers are created lazily so that idle workers never allocate
+  // scratch space.
+  std::vector<std::unique_ptr<FaceClassifier>> classifiers(
+    Parallel::resolveThreadCount(numThreads));
+
+  Parallel::forRange(numFaces, 4096, (unsigned int)classifiers.size(),
+    [&](unsigned int thread, unsigned int begin, unsigned int end) {
+      if (!classifiers[thread]) {
+        classifiers[thread].reset(
+          new FaceClassifier(topology, weights, kernel));
+      }
+
+      classifiers[thread]->classifyRange(begin, end, maxInfluences.data());
+    });
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MDagPath.h>
+#include <maya/MStatus.h>
+
+class SkinWeights;
+
+// Face-vertex topology of a mesh in flat arrays: the vertices of face f are
+// faceVertices()[faceBegin(f)] through faceVertices()[faceEnd(f) - 1].
+class MeshTopology {
+public:
+  MeshTopology();
+  MStatus read(const MDagPath& meshDagPath);
+  void clear();
+
+  unsigned int numFaces() const;
+  unsigned int faceBegin(unsigned int face) const;
+  unsigned int faceEnd(unsigned int face) const;
+  const std::vector<unsigned int>& faceOffsets() const;
+  const std::vector<unsigned int>& faceVertices() const;
+
+private:
+  std::vector<unsigned int> _faceOffsets;
+  std::vector<unsigned int> _faceVertices;
+};
+
+inline unsigned int MeshTopology::faceBegin(unsigned int face) const {
+  return _faceOffsets[face];
+}
+
+inline unsigned int MeshTopology::faceEnd(unsigned int face) const {
+  return _faceOffsets[face + 1];
+}
+
+// Finds the influence with the largest summed weight over each face's
+// vertices. Each classifier owns its scratch space, so use one per thread.
+class FaceClassifier {
+public:
+  // Per-face kernels; all of them produce identical results.
+  //   kUpTo4/kUpTo8: every vertex has at most 4/8 nonzero weights, so a
+  //     triangle or quad's candidates fit in a small fixed-size array that
+  //     is searched with SIMD compares.
+  //   kGeneral: scatter into a per-influence accumulator and scan only the
+  //     influences the face touched.
+  //   kDense: scatter into the accumulator and scan all of it with SIMD;
+  //     wins when faces touch most of the influences anyway.
+  // kAuto times the kernels eligible for the rig on a sample of faces and
+  // picks the fastest.
+  enum Kernel { kAuto, kUpTo4, kUpTo8, kGeneral, kDense };
+
+  FaceClassifier(const MeshTopology& topology,
+    const SkinWeights& weights,
+    Kernel kernel = kAuto);
+  Kernel kernel() const;
+  int classify(unsigned int face);
+  void classifyRange(unsigned int begin, unsigned int end, int* out);
+
+  static Kernel chooseKernel(const MeshTopology& topology,
+    const SkinWeights& weights);
+  static const char* kernelName(Kernel kernel);
+
+private:
+  template<unsigned int MaxPerVertex> int classifySmall(unsigned int face);
+  int classifyGeneral(unsigned int face);
+  int classifyDense(unsigned int face);
+
+  const MeshTopology& _topology;
+  const SkinWeights& _weights;
+  Kernel _kernel;
+  std::vector<double> _weightSums;
+  std::vector<unsigned int> _touched;
+};
+
+namespace FaceInfluences {
+
+  // Classifies every face of the topology into maxInfluences, splitting the
+  // faces across numThreads threads.
+  void classifyAll(const MeshTopology& topology,
+                   const SkinWeights& weights,
+                   unsigned int numThreads,
+                   std::vector<int>& maxInfluences,
+                   FaceClassifier::Kernel kernel = FaceClassifier::kAuto);
+
+}
@@ -0,0 +1,69 @@
+#include "hover_scheduler.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+HoverScheduler::HoverScheduler()
+  : _threshold(0),
+    _budget(0.0),
+    _interval(Clock::duration::zero()),
+    _hasAccepted(false),
+    _acceptedX(0),
+    _acceptedY(0),
+    _hasPicked(false),
+    _pending(false) {}
+
+void HoverScheduler::configure(int thresholdPixels, double rate,
+  double budgetMs) {
+  _threshold = std::max(thresholdPixels, 0);
+  _budget = budgetMs;
+  if (rate > 0.0) {
+    _interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  } else {
+    _interval = Clock::duration::zero();
+  }
+}
+
+HoverScheduler::Action HoverScheduler::submit(short x, short y) {
+  if (_hasAccepted) {
+    int distance = std::max(std::abs(x - _acceptedX),
+      std::abs(y - _acceptedY));
+    if (distance < _threshold) {
+      return kSkip;
+    }
+  }
+
+  _hasAccepted = true;
+  _acceptedX = x;
+  _acceptedY = y;
+
+  if (_hasPicked && Clock::now() - _lastPick < _interval) {
+    _pending = true;
+    return kDefer;
+  }
+
+  return kProcess;
+}
+
+void HoverScheduler::beginPick() {
+  _hasPicked = true;
+  _lastPick = Clock::now();
+  _pending = false;
+}
+
+void HoverScheduler::defer() {
+  _pending = true;
+}
+
+bool HoverScheduler::flushDue() const {
+  return _pending && (!_hasPicked || Clock::now() - _lastPick >= _interval);
+}
+
+bool HoverScheduler::hasPending() const {
+  return _pending;
+}
+
+double HoverScheduler::budget() const {
+  return _budget;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+
+// Decides which mouse moves are worth a pick. Moves within a few pixels of
+// the last accepted position are dropped, and moves that arrive faster than
+// the hover rate are deferred so that a burst collapses into its latest
+// position. The caller owns the deferred position and flushes it later.
+class HoverScheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum Action { kSkip, kDefer, kProcess };
+
+  HoverScheduler();
+  void configure(int thresholdPixels, double rate, double budgetMs);
+
+  Action submit(short x, short y);
+  // Marks the start of a pick, which clears any deferred position.
+  void beginPick();
+  // Keeps the last result for now and retries the position later.
+  void defer();
+  // Whether the deferred position may be picked yet.
+  bool flushDue() const;
+  bool hasPending() const;
+
+  double budget() const;
+
+private:
+  int _threshold;
+  double _budget;
+  Clock::duration _interval;
+
+  bool _hasAccepted;
+  short _acceptedX;
+  short _acceptedY;
+  bool _hasPicked;
+  Clock::time_point _lastPick;
+  bool _pending;
+};
@@ -0,0 +1,242 @@
+#include "joint_watcher.h"
+
+#include <algorithm>
+
+#include <maya/MAnimControl.h>
+#include <maya/MConditionMessage.h>
+#include <maya/MDGMessage.h>
+#include <maya/MEventMessage.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MUserEventMessage.h>
+
+const MString JointWatcher::EVENT_NAME = "mannequinJointsChanged";
+
+MStatus JointWatcher::initialize() {
+  if (MUserEventMessage::isUserEvent(EVENT_NAME)) {
+    return MS::kSuccess;
+  }
+
+  return MUserEventMessage::registerUserEvent(EVENT_NAME);
+}
+
+void JointWatcher::uninitialize() {
+  if (MUserEventMessage::isUserEvent(EVENT_NAME)) {
+    MUserEventMessage::deregisterUserEvent(EVENT_NAME);
+  }
+}
+
+JointWatcher::JointWatcher()
+  : _pendingFlags(0),
+    _throttled(false),
+    _interval(Clock::duration::zero()),
+    _suspended(false),
+    _idleCallbackId(0),
+    _hasIdleCallback(false) {
+  _posted.flags = 0;
+}
+
+JointWatcher::~JointWatcher() {
+  unwatch();
+}
+
+void JointWatcher::watch(int rigId, const Rig& rig) {
+  if (rigId < 0) {
+    return;
+  }
+
+  if (_callbacks.length() == 0) {
+    _callbacks.append(MDGMessage::addTimeChangeCallback(
+      JointWatcher::timeChangeCallback, this));
+    _callbacks.append(MConditionMessage::addConditionCallback("playingBack",
+      JointWatcher::playingBackCallback, this));
+  }
+
+  if (rigId >= (int)_rigs.size()) {
+    _rigs.resize(rigId + 1);
+  } else {
+    unwatchRig(rigId);
+  }
+
+  unsigned int numJoints = rig.numJoints();
+  WatchedRig& watched = _rigs[rigId];
+  watched.joints.reset(new WatchedJoint[numJoints]);
+  watched.pendingChannels.assign(numJoints, 0);
+
+  for (unsigned int i = 0; i < numJoints; ++i) {
+    MObject jointObj = rig.jointDagPath(i).node();
+
+    // Influences are all transforms, so they share these attributes.
+    if (_translateAttr.isNull()) {
+      MFnDependencyNode jointNode(jointObj);
+      _translateAttr = jointNode.attribute("translate");
+      _rotateAttr = jointNode.attribute("rotate");
+      for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+        _channelAttrs[c] = jointNode.attribute(KeyIndex::attributeName(c));
+      }
+    }
+
+    WatchedJoint& joint = watched.joints[i];
+    joint.watcher = this;
+    joint.rigId = rigId;
+    joint.jointId = (int)i;
+    watched.callbacks.append(MNodeMessage::addNodeDirtyPlugCallback(jointObj,
+      JointWatcher::jointDirtyCallback, &joint));
+  }
+}
+
+void JointWatcher::unwatch() {
+  stopIdleCallback();
+
+  if (_callbacks.length() != 0) {
+    MMessage::removeCallbacks(_callbacks);
+    _callbacks.clear();
+  }
+
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    unwatchRig((int)i);
+  }
+  _rigs.clear();
+  _dirtyJoints.clear();
+  _pendingFlags = 0;
+  _throttled = false;
+}
+
+void JointWatcher::setRate(double rate) {
+  _suspended = rate <= 0.0;
+  if (_suspended) {
+    _interval = Clock::duration::zero();
+  } else {
+    _interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  }
+}
+
+void JointWatcher::unwatchRig(int rigId) {
+  WatchedRig& watched = _rigs[rigId];
+  if (watched.callbacks.length() != 0) {
+    MMessage::removeCallbacks(watched.callbacks);
+    watched.callbacks.clear();
+  }
+  watched.joints.reset();
+  watched.pendingChannels.clear();
+
+  // Pending joint IDs may not survive the rig's renumbering.
+  _dirtyJoints.erase(std::remove_if(_dirtyJoints.begin(), _dirtyJoints.end(),
+    [rigId](const std::pair<int, int>& dirtyJoint) {
+      return dirtyJoint.first == rigId;
+    }), _dirtyJoints.end());
+}
+
+const JointWatcher::Batch& JointWatcher::lastBatch() const {
+  return _posted;
+}
+
+bool JointWatcher::isPlaying() {
+  return MAnimControl::isPlaying() || MAnimControl::isScrubbing();
+}
+
+int JointWatcher::channelsForAttribute(const MObject& attr) const {
+  if (attr == _translateAttr) {
+    return KeyIndex::kTranslateChannels;
+  } else if (attr == _rotateAttr) {
+    return KeyIndex::kRotateChannels;
+  }
+
+  for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+    if (attr == _channelAttrs[c]) {
+      return 1 << c;
+    }
+  }
+
+  return 0;
+}
+
+void JointWatcher::markDirty(int rigId, int jointId, int channels) {
+  int& pending = _rigs[rigId].pendingChannels[jointId];
+  if (pending == 0) {
+    _dirtyJoints.push_back(std::make_pair(rigId, jointId));
+  }
+  pending |= channels;
+
+  startIdleCallback();
+}
+
+void JointWatcher::startIdleCallback() {
+  if (!_hasIdleCallback) {
+    MStatus err;
+    _idleCallbackId = MEventMessage::addEventCallback("idle",
+      JointWatcher::idleCallback, this, &err);
+    _hasIdleCallback = !err.error();
+  }
+}
+
+void JointWatcher::stopIdleCallback() {
+  if (_hasIdleCallback) {
+    MMessage::removeCallback(_idleCallbackId);
+    _hasIdleCallback = false;
+  }
+}
+
+void JointWatcher::jointDirtyCallback(MObject& node, MPlug& plug,
+  void* clientData) {
+  WatchedJoint* joint = static_cast<WatchedJoint*>(clientData);
+  JointWatcher* watcher = joint->watcher;
+
+  int channels = watcher->channelsForAttribute(plug.attribute());
+  if (channels != 0) {
+    watcher->markDirty(joint->rigId, joint->jointId, channels);
+  }
+}
+
+void JointWatcher::timeChangeCallback(MTime& time, void* clientData) {
+  JointWatcher* watcher = static_cast<JointWatcher*>(clientData);
+  watcher->_pendingFlags |= kTimeChanged;
+  watcher->startIdleCallback();
+}
+
+void JointWatcher::playingBackCallback(bool state, void* clientData) {
+  // Make sure the full refresh goes out even if nothing changes after.
+  JointWatcher* watcher = static_cast<JointWatcher*>(clientData);
+  if (state) {
+    watcher->_throttled = true;
+  } else if (watcher->_throttled) {
+    watcher->startIdleCallback();
+  }
+}
+
+void JointWatcher::idleCallback(void* clientData) {
+  JointWatcher* watcher = static_cast<JointWatcher*>(clientData);
+
+  // Idle fires continuously, so wait here until the next batch is due.
+  if (isPlaying()) {
+    watcher->_throttled = true;
+    if (watcher->_suspended ||
+        Clock::now() - watcher->_lastPost < watcher->_interval) {
+      return;
+    }
+  } else if (watcher->_throttled) {
+    watcher->_throttled = false;
+    watcher->_pendingFlags |= kFullRefresh;
+  }
+
+  watcher->stopIdleCallback();
+  watcher->post();
+}
+
+void JointWatcher::post() {
+  // Listeners may edit joints again, which schedules another post.
+  _posted.flags = _pendingFlags;
+  _posted.changes.clear();
+  for (const std::pair<int, int>& dirtyJoint : _dirtyJoints) {
+    int& pending = _rigs[dirtyJoint.first].pendingChannels[dirtyJoint.second];
+    Change change = { dirtyJoint.first, dirtyJoint.second, pending };
+    _posted.changes.push_back(change);
+    pending = 0;
+  }
+  _dirtyJoints.clear();
+  _pendingFlags = 0;
+  _lastPost = Clock::now();
+
+  MUserEventMessage::postUserEvent(EVENT_NAME, &_posted);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <maya/MCallbackIdArray.h>
+#include <maya/MMessage.h>
+#include <maya/MObject.h>
+#include <maya/MPlug.h>
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+#include <maya/MTime.h>
+
+#include "key_index.h"
+#include "rig.h"
+
+// Edits to the joints of the rigs being posed, collected from their dirty
+// plugs in C++ and announced on a Maya user event once Maya is idle, so that
+// dirty plugs don't each cross into Python. A joint dirtied many times
+// before the event goes out, e.g. during playback or a rig-wide edit, is
+// reported once with all of its dirtied channels. Time changes are batched
+// the same way. While the timeline plays or scrubs, batches go out at most
+// at the palette rate, or not at all if the rate is zero, and a full
+// refresh follows once it stops. C++ listeners receive a const Batch* as
+// their client data; scripts can fetch the batch with
+// `mannequinContext -q -dirtyJoints` when the event fires.
+class JointWatcher {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  static const MString EVENT_NAME;
+
+  enum BatchFlags {
+    kTimeChanged = 1 << 0,
+    // Playback or scrubbing ended; everything may have changed.
+    kFullRefresh = 1 << 1
+  };
+
+  struct Change {
+    int rigId;
+    int jointId;
+    // Bit (1 << KeyIndex::Channel) for every dirtied channel.
+    int channels;
+  };
+
+  struct Batch {
+    int flags;
+    std::vector<Change> changes;
+  };
+
+  static MStatus initialize();
+  static void uninitialize();
+
+  JointWatcher();
+  ~JointWatcher();
+
+  // Watches the joints of one rig, replacing whatever was watched under the
+  // ID before; call again whenever the rig's joint table is renumbered.
+  void watch(int rigId, const Rig& rig);
+  void unwatch();
+  // Batches per second while playing or scrubbing; zero suspends them.
+  void setRate(double rate);
+
+  const Batch& lastBatch() const;
+
+private:
+  JointWatcher(const JointWatcher&);
+  JointWatcher& operator=(const JointWatcher&);
+
+  struct WatchedJoint {
+    JointWatcher* watcher;
+    int rigId;
+    int jointId;
+  };
+
+  // The callbacks point into joints, which keeps its address as rigs are
+  // added.
+  struct WatchedRig {
+    std::unique_ptr<WatchedJoint[]> joints;
+    std::vector<int> pendingChannels;
+    MCallbackIdArray callbacks;
+  };
+
+  static void jointDirtyCallback(MObject& node, MPlug& plug,
+    void* clientData);
+  static void timeChangeCallback(MTime& time, void* clientData);
+  static void playingBackCallback(bool state, void* clientData);
+  static void idleCallback(void* clientData);
+
+  static bool isPlaying();
+  int channelsForAttribute(const MObject& attr) const;
+  void markDirty(int rigId, int jointId, int channels);
+  void unwatchRig(int rigId);
+  void startIdleCallback();
+  void stopIdleCallback();
+  void post();
+
+  std::vector<WatchedRig> _rigs;
+  std::vector<std::pair<int, int>> _dirtyJoints;
+  int _pendingFlags;
+  // Whether the timeline has played or scrubbed since the last full refresh.
+  bool _throttled;
+  Batch _posted;
+
+  Clock::duration _interval;
+  bool _suspended;
+  Clock::time_point _lastPost;
+
+  MObject _translateAttr;
+  MObject _rotateAttr;
+  MObject _channelAttrs[KeyIndex::NUM_CHANNELS];
+
+  MCallbackIdArray _callbacks;
+  MCallbackId _idleCallbackId;
+  bool _hasIdleCallback;
+};
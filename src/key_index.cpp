@@ -0,0 +1,306 @@
+#include "key_index.h"
+
+#include <algorithm>
+
+#include <maya/MAnimMessage.h>
+#include <maya/MAnimUtil.h>
+#include <maya/MDGMessage.h>
+#include <maya/MFnAnimCurve.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MObjectHandle.h>
+#include <maya/MPlugArray.h>
+
+namespace {
+  const char* const CHANNEL_NAMES[KeyIndex::NUM_CHANNELS] = {
+    "translateX", "translateY", "translateZ",
+    "rotateX", "rotateY", "rotateZ"
+  };
+
+  // Key times are compared in 6000 fps ticks, where integer frames at every
+  // common rate land exactly; the tolerance only absorbs rounding.
+  const double KEY_TIME_TOLERANCE = 1e-3;
+}
+
+const char* KeyIndex::attributeName(unsigned int channel) {
+  return channel < NUM_CHANNELS ? CHANNEL_NAMES[channel] : "";
+}
+
+KeyIndex::KeyIndex() : _allDirty(false) {}
+
+KeyIndex::~KeyIndex() {
+  unwatch();
+}
+
+void KeyIndex::setJoints(const std::vector<MDagPath>& jointDagPaths) {
+  if (jointDagPaths.size() == _jointDagPaths.size() &&
+      std::equal(jointDagPaths.begin(), jointDagPaths.end(),
+        _jointDagPaths.begin(),
+        [](const MDagPath& a, const MDagPath& b) {
+          return a.node() == b.node();
+        })) {
+    return;
+  }
+
+  clear();
+
+  _jointDagPaths = jointDagPaths;
+  unsigned int numJoints = (unsigned int)_jointDagPaths.size();
+  unsigned int numChannels = numJoints * NUM_CHANNELS;
+
+  _channelPlugs.reserve(numChannels);
+  _jointIds.reserve(numJoints);
+  for (unsigned int i = 0; i < numJoints; ++i) {
+    MObject jointObj = _jointDagPaths[i].node();
+    _jointIds.insert(std::make_pair(nodeHash(jointObj), (int)i));
+
+    MFnDependencyNode jointNode(jointObj);
+    for (unsigned int c = 0; c < NUM_CHANNELS; ++c) {
+      MStatus err;
+      MPlug plug = jointNode.findPlug(attributeName(c), true, &err);
+      _channelPlugs.push_back(err.error() ? MPlug() : plug);
+    }
+  }
+
+  _channelKeys.resize(numChannels);
+  _channelCurves.resize(numChannels);
+  _channelDirty.assign(numChannels, false);
+  _allDirty = true;
+
+  watch();
+}
+
+void KeyIndex::clear() {
+  unwatch();
+
+  _jointDagPaths.clear();
+  _jointIds.clear();
+  _channelPlugs.clear();
+  _channelKeys.clear();
+  _channelCurves.clear();
+  _curveLinks.clear();
+  _dirtyChannels.clear();
+  _channelDirty.clear();
+  _allDirty = false;
+}
+
+void KeyIndex::update() {
+  if (_allDirty) {
+    _curveLinks.clear();
+    for (std::vector<MObject>& curves : _channelCurves) {
+      curves.clear();
+    }
+    for (unsigned int c = 0; c < _channelPlugs.size(); ++c) {
+      rebuildChannel(c);
+    }
+  } else {
+    for (unsigned int c : _dirtyChannels) {
+      rebuildChannel(c);
+    }
+  }
+
+  for (unsigned int c : _dirtyChannels) {
+    _channelDirty[c] = false;
+  }
+  _dirtyChannels.clear();
+  _allDirty = false;
+}
+
+int KeyIndex::keyedChannels(int jointId, const MTime& time) const {
+  if (jointId < 0 || jointId >= (int)_jointDagPaths.size()) {
+    return 0;
+  }
+
+  double t = ticks(time);
+  int result = 0;
+  for (unsigned int c = 0; c < NUM_CHANNELS; ++c) {
+    const std::vector<double>& keys = _channelKeys[jointId * NUM_CHANNELS + c];
+    auto it = std::lower_bound(keys.begin(), keys.end(),
+      t - KEY_TIME_TOLERANCE);
+    if (it != keys.end() && *it <= t + KEY_TIME_TOLERANCE) {
+      result |= 1 << c;
+    }
+  }
+
+  return result;
+}
+
+void KeyIndex::appendKeyedChannels(const MTime& time, MIntArray& results) {
+  update();
+
+  unsigned int numJoints = (unsigned int)_jointDagPaths.size();
+  for (unsigned int i = 0; i < numJoints; ++i) {
+    results.append(keyedChannels((int)i, time));
+  }
+}
+
+double KeyIndex::ticks(const MTime& time) {
+  return time.as(MTime::k6000FPS);
+}
+
+unsigned int KeyIndex::nodeHash(const MObject& node) {
+  return MObjectHandle(node).hashCode();
+}
+
+int KeyIndex::jointIdForNode(const MObject& node) const {
+  auto range = _jointIds.equal_range(nodeHash(node));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (_jointDagPaths[it->second].node() == node) {
+      return it->second;
+    }
+  }
+
+  return -1;
+}
+
+void KeyIndex::curveEdited(const MObject& curve) {
+  bool linked = false;
+  auto range = _curveLinks.equal_range(nodeHash(curve));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.curve == curve) {
+      markChannelDirty(it->second.channel);
+      linked = true;
+    }
+  }
+
+  if (linked) {
+    return;
+  }
+
+  // A curve we haven't seen; it only matters if it now drives one of the
+  // joints, either directly or through something like a layer's blend node.
+  // Curves driving other transforms are some other rig's business.
+  MStatus err;
+  MFnDependencyNode curveNode(curve);
+  MPlug outputPlug = curveNode.findPlug("output", true, &err);
+  if (err.error()) {
+    return;
+  }
+
+  MPlugArray destinations;
+  outputPlug.connectedTo(destinations, false, true);
+  for (unsigned int i = 0; i < destinations.length(); ++i) {
+    MObject node = destinations[i].node();
+    int jointId = jointIdForNode(node);
+    if (jointId >= 0) {
+      markJointDirty(jointId);
+    } else if (!node.hasFn(MFn::kTransform)) {
+      _allDirty = true;
+    }
+  }
+}
+
+void KeyIndex::rebuildChannel(unsigned int channel) {
+  // Unlink the curves found last time; the channel may have lost some.
+  for (const MObject& curve : _channelCurves[channel]) {
+    auto range = _curveLinks.equal_range(nodeHash(curve));
+    for (auto it = range.first; it != range.second;) {
+      if (it->second.curve == curve && it->second.channel == channel) {
+        it = _curveLinks.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  std::vector<double>& keys = _channelKeys[channel];
+  std::vector<MObject>& curves = _channelCurves[channel];
+  keys.clear();
+  curves.clear();
+
+  const MPlug& plug = _channelPlugs[channel];
+  MObjectArray animation;
+  if (plug.isNull() || !MAnimUtil::findAnimation(plug, animation)) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < animation.length(); ++i) {
+    MStatus err;
+    MFnAnimCurve animCurve(animation[i], &err);
+    if (err.error()) {
+      continue;
+    }
+
+    unsigned int numKeys = animCurve.numKeys();
+    for (unsigned int k = 0; k < numKeys; ++k) {
+      keys.push_back(ticks(animCurve.time(k)));
+    }
+
+    curves.push_back(animation[i]);
+    CurveLink link = { animation[i], channel };
+    _curveLinks.insert(std::make_pair(nodeHash(animation[i]), link));
+  }
+
+  // Layers can key the same time more than once.
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void KeyIndex::markChannelDirty(unsigned int channel) {
+  if (_allDirty || _channelDirty[channel]) {
+    return;
+  }
+
+  _channelDirty[channel] = true;
+  _dirtyChannels.push_back(channel);
+}
+
+void KeyIndex::markJointDirty(int jointId) {
+  for (unsigned int c = 0; c < NUM_CHANNELS; ++c) {
+    markChannelDirty(jointId * NUM_CHANNELS + c);
+  }
+}
+
+void KeyIndex::watch() {
+  _callbacks.append(MAnimMessage::addAnimCurveEditedCallback(
+    KeyIndex::curveEditedCallback, this));
+  _callbacks.append(MDGMessage::addNodeRemovedCallback(
+    KeyIndex::curveRemovedCallback, "animCurve", this));
+
+  // Setting the first key on a channel connects a new curve to it.
+  for (const MDagPath& jointDagPath : _jointDagPaths) {
+    MObject jointObj = jointDagPath.node();
+    _callbacks.append(MNodeMessage::addAttributeChangedCallback(jointObj,
+      KeyIndex::jointAttributeChangedCallback, this));
+  }
+}
+
+void KeyIndex::unwatch() {
+  if (_callbacks.length() != 0) {
+    MMessage::removeCallbacks(_callbacks);
+    _callbacks.clear();
+  }
+}
+
+void KeyIndex::curveEditedCallback(MObjectArray& curves, void* clientData) {
+  KeyIndex* index = static_cast<KeyIndex*>(clientData);
+  for (unsigned int i = 0; i < curves.length() && !index->_allDirty; ++i) {
+    index->curveEdited(curves[i]);
+  }
+}
+
+void KeyIndex::curveRemovedCallback(MObject& node, void* clientData) {
+  // The curve is still connected here, but the rebuild happens on the next
+  // query, by which time it's gone.
+  KeyIndex* index = static_cast<KeyIndex*>(clientData);
+  auto range = index->_curveLinks.equal_range(nodeHash(node));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.curve == node) {
+      index->markChannelDirty(it->second.channel);
+    }
+  }
+}
+
+void KeyIndex::jointAttributeChangedCallback(
+  MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug& otherPlug,
+  void* clientData) {
+  if (!(msg & (MNodeMessage::kConnectionMade |
+      MNodeMessage::kConnectionBroken))) {
+    return;
+  }
+
+  KeyIndex* index = static_cast<KeyIndex*>(clientData);
+  int jointId = index->jointIdForNode(plug.node());
+  if (jointId >= 0) {
+    index->markJointDirty(jointId);
+  }
+}
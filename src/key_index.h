@@ -0,0 +1,97 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <maya/MCallbackIdArray.h>
+#include <maya/MDagPath.h>
+#include <maya/MIntArray.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MObject.h>
+#include <maya/MObjectArray.h>
+#include <maya/MPlug.h>
+#include <maya/MTime.h>
+
+// The key times of every joint's translate and rotate channels, so that the
+// keyed channels at a time can be answered for the whole rig without going
+// through MEL. Each channel keeps the sorted union of the key times of the
+// curves driving it; there's more than one with animation layers.
+// Curve edits arrive through MAnimMessage and only rebuild the channels the
+// curve drives. New curves are found through connection changes on the
+// joints, or through a rescan if they drive something in between, like a
+// layer's blend node. Rebuilds are applied lazily on the next query, so
+// dragging keys around only rebuilds the channels once.
+class KeyIndex {
+public:
+  enum Channel {
+    kTranslateX,
+    kTranslateY,
+    kTranslateZ,
+    kRotateX,
+    kRotateY,
+    kRotateZ,
+    NUM_CHANNELS
+  };
+
+  // Bit (1 << Channel) per channel, for the channels of each attribute.
+  enum ChannelMask {
+    kTranslateChannels =
+      (1 << kTranslateX) | (1 << kTranslateY) | (1 << kTranslateZ),
+    kRotateChannels = (1 << kRotateX) | (1 << kRotateY) | (1 << kRotateZ),
+    kAllChannels = kTranslateChannels | kRotateChannels
+  };
+
+  // The joint attribute behind each channel, e.g. "rotateY".
+  static const char* attributeName(unsigned int channel);
+
+  KeyIndex();
+  ~KeyIndex();
+
+  // Starts indexing the given joints; does nothing if they're the joints
+  // already indexed, so that renames and reparenting keep the index.
+  void setJoints(const std::vector<MDagPath>& jointDagPaths);
+  void clear();
+  void update();
+
+  // Bit (1 << Channel) is set for every channel keyed at the time.
+  int keyedChannels(int jointId, const MTime& time) const;
+  // Appends the keyed channels of every joint, in joint ID order.
+  void appendKeyedChannels(const MTime& time, MIntArray& results);
+
+private:
+  struct CurveLink {
+    MObject curve;
+    unsigned int channel;
+  };
+
+  static void curveEditedCallback(MObjectArray& curves, void* clientData);
+  static void curveRemovedCallback(MObject& node, void* clientData);
+  static void jointAttributeChangedCallback(
+    MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug& otherPlug,
+    void* clientData);
+
+  static double ticks(const MTime& time);
+  static unsigned int nodeHash(const MObject& node);
+  int jointIdForNode(const MObject& node) const;
+  void curveEdited(const MObject& curve);
+  void rebuildChannel(unsigned int channel);
+  void markChannelDirty(unsigned int channel);
+  void markJointDirty(int jointId);
+  void watch();
+  void unwatch();
+
+  std::vector<MDagPath> _jointDagPaths;
+  std::unordered_multimap<unsigned int, int> _jointIds;
+  // Channel plugs and key times, NUM_CHANNELS per joint in joint ID order.
+  std::vector<MPlug> _channelPlugs;
+  std::vector<std::vector<double>> _channelKeys;
+  std::vector<std::vector<MObject>> _channelCurves;
+  // Curves to the channels they drive, by node hash.
+  std::unordered_multimap<unsigned int, CurveLink> _curveLinks;
+
+  std::vector<unsigned int> _dirtyChannels;
+  std::vector<bool> _channelDirty;
+  bool _allDirty;
+
+  MCallbackIdArray _callbacks;
+};
@@ -1,14 +1,30 @@
 #include "mannequin.h"
 #include "mannequin_manipulator.h"
 #include "move_manipulator.h"
+#include "mannequin_overlay.h"
 #include "util.h"
-
+#include "skin_weights.h"
+#include "face_influences.h"
+#include "parallel.h"
+#include "stats.h"
+#include "trace.h"
+#include "selection_event.h"
+#include "pose_command.h"
+#include "pose_writer.h"
+
+#include <algorithm>
 #include <limits>
+#include <chrono>
+#include <random>
+#include <string>
 
 #include <maya/MStatus.h>
 #include <maya/MFnPlugin.h>
+#include <maya/MDagModifier.h>
+#include <maya/MDrawRegistry.h>
 #include <maya/MFnSkinCluster.h>
 #include <maya/MItDependencyNodes.h>
+#include <maya/MItDependencyGraph.h>
 #include <maya/MGlobal.h>
 #include <maya/MSelectionList.h>
 #include <maya/MFnMesh.h>
@@ -16,29 +32,83 @@
 #include <maya/MFnSingleIndexedComponent.h>
 #include <maya/MDagPathArray.h>
 #include <maya/M3dView.h>
-#include <maya/MItMeshPolygon.h>
+#include <maya/MAnimControl.h>
+#include <maya/MIntArray.h>
+#include <maya/MDoubleArray.h>
 #include <maya/MAnimMessage.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MDGMessage.h>
+#include <maya/MDagMessage.h>
+#include <maya/MEventMessage.h>
+#include <maya/MPolyMessage.h>
+#include <maya/MFloatPoint.h>
+#include <maya/MMatrix.h>
 
 const double MannequinContext::MANIP_DEFAULT_SCALE = 1.5;
 const double MannequinContext::MANIP_ADJUSTMENT = 0.1;
+const size_t MannequinContext::MAX_ROTATE_MANIPS = 32;
+const int MannequinContext::HOVER_DEFAULT_THRESHOLD = 2;
+const double MannequinContext::HOVER_DEFAULT_RATE = 60.0;
+const double MannequinContext::HOVER_DEFAULT_BUDGET = 4.0;
+const double MannequinContext::PALETTE_DEFAULT_RATE = 10.0;
+
+namespace {
+  // Quotes a string for use as a MEL argument.
+  MString melString(const MString& string) {
+    std::string result = "\"";
+    for (const char* c = string.asChar(); *c != '\0'; ++c) {
+      if (*c == '\\' || *c == '"') {
+        result += '\\';
+      }
+      result += *c;
+    }
+    result += '"';
+    return MString(result.c_str());
+  }
+}
 
 MannequinContext::MannequinContext()
   : _mannequinManip(nullptr),
     _moveManip(nullptr),
-    _selectionStyle(JointPresentationStyle::NONE) {}
+    _selectionRig(-1),
+    _selection(-1),
+    _selectionStyle(JointPresentationStyle::NONE),
+    _rigUpdateCallbackId(0),
+    _hasRigUpdateCallback(false) {}
 
 void MannequinContext::forceExit() {
   MGlobal::executeCommand("setToolTo $gSelect");
 }
 
 void MannequinContext::select(const MDagPath& dagPath, int style) {
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    int jointId = _rigs[i]->jointIdForDagPath(dagPath);
+    if (jointId >= 0) {
+      select(i, jointId, style);
+      return;
+    }
+  }
+
+  select(-1, -1, style);
+}
+
+void MannequinContext::select(int rigId, int jointId, int style) {
+  Stats::ScopedTimer timer(Stats::kSelect);
+
+  Rig* selectionRig = rig(rigId);
+  if (!selectionRig || jointId < 0) {
+    rigId = -1;
+    jointId = -1;
+  }
+
   // Determine which style to use/request.
   if (style == JointPresentationStyle::NONE) {
     // Try to preserve the presentation style used previously.
     style = _selectionStyle;
   }
 
-  int availableStyles = presentationStyleForJointDagPath(dagPath);
+  int availableStyles = selectionRig ?
+    selectionRig->jointStyle(jointId) : JointPresentationStyle::NONE;
   if (style & availableStyles) {
     // Requested presentation style available.
     style = style & availableStyles;
@@ -47,78 +117,155 @@ void MannequinContext::select(const MDagPath& dagPath, int style) {
     style = availableStyles;
   }
 
-  // If the DAG path + style combo is still the same, then DO NOTHING.
-  if ((_selection == dagPath) && (style & _selectionStyle)) {
+  // If the joint + style combo is still the same, then DO NOTHING.
+  if ((_selectionRig == rigId) && (_selection == jointId) &&
+      (style & _selectionStyle)) {
     return;
   }
 
-  _selection = dagPath;
-  calculateJointLengthRatio(_selection);
+  _selectionRig = rigId;
+  _selection = jointId;
+  MDagPath selectionPath = selectionDagPath();
+  calculateJointLengthRatio(selectionPath);
+
+  // One sample per selection, from dropping the old manipulators to the new
+  // one being ready.
+  {
+    Stats::ScopedTimer manipTimer(Stats::kSelectManipulators);
+    resetManipulators();
+
+    if (selectionPath.hasFn(MFn::kTransform)) {
+      MFnTransform selectionXform(selectionPath);
+
+      // Just use the first presentation style that we can.
+      if (style & JointPresentationStyle::ROTATE) {
+        std::string key = selectionPath.fullPathName().asChar();
+        auto cached = _rotateManips.find(key);
+        if (cached != _rotateManips.end()) {
+          _rotateManip = cached->second;
+        } else {
+          MFnRotateManip rotateManip;
+          MObject rotateManipObj = rotateManip.create();
+          _rotateManip = rotateManipObj;
+          _rotateManips.insert(std::make_pair(key, rotateManipObj));
+
+          MPlug rotationPlug = selectionXform.findPlug("rotate");
+
+          rotateManip.connectToRotationPlug(rotationPlug);
+          rotateManip.displayWithNode(selectionPath.node());
+          rotateManip.setRotateMode(MFnRotateManip::kObjectSpace);
+          addManipulator(rotateManipObj);
+        }
 
-  MDagPath oldHighlight;
-  if (_mannequinManip) {
-    // Preserve old highlight while transitioning manipulators.
-    oldHighlight = _mannequinManip->highlightedDagPath();
-  }
+        MFnRotateManip rotateManip(_rotateManip);
+        rotateManip.setManipScale(manipAdjustedScale());
+        rotateManip.setVisible(true);
+
+        _availableStyles = availableStyles;
+        _selectionStyle = JointPresentationStyle::ROTATE;
+      } else if (style & JointPresentationStyle::TRANSLATE) {
+        if (!_moveManip) {
+          MObject moveManipObj;
+          _moveManip = (MannequinMoveManipulator*)
+            MPxManipulatorNode::newManipulator(
+              "MannequinMoveManipulator",
+              moveManipObj);
+          addManipulator(moveManipObj);
+        }
 
-  deleteManipulators();
-  addMannequinManipulator(oldHighlight);
-  _rotateManip = nullptr;
-  _moveManip = nullptr;
+        _moveManip->setTarget(selectionPath);
+        _moveManip->setManipScale(manipAdjustedScale() * 1.25f);
 
-  if (_selection.hasFn(MFn::kTransform)) {
-    MFnTransform selectionXform(_selection);
+        _availableStyles = availableStyles;
+        _selectionStyle = JointPresentationStyle::TRANSLATE;
+      }
+    }
+  }
 
-    // Just use the first presentation style that we can.
-    if (style & JointPresentationStyle::ROTATE) {
-      MFnRotateManip rotateManip;
-      MObject rotateManipObj = rotateManip.create();
-      _rotateManip = (void*)true;
+  // Only the joint goes on the active list, so that the channel box and
+  // keying follow the click. Hovering draws through the overlay instead.
+  MSelectionList selList;
+  if (selectionPath.isValid()) {
+    selList.add(selectionPath);
+  }
+  MGlobal::setActiveSelectionList(selList);
 
-      MPlug rotationPlug = selectionXform.findPlug("rotate");
+  SelectionEvent::Payload payload;
+  payload.rigId = _selectionRig;
+  payload.jointId = _selection;
+  payload.style = _selectionStyle;
+  payload.fullPathName = selectionPath.fullPathName();
+  SelectionEvent::post(payload);
 
-      rotateManip.connectToRotationPlug(rotationPlug);
-      rotateManip.displayWithNode(_selection.node());
-      rotateManip.setManipScale(manipAdjustedScale());
-      rotateManip.setRotateMode(MFnRotateManip::kObjectSpace);
+  updateText();
+}
 
-      _availableStyles = availableStyles;
-      _selectionStyle = JointPresentationStyle::ROTATE;
-      addManipulator(rotateManipObj);
-    } else if (style & JointPresentationStyle::TRANSLATE) {
-      MObject moveManipObj;
-      _moveManip = (MannequinMoveManipulator*)
-        MPxManipulatorNode::newManipulator(
-          "MannequinMoveManipulator",
-          moveManipObj);
+void MannequinContext::resetManipulators() {
+  // The hover and move manipulators live for the whole session; the move
+  // manipulator is just pointed at nothing until the next selection.
+  if (!_rotateManip.isNull()) {
+    MFnRotateManip rotateManip(_rotateManip);
+    rotateManip.setVisible(false);
+    _rotateManip = MObject::kNullObj;
+  }
 
-      _moveManip->connectToDependNode(_selection.node());
-      _moveManip->setManipScale(manipAdjustedScale() * 1.25f);
+  if (_moveManip) {
+    _moveManip->setTarget(MDagPath());
+  }
 
-      _availableStyles = availableStyles;
-      _selectionStyle = JointPresentationStyle::TRANSLATE;
-      addManipulator(moveManipObj);
+  // A rotate manipulator can't be disconnected from its joint's plug, so
+  // each one is hidden and kept for when its joint is selected again. The
+  // context can only drop all of its manipulators at once, so once too many
+  // have piled up, everything is rebuilt and the hover manipulator takes
+  // over the current highlight.
+  if (_rotateManips.size() >= MAX_ROTATE_MANIPS) {
+    int oldHighlightRig = -1;
+    int oldHighlight = -1;
+    if (_mannequinManip) {
+      oldHighlightRig = _mannequinManip->highlightedRigId();
+      oldHighlight = _mannequinManip->highlightedJointId();
     }
-  }
 
-  MString pythonSelectionCallback;
-  pythonSelectionCallback.format("mannequinSelectionChanged(\"^1s\", \"^2s\")",
-    _selection.fullPathName(),
-    JointPresentationStyle::toString(_selectionStyle));
-  MGlobal::executePythonCommand(pythonSelectionCallback);
+    deleteManipulators();
+    _rotateManips.clear();
+    _moveManip = nullptr;
+    addMannequinManipulator(oldHighlightRig, oldHighlight);
+    return;
+  }
 
-  updateText();
+  // The overlay just needs the new selection.
+  if (_mannequinManip) {
+    _mannequinManip->highlight(_mannequinManip->highlightedRigId(),
+      _mannequinManip->highlightedJointId(), true);
+  }
 }
 
-void MannequinContext::reselect() {
-  MDagPath oldSelection = _selection;
-  if (oldSelection.isValid()) {
-    select(MDagPath());
-    select(oldSelection);
+void MannequinContext::updateManipScale() {
+  // Rescale the live manipulators in place rather than reselecting.
+  calculateJointLengthRatio(selectionDagPath());
+
+  if (!_rotateManip.isNull()) {
+    MFnRotateManip rotateManip(_rotateManip);
+    rotateManip.setManipScale(manipAdjustedScale());
+  }
+
+  if (_moveManip) {
+    _moveManip->setManipScale(manipAdjustedScale() * 1.25f);
   }
+
+  M3dView::scheduleRefreshAllViews();
 }
 
 MDagPath MannequinContext::selectionDagPath() const {
+  Rig* selectionRig = rig(_selectionRig);
+  return selectionRig ? selectionRig->jointDagPath(_selection) : MDagPath();
+}
+
+int MannequinContext::selectionRigId() const {
+  return _selectionRig;
+}
+
+int MannequinContext::selectionJointId() const {
   return _selection;
 }
 
@@ -126,97 +273,280 @@ int MannequinContext::selectionStyle() const {
   return _selectionStyle;
 }
 
-void MannequinContext::calculateDagLookupTables(MObject skinObj) {
-  MFnSkinCluster skin(skinObj);
-  MDagPathArray influenceObjects;
-  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+unsigned int MannequinContext::numRigs() const {
+  return (unsigned int)_rigs.size();
+}
 
-  for (unsigned int i = 0; i < numInfluences; ++i) {
-    MDagPath dagPath = influenceObjects[i];
-    _dagIndexLookup[dagPath] = i;
-    _dagStyleLookup[dagPath] = dagPath.childCount() == 0 ?
-#ifdef TERMINAL_JOINTS_ROTATE
-      JointPresentationStyle::TRANSLATE | JointPresentationStyle::ROTATE :
-      JointPresentationStyle::ROTATE;
-#else
-      JointPresentationStyle::TRANSLATE : JointPresentationStyle::ROTATE;
-#endif
+Rig* MannequinContext::rig(int rigId) const {
+  if (rigId < 0 || rigId >= (int)_rigs.size()) {
+    return nullptr;
   }
+
+  return _rigs[rigId].get();
 }
 
-void MannequinContext::calculateMaxInfluences(MDagPath dagPath,
-  MObject skinObj) {
-  MFnMesh mesh(dagPath);
-  MFnSkinCluster skin(skinObj);
+int MannequinContext::activeRigId() const {
+  if (_selectionRig >= 0) {
+    return _selectionRig;
+  }
 
-  MFnSingleIndexedComponent comp;
-  MObject compObj = comp.create(MFn::kMeshVertComponent);
-  comp.setCompleteData(mesh.numVertices());
+  return _rigs.empty() ? -1 : 0;
+}
 
-  MDoubleArray weights;
-  unsigned int numInfluences;
-  skin.getWeights(dagPath, compObj, weights, numInfluences);
+bool MannequinContext::findJoint(const MString& name, int& rigId,
+  int& jointId) const {
+  // Short names can be ambiguous across characters, so the active rig gets
+  // the first chance to claim one.
+  int activeRig = activeRigId();
+  if (activeRig >= 0) {
+    jointId = _rigs[activeRig]->jointIdForName(name);
+    if (jointId >= 0) {
+      rigId = activeRig;
+      return true;
+    }
+  }
 
-  _maxInfluences.resize(mesh.numPolygons());
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    jointId = _rigs[i]->jointIdForName(name);
+    if (jointId >= 0) {
+      rigId = i;
+      return true;
+    }
+  }
 
-  int i = 0;
-  for (MItMeshPolygon it(dagPath); !it.isDone(); it.next()) {
-    MIntArray polyVertices;
-    it.getVertices(polyVertices);
+  rigId = -1;
+  jointId = -1;
+  return false;
+}
+
+void MannequinContext::updateRig(int rigId) {
+  Rig* target = rig(rigId);
+  if (!target) {
+    return;
+  }
 
-    std::vector<double> weightSums(numInfluences, 0.0f);
-    for (unsigned int vtx = 0; vtx < polyVertices.length(); ++vtx) {
-      int vtxId = polyVertices[vtx];
-      for (unsigned int influence = 0; influence < numInfluences; ++influence) {
-        weightSums[influence] += weights[vtxId * numInfluences + influence];
+  unsigned int numThreads = Parallel::resolveThreadCount(threadCount());
+  if (target->jointTableDirty()) {
+    // Joint IDs may have been renumbered, so carry the selection across by
+    // path and drop the hover until the next mouse move.
+    bool isSelected = rigId == _selectionRig;
+    MDagPath selectionPath = isSelected ? selectionDagPath() : MDagPath();
+    target->updateJointTable(numThreads);
+    _jointWatcher.watch(rigId, *target);
+
+    if (isSelected) {
+      _selection = target->jointIdForDagPath(selectionPath);
+      if (_selection < 0) {
+        _selectionRig = -1;
       }
     }
 
-    double maxWeight = std::numeric_limits<double>::min();
-    int maxIndex = 0;
-    for (unsigned int influence = 0; influence < numInfluences; ++influence) {
-      if (weightSums[influence] > maxWeight) {
-        maxWeight = weightSums[influence];
-        maxIndex = influence;
-      }
+    if (_mannequinManip) {
+      _mannequinManip->highlight(-1, -1, true);
     }
+  }
 
-    _maxInfluences[i++] = maxIndex;
+  target->updateFaceInfluences(numThreads);
+}
+
+void MannequinContext::updateRigs() {
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    updateRig(i);
   }
 }
 
-void MannequinContext::calculateLongestJoint(MObject skinObj) {
-  MFnSkinCluster skin(skinObj);
+const JointWatcher::Batch& MannequinContext::jointChanges() const {
+  return _jointWatcher.lastBatch();
+}
 
-  MDagPathArray influenceObjects;
-  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+MStatus MannequinContext::benchmarkFaceKernels(MStringArray& results) {
+  Rig* activeRig = rig(activeRigId());
+  if (!activeRig) {
+    return MS::kInvalidParameter;
+  }
 
-  double maxLength = 0.0;
-  for (unsigned int i = 0; i < numInfluences; ++i) {
-    MDagPath jointDagPath = influenceObjects[i];
-    unsigned int children = jointDagPath.childCount();
+  MeshTopology topology;
+  SkinWeights skinWeights;
 
-    // We're looking through the children instead of at the actual joint
-    // because we want to avoid the root transform. We end up looking at the
-    // same number of objects since a transform can have only one parent.
-    for (unsigned int i = 0; i < children; ++i) {
-      MObject child = jointDagPath.child(i);
-      if (child.hasFn(MFn::kJoint)) {
-        MFnDagNode dagNode(child);
-        MDagPath childDagPath;
-        dagNode.getPath(childDagPath);
-        MFnTransform childXform(childDagPath);
-        maxLength = std::max(maxLength,
-          childXform.getTranslation(MSpace::kObject).length());
-      }
+  MStatus err = topology.read(activeRig->meshDagPath());
+  if (!err.error()) {
+    err = skinWeights.read(activeRig->meshDagPath(),
+      activeRig->skinObject());
+  }
+
+  if (err.error()) {
+    return err;
+  }
+
+  const FaceClassifier::Kernel kernels[] = {
+    FaceClassifier::kGeneral,
+    FaceClassifier::kUpTo4,
+    FaceClassifier::kUpTo8,
+    FaceClassifier::kDense
+  };
+
+  FaceClassifier::Kernel chosen =
+    FaceClassifier::chooseKernel(topology, skinWeights);
+  std::vector<int> reference;
+  double referenceTime = 0.0;
+
+  for (FaceClassifier::Kernel kernel : kernels) {
+    if ((kernel == FaceClassifier::kUpTo4 && skinWeights.maxRowLength() > 4) ||
+        (kernel == FaceClassifier::kUpTo8 && skinWeights.maxRowLength() > 8)) {
+      continue;
+    }
+
+    // Single-threaded, best of several runs, to measure the kernel itself.
+    std::vector<int> maxInfluences;
+    double bestTime = std::numeric_limits<double>::max();
+    for (int run = 0; run < 5; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      FaceInfluences::classifyAll(topology, skinWeights, 1, maxInfluences,
+        kernel);
+      std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+      bestTime = std::min(bestTime, elapsed.count());
+    }
+
+    if (kernel == FaceClassifier::kGeneral) {
+      reference = maxInfluences;
+      referenceTime = bestTime;
     }
+
+    MString line = FaceClassifier::kernelName(kernel);
+    line += kernel == chosen ? " (auto): " : ": ";
+    line += bestTime;
+    line += " ms, ";
+    line += referenceTime / bestTime;
+    line += "x vs general";
+    if (maxInfluences != reference) {
+      line += ", MISMATCH";
+    }
+    results.append(line);
   }
 
-  _longestJoint = maxLength;
+  return MS::kSuccess;
+}
+
+MStatus MannequinContext::benchmarkPicking(MStringArray& results) {
+  Rig* activeRig = rig(activeRigId());
+  if (!activeRig) {
+    return MS::kInvalidParameter;
+  }
+
+  MDagPath meshDagPath = activeRig->meshDagPath();
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  PickBvh bvh;
+  auto start = std::chrono::steady_clock::now();
+  err = bvh.build(meshDagPath);
+  if (err.error()) {
+    return err;
+  }
+  std::chrono::duration<double, std::milli> buildTime =
+    std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  bvh.refit(meshDagPath);
+  std::chrono::duration<double, std::milli> refitTime =
+    std::chrono::steady_clock::now() - start;
+
+  // Fixed-seed rays from a sphere around the mesh, aimed at points inside
+  // its bounds, so that runs are comparable.
+  MPoint min, max;
+  bvh.bounds(min, max);
+  MPoint center = min + (max - min) * 0.5;
+  double radius = std::max((max - min).length() * 0.5, 1e-3);
+  float maxParam = float(radius * 4.0);
+
+  static const unsigned int NUM_RAYS = 1000;
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::vector<MPoint> origins(NUM_RAYS);
+  std::vector<MVector> directions(NUM_RAYS);
+  std::normal_distribution<double> gaussian;
+  for (unsigned int i = 0; i < NUM_RAYS; ++i) {
+    MVector offset(gaussian(rng), gaussian(rng), gaussian(rng));
+    origins[i] = center + offset.normal() * radius * 2.0;
+
+    MPoint target(min.x + (max.x - min.x) * unit(rng),
+      min.y + (max.y - min.y) * unit(rng),
+      min.z + (max.z - min.z) * unit(rng));
+    directions[i] = (target - origins[i]).normal();
+  }
+
+  std::vector<int> mayaFaces(NUM_RAYS, -1);
+  start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < NUM_RAYS; ++i) {
+    MFloatPoint rayOrigin;
+    rayOrigin.setCast(origins[i]);
+    MFloatPoint hitPoint;
+    mesh.closestIntersection(rayOrigin, directions[i], NULL, NULL, false,
+      MSpace::kWorld, maxParam, false, NULL, hitPoint, NULL, &mayaFaces[i],
+      NULL, NULL, NULL, 1e-3f);
+  }
+  std::chrono::duration<double, std::micro> mayaTime =
+    std::chrono::steady_clock::now() - start;
+
+  std::vector<int> bvhFaces(NUM_RAYS, -1);
+  start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < NUM_RAYS; ++i) {
+    bvh.intersect(origins[i], directions[i], maxParam, bvhFaces[i]);
+  }
+  std::chrono::duration<double, std::micro> bvhTime =
+    std::chrono::steady_clock::now() - start;
+
+  // Rays through shared edges may legitimately pick either face.
+  unsigned int hits = 0;
+  unsigned int mismatches = 0;
+  for (unsigned int i = 0; i < NUM_RAYS; ++i) {
+    hits += bvhFaces[i] >= 0 ? 1 : 0;
+    mismatches += bvhFaces[i] != mayaFaces[i] ? 1 : 0;
+  }
+
+  MString line = "bvh build: ";
+  line += buildTime.count();
+  line += " ms (";
+  line += bvh.numTriangles();
+  line += " triangles, ";
+  line += bvh.numNodes();
+  line += " nodes)";
+  results.append(line);
+
+  line = "bvh refit: ";
+  line += refitTime.count();
+  line += " ms";
+  results.append(line);
+
+  line = "closestIntersection: ";
+  line += mayaTime.count() / NUM_RAYS;
+  line += " us/ray";
+  results.append(line);
+
+  line = "bvh: ";
+  line += bvhTime.count() / NUM_RAYS;
+  line += " us/ray, ";
+  line += mayaTime.count() / bvhTime.count();
+  line += "x vs closestIntersection, ";
+  line += hits;
+  line += "/";
+  line += NUM_RAYS;
+  line += " hits, ";
+  line += mismatches;
+  line += " mismatched faces";
+  results.append(line);
+
+  return MS::kSuccess;
 }
 
 void MannequinContext::calculateJointLengthRatio(MDagPath jointDagPath) {
-  if (_autoAdjust && _autoAdjust.value() && jointDagPath.isValid()) {
+  Rig* selectionRig = rig(_selectionRig);
+  if (_autoAdjust && _autoAdjust.value() && jointDagPath.isValid() &&
+      selectionRig) {
     unsigned int children = jointDagPath.childCount();
     double maxLength = 0.0;
 
@@ -232,26 +562,30 @@ void MannequinContext::calculateJointLengthRatio(MDagPath jointDagPath) {
       }
     }
 
-    double rawRatio = maxLength / _longestJoint;
+    double rawRatio = maxLength / selectionRig->longestJoint();
     _jointLengthRatio = rawRatio * 0.75 + 0.25; // Scale to [1/4, 1].
   } else {
     _jointLengthRatio = 1.0;
   }
 }
 
-const std::vector<int>& MannequinContext::maxInfluences() const {
-  return _maxInfluences;
-}
-
-MDagPath MannequinContext::meshDagPath() const {
-  return _meshDagPath;
+const std::vector<int>& MannequinContext::maxInfluences(int rigId) {
+  static const std::vector<int> empty;
+  updateRig(rigId);
+  Rig* influenceRig = rig(rigId);
+  return influenceRig ? influenceRig->maxInfluences() : empty;
 }
 
-MObject MannequinContext::skinObject() const {
-  return _skinObject;
+const std::vector<int>& MannequinContext::facesForJoint(int rigId,
+  int jointId) {
+  static const std::vector<int> empty;
+  updateRig(rigId);
+  Rig* influenceRig = rig(rigId);
+  return influenceRig ? influenceRig->facesForJoint(jointId) : empty;
 }
 
-bool MannequinContext::addMannequinManipulator(MDagPath newHighlight) {
+bool MannequinContext::addMannequinManipulator(int newHighlightRig,
+  int newHighlight) {
   MObject mannequinManipObj;
   MStatus err;
   _mannequinManip = (MannequinManipulator*)MPxManipulatorNode::newManipulator(
@@ -261,19 +595,78 @@ bool MannequinContext::addMannequinManipulator(MDagPath newHighlight) {
     return false;
   }
 
-  _mannequinManip->setup(this, newHighlight);
+  _mannequinManip->setup(this, newHighlightRig, newHighlight);
   addManipulator(mannequinManipObj);
   return true;
 }
 
+bool MannequinContext::createOverlays() {
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    MStatus err;
+    MDagModifier dagMod;
+    MObject transformObj = dagMod.createNode(MannequinOverlay::id,
+      MObject::kNullObj, &err);
+    if (err.error()) {
+      deleteOverlays();
+      return false;
+    }
+
+    err = dagMod.doIt();
+    if (err.error()) {
+      deleteOverlays();
+      return false;
+    }
+
+    MFnDagNode transform(transformObj);
+    MFnDependencyNode shape(transform.child(0));
+    MannequinOverlay* overlay =
+      dynamic_cast<MannequinOverlay*>(shape.userNode());
+    _overlays.push_back(overlay);
+    _overlayTransforms.push_back(transformObj);
+    if (!overlay) {
+      deleteOverlays();
+      return false;
+    }
+
+    // The overlay only lives as long as the tool, so keep it out of files.
+    transform.setDoNotWrite(true);
+    shape.setDoNotWrite(true);
+
+    overlay->setup(this, i);
+  }
+
+  return true;
+}
+
+void MannequinContext::deleteOverlays() {
+  MDagModifier dagMod;
+  for (const MObjectHandle& overlayTransform : _overlayTransforms) {
+    if (overlayTransform.isAlive()) {
+      dagMod.deleteNode(overlayTransform.object());
+    }
+  }
+  dagMod.doIt();
+
+  _overlays.clear();
+  _overlayTransforms.clear();
+}
+
+void MannequinContext::updateOverlays(int hoverRigId, int hoverJointId) {
+  for (unsigned int i = 0; i < _overlays.size(); ++i) {
+    _overlays[i]->setHighlight(
+      (int)i == hoverRigId ? hoverJointId : -1,
+      (int)i == _selectionRig ? _selection : -1);
+  }
+}
+
 bool MannequinContext::intersectManip(MPxManipulatorNode* manip) {
-  if (_rotateManip) {
+  if (!_rotateManip.isNull()) {
     MPoint linePoint;
     MVector lineDirection;
     manip->mouseRayWorld(linePoint, lineDirection);
 
     MStatus err;
-    MFnTransform selectionXform(_selection);
+    MFnTransform selectionXform(selectionDagPath());
     MPoint selectionPivot = selectionXform.rotatePivot(MSpace::kWorld, &err);
 
     // Extend manipulator radius a bit because of the free-rotation "shell".
@@ -290,7 +683,7 @@ bool MannequinContext::intersectManip(MPxManipulatorNode* manip) {
     }
   }
 
-  if (_moveManip) {
+  if (_moveManip && _moveManip->hasTarget()) {
     bool hit = _moveManip->intersectManip(manip);
     if (hit) {
       return true;
@@ -300,6 +693,83 @@ bool MannequinContext::intersectManip(MPxManipulatorNode* manip) {
   return false;
 }
 
+bool MannequinContext::pickFace(const MPoint& rayOrigin,
+  const MVector& rayDirection,
+  int& hitRig,
+  int& hitFace,
+  Deadline* deadline) {
+  // Every rig is tested so that the character in front wins.
+  hitRig = -1;
+  float nearestParam = std::numeric_limits<float>::max();
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    int face;
+    float param;
+    if (_rigs[i]->pickFace(rayOrigin, rayDirection, face, param, deadline) &&
+        param < nearestParam) {
+      hitRig = i;
+      hitFace = face;
+      nearestParam = param;
+    }
+
+    if (deadline && deadline->wasExceeded()) {
+      return false;
+    }
+  }
+
+  return hitRig >= 0;
+}
+
+bool MannequinContext::pickFaceInView(M3dView& view, short x, short y,
+  int& hitRig,
+  int& hitFace,
+  Deadline* deadline) {
+  MMatrix modelView;
+  MMatrix projection;
+  view.modelViewMatrix(modelView);
+  view.projectionMatrix(projection);
+  MMatrix worldToClip = modelView * projection;
+
+  int width = view.portWidth();
+  int height = view.portHeight();
+  unsigned int numThreads = Parallel::resolveThreadCount(threadCount());
+
+  hitRig = -1;
+  bool overlap = false;
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    int face;
+    if (_rigs[i]->pickFaceInView(worldToClip, width, height, x, y,
+        numThreads, face, deadline)) {
+      overlap = hitRig >= 0;
+      hitRig = i;
+      hitFace = face;
+    }
+
+    if (deadline && deadline->wasExceeded()) {
+      return false;
+    }
+
+    if (overlap) {
+      break;
+    }
+  }
+
+  // The buffers keep no depth, so where characters overlap on screen the
+  // ray decides which one is in front.
+  if (overlap) {
+    MPoint rayOrigin;
+    MVector rayDirection;
+    view.viewToWorld(x, y, rayOrigin, rayDirection);
+    return pickFace(rayOrigin, rayDirection, hitRig, hitFace, deadline);
+  }
+
+  return hitRig >= 0;
+}
+
+MString MannequinContext::pickBufferInfo() const {
+  Rig* activeRig = rig(activeRigId());
+  return activeRig ? activeRig->pickBufferInfo() : MString();
+}
+
 double MannequinContext::manipScale() const {
   if (!_scale) {
     bool optionExists;
@@ -321,8 +791,8 @@ void MannequinContext::setManipScale(double scale) {
 
   _scale = scale;
 
-  if (_rotateManip || _moveManip) {
-    reselect();
+  if (!_rotateManip.isNull() || _moveManip) {
+    updateManipScale();
   }
 }
 
@@ -348,121 +818,358 @@ void MannequinContext::setManipAutoAdjust(bool autoAdjust) {
 
   _autoAdjust = autoAdjust;
 
-  if (_rotateManip || _moveManip) {
-    reselect();
+  if (!_rotateManip.isNull() || _moveManip) {
+    updateManipScale();
   }
 }
 
-float MannequinContext::manipAdjustedScale() const {
-  return float(manipScale() * MANIP_ADJUSTMENT * _longestJoint * _jointLengthRatio);
+int MannequinContext::threadCount() const {
+  if (!_threadCount) {
+    bool optionExists;
+    int threadCount = MGlobal::optionVarIntValue("chartreuseThreadCount",
+      &optionExists);
+
+    if (optionExists) {
+      _threadCount = threadCount;
+    } else {
+      _threadCount = 0;
+    }
+  }
+
+  return _threadCount.value();
+}
+
+void MannequinContext::setThreadCount(int threadCount) {
+  MGlobal::setOptionVarValue("chartreuseThreadCount", threadCount);
+
+  _threadCount = threadCount;
 }
 
-int MannequinContext::influenceIndexForJointDagPath(const MDagPath& dagPath) {
-  auto value = _dagIndexLookup.find(dagPath);
-  if (value != _dagIndexLookup.end()) {
-    return value->second;
+bool MannequinContext::faceCacheEnabled() const {
+  if (!_faceCacheEnabled) {
+    bool optionExists;
+    bool enabled = MGlobal::optionVarIntValue("chartreuseFaceCache",
+      &optionExists);
+
+    if (optionExists) {
+      _faceCacheEnabled = enabled;
+    } else {
+      _faceCacheEnabled = true;
+    }
   }
 
-  return -1;
+  return _faceCacheEnabled.value();
+}
+
+void MannequinContext::setFaceCacheEnabled(bool enabled) {
+  MGlobal::setOptionVarValue("chartreuseFaceCache", enabled);
+
+  _faceCacheEnabled = enabled;
 }
 
-int MannequinContext::presentationStyleForJointDagPath(
-  const MDagPath& dagPath) const {
-    auto styleIter = _dagStyleLookup.find(dagPath);
-    if (styleIter == _dagStyleLookup.end()) {
-      return JointPresentationStyle::NONE;
+int MannequinContext::pickMode() const {
+  if (!_pickMode) {
+    bool optionExists;
+    MString pickMode = MGlobal::optionVarStringValue("chartreusePickMode",
+      &optionExists);
+
+    if (optionExists) {
+      _pickMode = PickMode::fromString(pickMode);
+    } else {
+      _pickMode = PickMode::RAY;
     }
+  }
 
-    return styleIter->second;
+  return _pickMode.value();
 }
 
-void MannequinContext::toolOnSetup(MEvent& event) {
-  MSelectionList list;
-  MGlobal::getActiveSelectionList(list);
+void MannequinContext::setPickMode(int pickMode) {
+  MGlobal::setOptionVarValue("chartreusePickMode",
+    PickMode::toString(pickMode));
 
-  MDagPath dagPath;
-  MObject skinObj;
+  _pickMode = pickMode;
+  for (const std::shared_ptr<Rig>& cachedRig : _rigs) {
+    cachedRig->clearPickBuffer();
+  }
+}
 
-  // Verify whether the previous mesh and skin object are still valid.
-  if (_meshDagPath.isValid() && !_skinObject.isNull()) {
-    bool hasMesh = _meshDagPath.hasFn(MFn::kMesh);
-    MStatus err;
-    MFnSkinCluster skinCluster(_skinObject, &err);
-    bool hasSkin = !err.error();
+int MannequinContext::hoverThreshold() const {
+  if (!_hoverThreshold) {
+    bool optionExists;
+    int pixels = MGlobal::optionVarIntValue("chartreuseHoverThreshold",
+      &optionExists);
 
-    if (hasMesh && hasSkin) {
-      dagPath = _meshDagPath;
-      skinObj = _skinObject;
+    if (optionExists) {
+      _hoverThreshold = pixels;
+    } else {
+      _hoverThreshold = HOVER_DEFAULT_THRESHOLD;
     }
   }
 
-  // If there's a current selection, try to edit that instead.
-  if (list.length() != 0) {
-    list.getDagPath(0, dagPath);
-    dagPath.extendToShape();
+  return _hoverThreshold.value();
+}
 
-    if (!dagPath.hasFn(MFn::kMesh)) {
-      MGlobal::displayError("Selection is not a mesh");
-      forceExit();
-      return;
+void MannequinContext::setHoverThreshold(int pixels) {
+  MGlobal::setOptionVarValue("chartreuseHoverThreshold", pixels);
+
+  _hoverThreshold = pixels;
+
+  if (_mannequinManip) {
+    _mannequinManip->configureHover();
+  }
+}
+
+double MannequinContext::hoverRate() const {
+  if (!_hoverRate) {
+    bool optionExists;
+    double rate = MGlobal::optionVarDoubleValue("chartreuseHoverRate",
+      &optionExists);
+
+    if (optionExists) {
+      _hoverRate = rate;
+    } else {
+      _hoverRate = HOVER_DEFAULT_RATE;
     }
+  }
 
-    MFnMesh mesh(dagPath);
-    MItDependencyNodes depNodeIter(MFn::kSkinClusterFilter);
-    bool hasSkinCluster = false;
-    for(; !depNodeIter.isDone() && !hasSkinCluster; depNodeIter.next()) {
-      MObject node = depNodeIter.item();
-      MStatus err;
-      MFnSkinCluster skinCluster(node, &err);
-      if (err.error()) {
-        continue;
+  return _hoverRate.value();
+}
+
+void MannequinContext::setHoverRate(double rate) {
+  MGlobal::setOptionVarValue("chartreuseHoverRate", rate);
+
+  _hoverRate = rate;
+
+  if (_mannequinManip) {
+    _mannequinManip->configureHover();
+  }
+}
+
+double MannequinContext::hoverBudget() const {
+  if (!_hoverBudget) {
+    bool optionExists;
+    double budgetMs = MGlobal::optionVarDoubleValue("chartreuseHoverBudget",
+      &optionExists);
+
+    if (optionExists) {
+      _hoverBudget = budgetMs;
+    } else {
+      _hoverBudget = HOVER_DEFAULT_BUDGET;
+    }
+  }
+
+  return _hoverBudget.value();
+}
+
+void MannequinContext::setHoverBudget(double budgetMs) {
+  MGlobal::setOptionVarValue("chartreuseHoverBudget", budgetMs);
+
+  _hoverBudget = budgetMs;
+
+  if (_mannequinManip) {
+    _mannequinManip->configureHover();
+  }
+}
+
+double MannequinContext::paletteRate() const {
+  if (!_paletteRate) {
+    bool optionExists;
+    double rate = MGlobal::optionVarDoubleValue("chartreusePaletteRate",
+      &optionExists);
+
+    if (optionExists) {
+      _paletteRate = rate;
+    } else {
+      _paletteRate = PALETTE_DEFAULT_RATE;
+    }
+  }
+
+  return _paletteRate.value();
+}
+
+void MannequinContext::setPaletteRate(double rate) {
+  MGlobal::setOptionVarValue("chartreusePaletteRate", rate);
+
+  _paletteRate = rate;
+  _jointWatcher.setRate(rate);
+}
+
+const MString& MannequinContext::poseLibraryPath() const {
+  return _poseLibraryPath;
+}
+
+const PoseLibrary* MannequinContext::poseLibrary() const {
+  return _poseLibrary.get();
+}
+
+MStatus MannequinContext::setPoseLibrary(const MString& path) {
+  _poseLibraryPath = path;
+  _poseLibrary.reset();
+  if (path.length() == 0) {
+    return MS::kSuccess;
+  }
+
+  MStatus err;
+  _poseLibrary = PoseLibrary::acquire(path, &err);
+  if (err.statusCode() == MS::kNotFound) {
+    return MS::kSuccess;
+  }
+
+  return err;
+}
+
+MStatus MannequinContext::applyPose(const MString& poseName,
+  const MString& blendPoseName, double weight) {
+  Rig* activeRig = rig(activeRigId());
+  if (!activeRig || !activeRig->isValid() || !_poseLibrary) {
+    return MS::kFailure;
+  }
+
+  // Run it as mannequinPose so that the pose is one undo step.
+  MString command = "mannequinPose -e -library " +
+    melString(_poseLibraryPath) + " -pose " + melString(poseName);
+  if (blendPoseName.length() != 0) {
+    command += " -blend " + melString(blendPoseName) + " -weight ";
+    command += weight;
+  }
+  command += " " + melString(activeRig->meshDagPath().fullPathName());
+
+  return MGlobal::executeCommand(command, false, true);
+}
+
+MStatus MannequinContext::savePose(const MString& poseName) {
+  updateRigs();
+
+  Rig* activeRig = rig(activeRigId());
+  if (!activeRig || !activeRig->isValid() ||
+      _poseLibraryPath.length() == 0 || poseName.length() == 0) {
+    return MS::kFailure;
+  }
+
+  unsigned int numJoints = activeRig->numJoints();
+  std::vector<std::string> jointNames(numJoints);
+  MDoubleArray values;
+  for (unsigned int i = 0; i < numJoints; ++i) {
+    MDagPath jointDagPath = activeRig->jointDagPath(i);
+    jointNames[i] = PoseLibrary::jointKey(jointDagPath);
+
+    MStatus err = PoseWriter::read(jointDagPath, KeyIndex::kAllChannels,
+      values, PoseWriter::kInternalUnits);
+    if (err.error()) {
+      return err;
+    }
+  }
+
+  std::vector<double> flatValues(values.length());
+  values.get(flatValues.data());
+
+  // Let go of the old mapping so that the file can be replaced.
+  _poseLibrary.reset();
+  MStatus err = PoseLibrary::savePose(_poseLibraryPath, poseName,
+    jointNames, flatValues);
+  _poseLibrary = PoseLibrary::acquire(_poseLibraryPath);
+
+  return err;
+}
+
+float MannequinContext::manipAdjustedScale() const {
+  Rig* selectionRig = rig(_selectionRig);
+  double longestJoint = selectionRig ? selectionRig->longestJoint() : 0.0;
+  return float(manipScale() * MANIP_ADJUSTMENT * longestJoint * _jointLengthRatio);
+}
+
+void MannequinContext::toolOnSetup(MEvent& event) {
+  Stats::ScopedTimer timer(Stats::kSetup);
+
+  MSelectionList list;
+  MGlobal::getActiveSelectionList(list);
+
+  std::vector<std::shared_ptr<Rig>> rigs;
+
+  // Every selected mesh becomes a character to pose. With no selection, go
+  // back to the previous characters if they're still valid.
+  if (list.length() != 0) {
+    for (unsigned int i = 0; i < list.length(); ++i) {
+      MDagPath dagPath;
+      list.getDagPath(i, dagPath);
+      dagPath.extendToShape();
+
+      if (!dagPath.hasFn(MFn::kMesh)) {
+        MGlobal::displayError("Selection is not a mesh");
+        forceExit();
+        return;
       }
 
-      unsigned int numGeoms = skinCluster.numOutputConnections();
-      for (unsigned int i = 0; i < numGeoms && !hasSkinCluster; ++i) {
-        unsigned int index = skinCluster.indexForOutputConnection(i);
-        MObject output = skinCluster.outputShapeAtIndex(index);
-        if(output == mesh.object())
-        {
-          hasSkinCluster = true;
-          skinObj = node;
-        }
+      MObject skinObj;
+      {
+        Stats::ScopedTimer stageTimer(Stats::kSetupFindSkin);
+        skinObj = Rig::findSkinCluster(dagPath);
       }
-    }
 
-    if (!hasSkinCluster) {
-      MGlobal::displayError("Selection has no smooth skin bound");
-      forceExit();
-      return;
+      bool hasSkinCluster = !skinObj.isNull();
+      if (!hasSkinCluster) {
+        MGlobal::displayError("Selection has no smooth skin bound");
+        forceExit();
+        return;
+      }
+
+      std::shared_ptr<Rig> selectedRig = Rig::acquire(dagPath, skinObj);
+      if (std::find(rigs.begin(), rigs.end(), selectedRig) == rigs.end()) {
+        rigs.push_back(selectedRig);
+      }
+    }
+  } else {
+    for (const std::shared_ptr<Rig>& cachedRig : _rigs) {
+      if (cachedRig->isValid()) {
+        rigs.push_back(cachedRig);
+      }
     }
   }
 
   // If we still don't have anything selected, we can't continue.
-  if (!dagPath.isValid() || skinObj.isNull()) {
+  if (rigs.empty()) {
     MGlobal::displayError("Nothing selected");
     forceExit();
     return;
   }
 
-  // Add DAG paths to their lookup tables.
-  calculateDagLookupTables(skinObj);
+  // Rigs that were already set up by this or another session only update
+  // what changed since.
+  _rigs.swap(rigs);
+  rigs.clear();
+  _selectionRig = -1;
+  _selection = -1;
 
-  // Calculate the max influences for each face.
-  calculateMaxInfluences(dagPath, skinObj);
+  unsigned int numThreads = Parallel::resolveThreadCount(threadCount());
+  for (const std::shared_ptr<Rig>& cachedRig : _rigs) {
+    cachedRig->setup(numThreads, faceCacheEnabled());
+  }
+
+  // The overlays draw the hovered and selected regions, so they have to
+  // exist before the manipulator starts highlighting.
+  bool didCreateOverlays;
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupOverlay);
+    didCreateOverlays = createOverlays();
+  }
 
-  // Determine the longest joint length in the rig.
-  calculateLongestJoint(skinObj);
+  if (!didCreateOverlays) {
+    MGlobal::displayWarning("Could not create the highlight overlay");
+  }
 
   // Finally add the manipulator.
-  bool didAdd = addMannequinManipulator();
+  bool didAdd;
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupManipulator);
+    didAdd = addMannequinManipulator();
+  }
+
   if (!didAdd) {
     MGlobal::displayError("Could not create manipulator");
     forceExit();
     return;
   }
 
-  _meshDagPath = dagPath;
-  _skinObject = skinObj;
   MGlobal::clearSelectionList();
 
   // Set image, title text, etc.
@@ -474,23 +1181,49 @@ void MannequinContext::toolOnSetup(MEvent& event) {
   _callbacks.append(MAnimMessage::addAnimKeyframeEditCheckCallback(
     MannequinContext::keyframeCallback
   ));
+
+  // Renames or reparenting change the cached joint names of any rig. The
+  // rigs watch their own meshes and skins.
+  _callbacks.append(MDagMessage::addParentAddedCallback(
+    MannequinContext::parentChangedCallback, this));
+  _callbacks.append(MDagMessage::addParentRemovedCallback(
+    MannequinContext::parentChangedCallback, this));
+  MObject allNodes;
+  _callbacks.append(MNodeMessage::addNameChangedCallback(allNodes,
+    MannequinContext::nameChangedCallback, this));
+
+  // Joint edits reach the palette in one batch per idle.
+  _jointWatcher.setRate(paletteRate());
+  for (unsigned int i = 0; i < _rigs.size(); ++i) {
+    _jointWatcher.watch(i, *_rigs[i]);
+    _rigs[i]->setEditCallback(MannequinContext::rigEditedCallback, this);
+  }
 }
 
 void MannequinContext::toolOffCleanup() {
-  select(MDagPath());
+  select(-1, -1);
 
   MMessage::removeCallbacks(_callbacks);
   _callbacks.clear();
+  _jointWatcher.unwatch();
+  stopRigUpdateCallback();
+  for (const std::shared_ptr<Rig>& cachedRig : _rigs) {
+    cachedRig->setEditCallback(nullptr, nullptr);
+  }
 
   _mannequinManip = nullptr;
-  _rotateManip = nullptr;
+  _rotateManip = MObject::kNullObj;
+  _rotateManips.clear();
   _moveManip = nullptr;
 
-  _maxInfluences.clear();
-  _dagIndexLookup.clear();
-  _dagStyleLookup.clear();
+  // The rigs stay cached for the next session, but the per-view buffers
+  // are only worth keeping while hovering.
+  for (const std::shared_ptr<Rig>& cachedRig : _rigs) {
+    cachedRig->clearPickBuffer();
+  }
 
   deleteManipulators();
+  deleteOverlays();
   MGlobal::clearSelectionList();
   MGlobal::executeCommand("mannequinContextFinish");
 }
@@ -508,6 +1241,52 @@ void MannequinContext::keyframeCallback(bool* retCode,
   return;
 }
 
+void MannequinContext::parentChangedCallback(MDagPath& child,
+  MDagPath& parent, void* clientData) {
+  MannequinContext* ctx = static_cast<MannequinContext*>(clientData);
+  if (child.hasFn(MFn::kTransform)) {
+    for (const std::shared_ptr<Rig>& cachedRig : ctx->_rigs) {
+      cachedRig->markJointTableDirty();
+    }
+  }
+}
+
+void MannequinContext::nameChangedCallback(MObject& node,
+  const MString& prevName, void* clientData) {
+  MannequinContext* ctx = static_cast<MannequinContext*>(clientData);
+  if (node.hasFn(MFn::kTransform)) {
+    for (const std::shared_ptr<Rig>& cachedRig : ctx->_rigs) {
+      cachedRig->markJointTableDirty();
+    }
+  }
+}
+
+void MannequinContext::rigEditedCallback(void* clientData) {
+  MannequinContext* ctx = static_cast<MannequinContext*>(clientData);
+  if (!ctx->_hasRigUpdateCallback) {
+    MStatus err;
+    ctx->_rigUpdateCallbackId = MEventMessage::addEventCallback("idle",
+      MannequinContext::rigUpdateCallback, ctx, &err);
+    ctx->_hasRigUpdateCallback = !err.error();
+  }
+}
+
+void MannequinContext::rigUpdateCallback(void* clientData) {
+  MannequinContext* ctx = static_cast<MannequinContext*>(clientData);
+  ctx->stopRigUpdateCallback();
+  ctx->updateRigs();
+
+  // The overlays pick up the new face versions on the next refresh.
+  M3dView::scheduleRefreshAllViews();
+}
+
+void MannequinContext::stopRigUpdateCallback() {
+  if (_hasRigUpdateCallback) {
+    MMessage::removeCallback(_rigUpdateCallbackId);
+    _hasRigUpdateCallback = false;
+  }
+}
+
 void MannequinContext::getClassName(MString& name) const {
   // Note: when setToolTo is called from MEL, Maya will try to load
   // mannequinContextProperties and mannequinContextValues.
@@ -529,26 +1308,35 @@ MStatus MannequinContext::doPress() {
     return MS::kUnknownParameter;
   }
 
-  select(_mannequinManip->highlightedDagPath());
+  // Click to manipulator ready, including any teardown.
+  Stats::ScopedTimer timer(Stats::kPress);
+
+  // Clicking another character switches to it straight away.
+  select(_mannequinManip->highlightedRigId(),
+    _mannequinManip->highlightedJointId());
   return MS::kSuccess;
 }
 
 void MannequinContext::abortAction() {
-  select(MDagPath());
+  select(-1, -1);
 }
 
 void MannequinContext::completeAction() {
-  if (_selection.isValid() && _selectionStyle != _availableStyles) {
+  if (_selection >= 0 && _selectionStyle != _availableStyles) {
     if (_selectionStyle == JointPresentationStyle::ROTATE) {
-      select(_selection, JointPresentationStyle::TRANSLATE);
+      select(_selectionRig, _selection, JointPresentationStyle::TRANSLATE);
     } else if (_selectionStyle == JointPresentationStyle::TRANSLATE) {
-      select(_selection, JointPresentationStyle::ROTATE);
+      select(_selectionRig, _selection, JointPresentationStyle::ROTATE);
     }
   }
 }
 
 void MannequinContext::updateText() {
-  if (_selection.isValid() && _selectionStyle != _availableStyles) {
+  Rig* selectionRig = rig(_selectionRig);
+  const MString& selectionName = selectionRig ?
+    selectionRig->jointName(_selection) : MString();
+
+  if (_selection >= 0 && _selectionStyle != _availableStyles) {
     MString next;
     if (_selectionStyle == JointPresentationStyle::ROTATE) {
       next = "translation";
@@ -561,14 +1349,14 @@ void MannequinContext::updateText() {
     MString help;
     help.format(
       "^1s selected. Press ESC to deselect. Press ENTER to switch to ^2s.",
-      _selection.partialPathName(),
+      selectionName,
       next);
     setHelpString(help);
-  } else if (_selection.isValid()) {
+  } else if (_selection >= 0) {
     MString help;
     help.format(
       "^1s selected. Press ESC to deselect.",
-      _selection.partialPathName());
+      selectionName);
     setHelpString(help);
   } else {
     setHelpString("Click on the mesh to select a part.");
@@ -608,23 +1396,13 @@ MStatus MannequinContextCommand::doEditFlags() {
       return err;
     }
 
-    MFnSkinCluster skin(_mannequinContext->skinObject(), &err);
-    if (err.error()) {
-      return err;
-    }
-
-    MDagPathArray influenceObjects;
-    unsigned int numInfluences = skin.influenceObjects(influenceObjects);
-
-    for (unsigned int i = 0; i < numInfluences; i++) {
-      MString fullName = influenceObjects[i].fullPathName();
-      MString partialName = influenceObjects[i].partialPathName();
-
-      if (nameArg == fullName || nameArg == partialName) {
-        _mannequinContext->select(influenceObjects[i],
-          JointPresentationStyle::fromString(styleArg));
-        return MS::kSuccess;
-      }
+    _mannequinContext->updateRigs();
+    int rigId;
+    int jointId;
+    if (_mannequinContext->findJoint(nameArg, rigId, jointId)) {
+      _mannequinContext->select(rigId, jointId,
+        JointPresentationStyle::fromString(styleArg));
+      return MS::kSuccess;
     }
 
     MString errMessage;
@@ -648,6 +1426,189 @@ MStatus MannequinContextCommand::doEditFlags() {
 
     _mannequinContext->setManipAutoAdjust(arg);
     return MS::kSuccess;
+  } else if (parse.isFlagSet("-tc")) {
+    MStatus err;
+    int arg = parse.flagArgumentInt("-tc", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setThreadCount(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-fc")) {
+    MStatus err;
+    bool arg = parse.flagArgumentBool("-fc", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setFaceCacheEnabled(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-pm")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-pm", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    if (arg != "ray" && arg != "buffer") {
+      return MS::kInvalidParameter;
+    }
+
+    _mannequinContext->setPickMode(PickMode::fromString(arg));
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-pbi")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-jc")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-ji")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-ks")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-dj")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-rg")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-ht")) {
+    MStatus err;
+    int arg = parse.flagArgumentInt("-ht", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setHoverThreshold(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-hr")) {
+    MStatus err;
+    double arg = parse.flagArgumentDouble("-hr", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setHoverRate(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-hb")) {
+    MStatus err;
+    double arg = parse.flagArgumentDouble("-hb", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setHoverBudget(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-pr")) {
+    MStatus err;
+    double arg = parse.flagArgumentDouble("-pr", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    _mannequinContext->setPaletteRate(arg);
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-pl")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-pl", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    // A path that doesn't exist yet starts a new library on the first save.
+    err = _mannequinContext->setPoseLibrary(arg);
+    if (err.error()) {
+      MGlobal::displayError("Could not open pose library " + arg);
+    }
+    return err;
+  } else if (parse.isFlagSet("-pn")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-ap")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-ap", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    return _mannequinContext->applyPose(arg);
+  } else if (parse.isFlagSet("-bp")) {
+    MStatus err;
+    MString arg0 = parse.flagArgumentString("-bp", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    MString arg1 = parse.flagArgumentString("-bp", 1, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    // The weight of the second pose; halfway if not given.
+    double weight = 0.5;
+    if (parse.isFlagSet("-bw")) {
+      weight = parse.flagArgumentDouble("-bw", 0, &err);
+      if (err.error()) {
+        return err;
+      }
+    }
+
+    return _mannequinContext->applyPose(arg0, arg1, weight);
+  } else if (parse.isFlagSet("-sp")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-sp", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    err = _mannequinContext->savePose(arg);
+    if (err.error()) {
+      MGlobal::displayError("Could not save pose " + arg);
+    }
+    return err;
+  } else if (parse.isFlagSet("-st")) {
+    Stats::reset();
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-tf")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-tf", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    // An empty path ends the trace in progress.
+    if (arg.length() == 0) {
+      Trace::stop();
+      return MS::kSuccess;
+    }
+
+    err = Trace::start(arg);
+    if (err.error()) {
+      MString errMessage;
+      errMessage.format("Couldn't open trace file ^1s", arg);
+      MGlobal::displayError(errMessage);
+      return err;
+    }
+
+    return MS::kSuccess;
+  } else if (parse.isFlagSet("-bm")) {
+    MStatus err;
+    MString arg = parse.flagArgumentString("-bm", 0, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    MStringArray results;
+    if (arg == "faces") {
+      err = _mannequinContext->benchmarkFaceKernels(results);
+    } else if (arg == "pick") {
+      err = _mannequinContext->benchmarkPicking(results);
+    } else {
+      err = MS::kInvalidParameter;
+    }
+
+    if (err.error()) {
+      return err;
+    }
+
+    setResult(results);
+    return MS::kSuccess;
   } else if (parse.isFlagSet("-sak")) {
     int autoState;
     MGlobal::executeCommand("autoKeyframe -q -state", autoState);
@@ -684,48 +1645,184 @@ MStatus MannequinContextCommand::doQueryFlags() {
   }
 
   if (parse.isFlagSet("-io")) {
-    MStatus err;
-    MFnSkinCluster skin(_mannequinContext->skinObject(), &err);
-    if (err.error()) {
-      return err;
-    }
-
-    MDagPathArray influenceObjects;
-    unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+    _mannequinContext->updateRigs();
 
+    // Influences of every character, so that the palette can switch
+    // between them; full path names keep them apart.
     MString result;
-    for (unsigned int i = 0; i < numInfluences; i++) {
-      if (i != 0) {
-        result += " ";
-      }
+    for (unsigned int r = 0; r < _mannequinContext->numRigs(); ++r) {
+      Rig* rig = _mannequinContext->rig(r);
+      unsigned int numJoints = rig->numJoints();
+      for (unsigned int i = 0; i < numJoints; i++) {
+        if (result.length() != 0) {
+          result += " ";
+        }
 
-      MDagPath dagPath = influenceObjects[i];
-      int style = _mannequinContext->presentationStyleForJointDagPath(dagPath);
+        int style = rig->jointStyle(i);
 
-      result += dagPath.fullPathName();
-      result += " ";
-      result += JointPresentationStyle::toString(style);
+        result += rig->jointFullName(i);
+        result += " ";
+        result += JointPresentationStyle::toString(style);
+      }
     }
 
     setResult(result);
   } else if (parse.isFlagSet("-sel")) {
-    MDagPath dagPath = _mannequinContext->selectionDagPath();
-    MString result;
-    if (dagPath.isValid()) {
-      result = MString(dagPath.fullPathName());
-      result += " ";
-      result += _mannequinContext->selectionStyle();
-    } else {
-      result = MString("");
+    _mannequinContext->updateRigs();
+
+    // Full path and style, or nothing if no joint is selected.
+    Rig* rig = _mannequinContext->rig(_mannequinContext->selectionRigId());
+    int jointId = _mannequinContext->selectionJointId();
+    MStringArray results;
+    if (rig && jointId >= 0) {
+      results.append(rig->jointFullName(jointId));
+      results.append(JointPresentationStyle::toString(
+        _mannequinContext->selectionStyle()));
     }
 
-    setResult(result);
+    setResult(results);
   } else if (parse.isFlagSet("-ms")) {
     double result = _mannequinContext->manipScale();
     setResult(result);
   } else if (parse.isFlagSet("-ma")) {
     bool result = _mannequinContext->manipAutoAdjust();
     setResult(result);
+  } else if (parse.isFlagSet("-tc")) {
+    int result = _mannequinContext->threadCount();
+    setResult(result);
+  } else if (parse.isFlagSet("-fc")) {
+    bool result = _mannequinContext->faceCacheEnabled();
+    setResult(result);
+  } else if (parse.isFlagSet("-pm")) {
+    MString result = PickMode::toString(_mannequinContext->pickMode());
+    setResult(result);
+  } else if (parse.isFlagSet("-pbi")) {
+    MString result = _mannequinContext->pickBufferInfo();
+    setResult(result);
+  } else if (parse.isFlagSet("-jc")) {
+    _mannequinContext->updateRigs();
+
+    unsigned int result = 0;
+    for (unsigned int i = 0; i < _mannequinContext->numRigs(); ++i) {
+      result += _mannequinContext->rig(i)->numJoints();
+    }
+    setResult((int)result);
+  } else if (parse.isFlagSet("-ji")) {
+    _mannequinContext->updateRigs();
+
+    // A page of joints, indexed across all rigs in order, with an optional
+    // start and count so that big rigs can be fetched in pieces. Each joint
+    // is five strings: rig ID, joint ID, parent joint ID (-1 for a root),
+    // style and full path.
+    MStatus err;
+    int start = parse.flagArgumentInt("-ji", 0, &err);
+    if (err.error() || start < 0) {
+      start = 0;
+    }
+
+    int count = parse.flagArgumentInt("-ji", 1, &err);
+    if (err.error() || count < 0) {
+      count = std::numeric_limits<int>::max();
+    }
+
+    MStringArray results;
+    int index = 0;
+    for (unsigned int r = 0; r < _mannequinContext->numRigs() && count > 0;
+        ++r) {
+      Rig* rig = _mannequinContext->rig(r);
+      int numJoints = (int)rig->numJoints();
+      if (index + numJoints <= start) {
+        index += numJoints;
+        continue;
+      }
+
+      for (int i = std::max(start - index, 0); i < numJoints && count > 0;
+          ++i, --count) {
+        MString rigId;
+        rigId += (int)r;
+        MString jointId;
+        jointId += i;
+        MString parentId;
+        parentId += rig->jointParent(i);
+
+        results.append(rigId);
+        results.append(jointId);
+        results.append(parentId);
+        results.append(JointPresentationStyle::toString(rig->jointStyle(i)));
+        results.append(rig->jointFullName(i));
+      }
+      index += numJoints;
+    }
+
+    setResult(results);
+  } else if (parse.isFlagSet("-ks")) {
+    Stats::ScopedTimer timer(Stats::kKeyStatus);
+    _mannequinContext->updateRigs();
+
+    // One bitmask per joint in -jointInfo order, with bits 0-2 set for
+    // translate X/Y/Z and 3-5 for rotate X/Y/Z if keyed at the current time.
+    MTime time = MAnimControl::currentTime();
+    MIntArray results;
+    for (unsigned int i = 0; i < _mannequinContext->numRigs(); ++i) {
+      _mannequinContext->rig(i)->appendKeyedChannels(time, results);
+    }
+    setResult(results);
+  } else if (parse.isFlagSet("-dj")) {
+    // The batch of the last mannequinJointsChanged event: its flags, then
+    // three ints per joint: rig ID, joint ID and the dirtied channels, with
+    // the same bits as -keyStatus.
+    const JointWatcher::Batch& batch = _mannequinContext->jointChanges();
+    MIntArray results;
+    results.append(batch.flags);
+    for (const JointWatcher::Change& change : batch.changes) {
+      results.append(change.rigId);
+      results.append(change.jointId);
+      results.append(change.channels);
+    }
+    setResult(results);
+  } else if (parse.isFlagSet("-rg")) {
+    MStringArray results;
+    for (unsigned int i = 0; i < _mannequinContext->numRigs(); ++i) {
+      results.append(_mannequinContext->rig(i)->meshDagPath().fullPathName());
+    }
+    setResult(results);
+  } else if (parse.isFlagSet("-ht")) {
+    int result = _mannequinContext->hoverThreshold();
+    setResult(result);
+  } else if (parse.isFlagSet("-hr")) {
+    double result = _mannequinContext->hoverRate();
+    setResult(result);
+  } else if (parse.isFlagSet("-hb")) {
+    double result = _mannequinContext->hoverBudget();
+    setResult(result);
+  } else if (parse.isFlagSet("-pr")) {
+    double result = _mannequinContext->paletteRate();
+    setResult(result);
+  } else if (parse.isFlagSet("-pl")) {
+    MString result = _mannequinContext->poseLibraryPath();
+    setResult(result);
+  } else if (parse.isFlagSet("-pn")) {
+    MStringArray results;
+    const PoseLibrary* poseLibrary = _mannequinContext->poseLibrary();
+    if (poseLibrary) {
+      poseLibrary->appendPoseNames(results);
+    }
+    setResult(results);
+  } else if (parse.isFlagSet("-ap")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-bp")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-sp")) {
+    return MS::kInvalidParameter;
+  } else if (parse.isFlagSet("-st")) {
+    MStringArray results;
+    Stats::report(results);
+    setResult(results);
+  } else if (parse.isFlagSet("-tf")) {
+    MString result = Trace::path();
+    setResult(result);
+  } else if (parse.isFlagSet("-bm")) {
+    return MS::kInvalidParameter;
   } else if (parse.isFlagSet("-sak")) {
     return MS::kInvalidParameter;
   } else if (parse.isFlagSet("-rak")) {
@@ -742,6 +1839,29 @@ MStatus MannequinContextCommand::appendSyntax() {
   syn.addFlag("-sel", "-selection", MSyntax::kString, MSyntax::kString);
   syn.addFlag("-ms", "-manipSize", MSyntax::kDouble);
   syn.addFlag("-ma", "-manipAdjust", MSyntax::kDouble);
+  syn.addFlag("-tc", "-threadCount", MSyntax::kLong);
+  syn.addFlag("-fc", "-faceCache", MSyntax::kBoolean);
+  syn.addFlag("-pm", "-pickMode", MSyntax::kString);
+  syn.addFlag("-pbi", "-pickBufferInfo");
+  syn.addFlag("-jc", "-jointCount");
+  syn.addFlag("-ji", "-jointInfo", MSyntax::kLong, MSyntax::kLong);
+  syn.makeFlagQueryWithFullArgs("-ji", true);
+  syn.addFlag("-ks", "-keyStatus");
+  syn.addFlag("-dj", "-dirtyJoints");
+  syn.addFlag("-rg", "-rigs");
+  syn.addFlag("-ht", "-hoverThreshold", MSyntax::kLong);
+  syn.addFlag("-hr", "-hoverRate", MSyntax::kDouble);
+  syn.addFlag("-hb", "-hoverBudget", MSyntax::kDouble);
+  syn.addFlag("-pr", "-paletteRate", MSyntax::kDouble);
+  syn.addFlag("-pl", "-poseLibrary", MSyntax::kString);
+  syn.addFlag("-pn", "-poseNames");
+  syn.addFlag("-ap", "-applyPose", MSyntax::kString);
+  syn.addFlag("-bp", "-blendPoses", MSyntax::kString, MSyntax::kString);
+  syn.addFlag("-bw", "-blendWeight", MSyntax::kDouble);
+  syn.addFlag("-sp", "-savePose", MSyntax::kString);
+  syn.addFlag("-st", "-stats");
+  syn.addFlag("-tf", "-traceFile", MSyntax::kString);
+  syn.addFlag("-bm", "-benchmark", MSyntax::kString);
   syn.addFlag("-sak", "-saveAutoKeyframe");
   syn.addFlag("-rak", "-restoreAutoKeyframe", MSyntax::kBoolean);
 
@@ -753,9 +1873,17 @@ MStatus initializePlugin(MObject obj)
   MStatus status;
   MFnPlugin plugin(obj, "Steven Dao", "0.25", "Any");
 
+  Trace::initialize();
+  SelectionEvent::initialize();
+  JointWatcher::initialize();
+
   status = plugin.registerContextCommand("mannequinContext",
     MannequinContextCommand::creator);
 
+  status = plugin.registerCommand("mannequinPose",
+    MannequinPoseCommand::creator,
+    MannequinPoseCommand::newSyntax);
+
   status = plugin.registerNode("MannequinManipulator",
     MannequinManipulator::id,
     &MannequinManipulator::creator,
@@ -768,6 +1896,18 @@ MStatus initializePlugin(MObject obj)
     &MannequinMoveManipulator::initialize,
     MPxNode::kManipulatorNode);
 
+  status = plugin.registerNode("MannequinOverlay",
+    MannequinOverlay::id,
+    &MannequinOverlay::creator,
+    &MannequinOverlay::initialize,
+    MPxNode::kLocatorNode,
+    &MannequinOverlay::drawDbClassification);
+
+  status = MHWRender::MDrawRegistry::registerSubSceneOverrideCreator(
+    MannequinOverlay::drawDbClassification,
+    MannequinOverlay::drawRegistrantId,
+    MannequinOverlayOverride::creator);
+
   status = MGlobal::executePythonCommand("from mannequin import *");
   status = MGlobal::sourceFile("mannequin.mel");
   status = MGlobal::executeCommand("mannequinInstallShelf");
@@ -781,8 +1921,17 @@ MStatus uninitializePlugin(MObject obj)
   MFnPlugin plugin(obj);
 
   status = plugin.deregisterContextCommand("mannequinContext");
+  status = plugin.deregisterCommand("mannequinPose");
   status = plugin.deregisterNode(MannequinManipulator::id);
   status = plugin.deregisterNode(MannequinMoveManipulator::id);
+  status = MHWRender::MDrawRegistry::deregisterSubSceneOverrideCreator(
+    MannequinOverlay::drawDbClassification,
+    MannequinOverlay::drawRegistrantId);
+  status = plugin.deregisterNode(MannequinOverlay::id);
+
+  JointWatcher::uninitialize();
+  SelectionEvent::uninitialize();
+  Trace::uninitialize();
 
   return status;
 }
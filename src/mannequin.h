@@ -1,8 +1,9 @@
 #pragma once
 
-#include <vector>
+#include <memory>
 #include <string>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 #include <maya/MPxContext.h>
 #include <maya/MPxContextCommand.h>
@@ -12,13 +13,21 @@
 #include <maya/MVector.h>
 #include <maya/MPxManipulatorNode.h>
 #include <maya/MCallbackIdArray.h>
+#include <maya/MStringArray.h>
+#include <maya/M3dView.h>
+#include <maya/MObjectHandle.h>
+#include <maya/MPlug.h>
 
 #include <boost/optional.hpp>
 
-#include "stdext.h"
+#include "rig.h"
+#include "joint_watcher.h"
+#include "pose_library.h"
+#include "deadline.h"
 
 class MannequinManipulator;
 class MannequinMoveManipulator;
+class MannequinOverlay;
 
 namespace JointPresentationStyle {
   const int NONE = 0;
@@ -44,31 +53,83 @@ namespace JointPresentationStyle {
   }
 }
 
+namespace PickMode {
+  // Raycast against the pick BVH on every mouse move.
+  const int RAY = 0;
+  // Read the face from a rasterized face-ID buffer of the viewport.
+  const int BUFFER = 1;
+
+  inline MString toString(int mode) {
+    return mode == PickMode::BUFFER ? "buffer" : "ray";
+  }
+
+  inline int fromString(MString string) {
+    return string == "buffer" ? PickMode::BUFFER : PickMode::RAY;
+  }
+}
+
 class MannequinContext : public MPxContext {
 public:
   MannequinContext();
   void forceExit();
+  void select(int rigId, int jointId,
+    int style = JointPresentationStyle::NONE);
   void select(const MDagPath& dagPath, int style =
     JointPresentationStyle::NONE);
-  void reselect();
+  void resetManipulators();
+  void updateManipScale();
   MDagPath selectionDagPath() const;
+  int selectionRigId() const;
+  int selectionJointId() const;
   int selectionStyle() const;
-  void calculateDagLookupTables(MObject skinObj);
-  void calculateMaxInfluences(MDagPath meshDagPath, MObject skinObject);
-  void calculateLongestJoint(MObject skinObject);
+  unsigned int numRigs() const;
+  Rig* rig(int rigId) const;
+  int activeRigId() const;
+  bool findJoint(const MString& name, int& rigId, int& jointId) const;
+  void updateRig(int rigId);
+  void updateRigs();
+  const JointWatcher::Batch& jointChanges() const;
+  MStatus benchmarkFaceKernels(MStringArray& results);
+  MStatus benchmarkPicking(MStringArray& results);
   void calculateJointLengthRatio(MDagPath jointDagPath);
-  const std::vector<int>& maxInfluences() const;
-  MDagPath meshDagPath() const;
-  MObject skinObject() const;
-  bool addMannequinManipulator(MDagPath newHighlight = MDagPath());
+  const std::vector<int>& maxInfluences(int rigId);
+  const std::vector<int>& facesForJoint(int rigId, int jointId);
+  bool addMannequinManipulator(int newHighlightRig = -1,
+    int newHighlight = -1);
+  bool createOverlays();
+  void deleteOverlays();
+  void updateOverlays(int hoverRigId, int hoverJointId);
   bool intersectManip(MPxManipulatorNode* manip);
+  bool pickFace(const MPoint& rayOrigin, const MVector& rayDirection,
+    int& hitRig, int& hitFace, Deadline* deadline = nullptr);
+  bool pickFaceInView(M3dView& view, short x, short y, int& hitRig,
+    int& hitFace, Deadline* deadline = nullptr);
+  MString pickBufferInfo() const;
   double manipScale() const;
   void setManipScale(double scale);
   bool manipAutoAdjust() const;
   void setManipAutoAdjust(bool autoAdjust);
   float manipAdjustedScale() const;
-  int influenceIndexForJointDagPath(const MDagPath& dagPath);
-  int presentationStyleForJointDagPath(const MDagPath& dagPath) const;
+  int threadCount() const;
+  void setThreadCount(int threadCount);
+  bool faceCacheEnabled() const;
+  void setFaceCacheEnabled(bool enabled);
+  int pickMode() const;
+  void setPickMode(int pickMode);
+  int hoverThreshold() const;
+  void setHoverThreshold(int pixels);
+  double hoverRate() const;
+  void setHoverRate(double rate);
+  double hoverBudget() const;
+  void setHoverBudget(double budgetMs);
+  double paletteRate() const;
+  void setPaletteRate(double rate);
+  const MString& poseLibraryPath() const;
+  const PoseLibrary* poseLibrary() const;
+  MStatus setPoseLibrary(const MString& path);
+  MStatus applyPose(const MString& poseName,
+    const MString& blendPoseName = MString(), double weight = 0.0);
+  MStatus savePose(const MString& poseName);
   void updateText();
 
   virtual void toolOnSetup(MEvent& event) override;
@@ -84,31 +145,64 @@ public:
   MStatus doPress();
 
   static void keyframeCallback(bool* retCode, MPlug& plug, void* clientData);
+  static void parentChangedCallback(MDagPath& child, MDagPath& parent,
+    void* clientData);
+  static void nameChangedCallback(MObject& node, const MString& prevName,
+    void* clientData);
+  static void rigEditedCallback(void* clientData);
+  static void rigUpdateCallback(void* clientData);
 
 private:
   static const double MANIP_DEFAULT_SCALE;
   static const double MANIP_ADJUSTMENT;
+  static const size_t MAX_ROTATE_MANIPS;
+  static const int HOVER_DEFAULT_THRESHOLD;
+  static const double HOVER_DEFAULT_RATE;
+  static const double HOVER_DEFAULT_BUDGET;
+  static const double PALETTE_DEFAULT_RATE;
+
+  void stopRigUpdateCallback();
 
-  MDagPath _meshDagPath;
-  MObject _skinObject;
-  std::vector<int> _maxInfluences;
-  std::map<MDagPath, int> _dagIndexLookup;
-  std::map<MDagPath, int> _dagStyleLookup;
+  // The characters being posed, shared with any other session on the same
+  // meshes. They're kept after the tool exits so that coming back is cheap.
+  std::vector<std::shared_ptr<Rig>> _rigs;
 
-  MDagPath _selection;
+  int _selectionRig;
+  int _selection;
   int _selectionStyle;
   int _availableStyles;
 
   MannequinManipulator* _mannequinManip;
-  void* _rotateManip;
+  MObject _rotateManip;
+  // Hidden rotate manipulators of earlier selections by joint full path.
+  std::unordered_map<std::string, MObject> _rotateManips;
   MannequinMoveManipulator* _moveManip;
+  // One overlay per rig, in the same order.
+  std::vector<MannequinOverlay*> _overlays;
+  std::vector<MObjectHandle> _overlayTransforms;
+  // Batches joint edits for the palette while the tool is active.
+  JointWatcher _jointWatcher;
+  // Kept open so that applying poses from it doesn't map it again. It's
+  // null until the first pose is saved if the file doesn't exist yet.
+  MString _poseLibraryPath;
+  std::shared_ptr<PoseLibrary> _poseLibrary;
 
   mutable boost::optional<double> _scale;
   mutable boost::optional<bool> _autoAdjust;
-  double _longestJoint;
+  mutable boost::optional<int> _threadCount;
+  mutable boost::optional<bool> _faceCacheEnabled;
+  mutable boost::optional<int> _pickMode;
+  mutable boost::optional<int> _hoverThreshold;
+  mutable boost::optional<double> _hoverRate;
+  mutable boost::optional<double> _hoverBudget;
+  mutable boost::optional<double> _paletteRate;
   double _jointLengthRatio;
 
   MCallbackIdArray _callbacks;
+  // Rig edits are applied on the next idle, so that neither Maya's dirty
+  // propagation nor the overlay's draw does the work.
+  MCallbackId _rigUpdateCallbackId;
+  bool _hasRigUpdateCallback;
 };
 
 class MannequinContextCommand : public MPxContextCommand
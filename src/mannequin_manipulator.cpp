@@ -1,82 +1,74 @@
 #include "mannequin_manipulator.h"
 #include "mannequin.h"
+#include "stats.h"
 
 #include <iostream>
 
 #include <maya/MStatus.h>
 #include <maya/MFnTransform.h>
 #include <maya/MDagPathArray.h>
-#include <maya/MFnSingleIndexedComponent.h>
 #include <maya/MFloatPoint.h>
 #include <maya/MFnMesh.h>
 #include <maya/MFnSkinCluster.h>
 #include <maya/MGlobal.h>
 #include <maya/MFnManip3D.h>
-#include <maya/MSelectionList.h>
+#include <maya/MEventMessage.h>
 
 const MTypeId MannequinManipulator::id = MTypeId(0xcafecab);
 
-MannequinManipulator::MannequinManipulator() : _ctx(NULL) {}
+MannequinManipulator::MannequinManipulator()
+  : _ctx(NULL),
+    _highlightRig(-1),
+    _highlight(-1),
+    _idleCallback(0),
+    _hasIdleCallback(false) {}
 
-void MannequinManipulator::setup(MannequinContext* ctx,
-  MDagPath newHighlight) {
+MannequinManipulator::~MannequinManipulator() {
+  stopIdleCallback();
+}
+
+void MannequinManipulator::setup(MannequinContext* ctx, int newHighlightRig,
+  int newHighlight) {
   _ctx = ctx;
-  highlight(newHighlight, true);
+  configureHover();
+  highlight(newHighlightRig, newHighlight, true);
 }
 
-bool MannequinManipulator::highlight(MDagPath dagPath, bool force) {
-  if (!force && dagPath == _highlight) {
-    // Maintain the status quo if not forced!
-    return false;
+void MannequinManipulator::configureHover() {
+  if (_ctx) {
+    _scheduler.configure(_ctx->hoverThreshold(), _ctx->hoverRate(),
+      _ctx->hoverBudget());
   }
+}
 
-  do {
-    if (!_ctx) {
-      break;
-    }
-
-    MFnMesh mesh(_ctx->meshDagPath());
-    int numPolygons = mesh.numPolygons();
-    const std::vector<int>& maxInfluences = _ctx->maxInfluences();
-    if (maxInfluences.size() != numPolygons) {
-      break;
-    }
-
-    MFnSingleIndexedComponent comp;
-    MObject compObj = comp.create(MFn::kMeshPolygonComponent);
-
-    int highlightIndex = _ctx->influenceIndexForJointDagPath(dagPath);
-    int selectionIndex = _ctx->influenceIndexForJointDagPath(
-      _ctx->selectionDagPath());
-
-    for (int i = 0; i < numPolygons; ++i) {
-      if (maxInfluences[i] == highlightIndex ||
-          maxInfluences[i] == selectionIndex) {
-        comp.addElement(i);
-      }
-    }
+bool MannequinManipulator::highlight(int rigId, int jointId, bool force) {
+  if (jointId < 0) {
+    rigId = -1;
+  }
 
-    _highlight = dagPath;
+  if (!force && rigId == _highlightRig && jointId == _highlight) {
+    // Maintain the status quo if not forced!
+    return false;
+  }
 
-    MSelectionList selList;
-    selList.add(_ctx->meshDagPath(), compObj);
-    selList.add(_ctx->selectionDagPath());
-    MGlobal::setActiveSelectionList(selList);
+  Stats::ScopedTimer timer(Stats::kHighlight);
 
-    return true;
-  } while (false);
+  // The overlay only swaps the index buffers it draws; the active selection
+  // is left alone so that hovering doesn't fire selection callbacks.
+  _highlightRig = rigId;
+  _highlight = jointId;
+  if (_ctx) {
+    _ctx->updateOverlays(rigId, jointId);
+  }
 
-  // Error occurred in the loop.
-  _highlight = MDagPath();
-  MGlobal::clearSelectionList();
   return true;
 }
 
-MDagPath MannequinManipulator::highlightedDagPath() const {
-  if (!_highlight.hasFn(MFn::kTransform)) {
-    return MDagPath();
-  }
+int MannequinManipulator::highlightedRigId() const {
+  return _highlightRig;
+}
 
+int MannequinManipulator::highlightedJointId() const {
   return _highlight;
 }
 
@@ -85,76 +77,157 @@ void MannequinManipulator::postConstructor() {
 }
 
 MStatus MannequinManipulator::doMove(M3dView& view, bool& refresh) {
-  do {
-    if (!_ctx) {
-      break;
-    }
+  Stats::ScopedTimer timer(Stats::kMove);
+  refresh = false;
+  if (!_ctx) {
+    refresh = highlight();
+    return MS::kUnknownParameter;
+  }
+
+  HoverRequest request;
+  request.view = view;
+  mousePosition(request.x, request.y);
 
-    // If the mouse is near the border (e.g. within 4px), don't highlight.
-    // This works around some bugs where a section can remain highlighted!
-    int portWidth = view.portWidth();
-    int portHeight = view.portHeight();
-    short screenX, screenY;
-    mousePosition(screenX, screenY);
+  // If the mouse is near the border (e.g. within 4px), don't highlight.
+  // This works around some bugs where a section can remain highlighted!
+  if (request.x < 4 || request.y < 4 ||
+      request.x >= view.portWidth() - 4 || request.y >= view.portHeight() - 4) {
+    refresh = highlight();
+    return MS::kUnknownParameter;
+  }
 
-    if (screenX < 4 || screenY < 4 ||
-        screenX >= portWidth - 4 || screenY >= portHeight - 4) {
+  switch (_scheduler.submit(request.x, request.y)) {
+    case HoverScheduler::kSkip:
+      return MS::kSuccess;
+    case HoverScheduler::kDefer:
+      mouseRayWorld(request.rayOrigin, request.rayDirection);
+      deferHover(request);
+      return MS::kSuccess;
+    case HoverScheduler::kProcess:
       break;
-    }
+  }
 
-    // Begin the actual hit-testing routine.
-    MPoint linePoint;
-    MVector lineDirection;
-    mouseRayWorld(linePoint, lineDirection);
+  {
+    Stats::ScopedTimer rayTimer(Stats::kMoveRay);
+    mouseRayWorld(request.rayOrigin, request.rayDirection);
+  }
+
+  // Over budget, the last highlight stays up and the position is picked
+  // again without a budget once Maya goes idle.
+  Deadline deadline(_scheduler.budget());
+  MStatus status = hover(request, &deadline, refresh);
+  if (deadline.wasExceeded()) {
+    refresh = false;
+    deferHover(request);
+    return MS::kSuccess;
+  }
 
-    MFnMesh mesh(_ctx->meshDagPath());
-    MFnSkinCluster skin(_ctx->skinObject());
+  return status;
+}
 
-    MFloatPoint worldLinePoint;
-    worldLinePoint.setCast(linePoint);
+MStatus MannequinManipulator::hover(const HoverRequest& request,
+  Deadline* deadline,
+  bool& refresh) {
+  _scheduler.beginPick();
 
-    MFloatPoint hitPoint;
+  do {
+    // Begin the actual hit-testing routine.
+    int hitRig;
     int hitFace;
-    bool hit = mesh.closestIntersection(worldLinePoint, lineDirection,
-      NULL, NULL, false, MSpace::kWorld, 1000.0f, false, NULL, hitPoint, NULL,
-      &hitFace, NULL, NULL, NULL, 1e-3f);
+    bool hit;
+    {
+      Stats::ScopedTimer timer(Stats::kMoveIntersect);
+      if (_ctx->pickMode() == PickMode::BUFFER) {
+        M3dView view = request.view;
+        hit = _ctx->pickFaceInView(view, request.x, request.y, hitRig,
+          hitFace, deadline);
+      } else {
+        hit = _ctx->pickFace(request.rayOrigin, request.rayDirection,
+          hitRig, hitFace, deadline);
+      }
+    }
 
     if (!hit) {
       break;
     }
 
-    bool hitManip = _ctx->intersectManip(this);
+    bool hitManip;
+    {
+      Stats::ScopedTimer timer(Stats::kMoveManipTest);
+      hitManip = _ctx->intersectManip(this);
+    }
+
     if (hitManip) {
       // We're pointing at the rotation/translation manipulator.
       break;
     }
 
     // Figure out the joint we've landed on.
-    int numPolygons = mesh.numPolygons();
-    const std::vector<int>& maxInfluences = _ctx->maxInfluences();
-    if (maxInfluences.size() != numPolygons) {
+    const std::vector<int>& maxInfluences = _ctx->maxInfluences(hitRig);
+    if (hitFace < 0 || hitFace >= (int)maxInfluences.size()) {
       break;
     }
 
-    MDagPathArray influenceObjects;
-    skin.influenceObjects(influenceObjects);
-    unsigned int hitFaceInfluence = maxInfluences[hitFace];
-    MDagPath influenceDagPath = influenceObjects[hitFaceInfluence];
-
-    refresh = highlight(influenceDagPath);
+    Stats::ScopedTimer timer(Stats::kMoveHighlight);
+    refresh = highlight(hitRig, maxInfluences[hitFace]);
     return MS::kSuccess;
   } while (false);
 
   // Error occurred in the loop.
+  Stats::ScopedTimer timer(Stats::kMoveHighlight);
   refresh = highlight();
   return MS::kUnknownParameter;
 }
 
+void MannequinManipulator::deferHover(const HoverRequest& request) {
+  _pendingHover = request;
+  _scheduler.defer();
+
+  if (!_hasIdleCallback) {
+    MStatus err;
+    _idleCallback = MEventMessage::addEventCallback("idle",
+      MannequinManipulator::idleCallback, this, &err);
+    _hasIdleCallback = !err.error();
+  }
+}
+
+void MannequinManipulator::stopIdleCallback() {
+  if (_hasIdleCallback) {
+    MMessage::removeCallback(_idleCallback);
+    _hasIdleCallback = false;
+  }
+}
+
+void MannequinManipulator::idleCallback(void* clientData) {
+  MannequinManipulator* manip = static_cast<MannequinManipulator*>(
+    clientData);
+
+  // Idle fires continuously, so wait here until the next frame is due.
+  if (!manip->_scheduler.flushDue()) {
+    if (!manip->_scheduler.hasPending()) {
+      manip->stopIdleCallback();
+    }
+    return;
+  }
+
+  manip->stopIdleCallback();
+  if (!manip->_ctx) {
+    return;
+  }
+
+  bool refresh = false;
+  manip->hover(manip->_pendingHover, nullptr, refresh);
+  if (refresh) {
+    manip->_pendingHover.view.refresh();
+  }
+}
+
 void MannequinManipulator::draw(M3dView &view,
   const MDagPath &path,
   M3dView::DisplayStyle style,
   M3dView::DisplayStatus status) {
-  if (!_highlight.hasFn(MFn::kTransform)) {
+  Rig* rig = _ctx ? _ctx->rig(_highlightRig) : nullptr;
+  if (_highlight < 0 || !rig) {
     return;
   }
 
@@ -163,7 +236,7 @@ void MannequinManipulator::draw(M3dView &view,
   view.setDrawColor(green);
 
   MPoint centerPoint = drawCenter();
-  MString text = _highlight.partialPathName();
+  const MString& text = rig->jointName(_highlight);
   view.drawText(text, centerPoint, M3dView::kCenter);
 
   view.endGL();
@@ -173,7 +246,8 @@ void MannequinManipulator::preDrawUI(const M3dView &view) {}
 
 void MannequinManipulator::drawUI(MHWRender::MUIDrawManager &drawManager,
   const MHWRender::MFrameContext &frameContext) const {
-  if (!_highlight.hasFn(MFn::kTransform)) {
+  Rig* rig = _ctx ? _ctx->rig(_highlightRig) : nullptr;
+  if (_highlight < 0 || !rig) {
     return;
   }
 
@@ -182,21 +256,23 @@ void MannequinManipulator::drawUI(MHWRender::MUIDrawManager &drawManager,
   drawManager.setColor(green);
 
   MPoint centerPoint = drawCenter();
-  MString text = _highlight.partialPathName();
+  const MString& text = rig->jointName(_highlight);
   drawManager.text(centerPoint, text, MHWRender::MUIDrawManager::kCenter);
 
   drawManager.endDrawable();
 }
 
 MPoint MannequinManipulator::drawCenter() const {
-  MFnTransform selectionXform(_highlight);
+  Rig* rig = _ctx->rig(_highlightRig);
+  MDagPath highlightPath = rig ? rig->jointDagPath(_highlight) : MDagPath();
+  MFnTransform selectionXform(highlightPath);
   MPoint pivot = selectionXform.rotatePivot(MSpace::kWorld);
 
-  unsigned int children = _highlight.childCount();
+  unsigned int children = highlightPath.childCount();
   unsigned int numChildJoints = 0;
   MObject singleChildJoint;
   for (unsigned int i = 0; i < children; ++i) {
-    MObject child = _highlight.child(i);
+    MObject child = highlightPath.child(i);
     if (child.hasFn(MFn::kJoint)) {
       numChildJoints++;
       singleChildJoint = child;
@@ -3,15 +3,25 @@
 #include <maya/MPxManipulatorNode.h>
 #include <maya/MDagPath.h>
 #include <maya/MPoint.h>
+#include <maya/MVector.h>
+#include <maya/M3dView.h>
+#include <maya/MMessage.h>
+
+#include "hover_scheduler.h"
+#include "deadline.h"
 
 class MannequinContext;
 
 class MannequinManipulator : public MPxManipulatorNode {
 public:
   MannequinManipulator();
-  void setup(MannequinContext* ctx, MDagPath newHighlight = MDagPath());
-  bool highlight(MDagPath dagPath = MDagPath(), bool force = false);
-  MDagPath highlightedDagPath() const;
+  virtual ~MannequinManipulator();
+  void setup(MannequinContext* ctx, int newHighlightRig = -1,
+    int newHighlight = -1);
+  void configureHover();
+  bool highlight(int rigId = -1, int jointId = -1, bool force = false);
+  int highlightedRigId() const;
+  int highlightedJointId() const;
 
   virtual void postConstructor() override;
   virtual MStatus doMove(M3dView& view, bool& refresh) override;
@@ -29,6 +39,27 @@ public:
   static const MTypeId id;
 
 private:
+  // Everything needed to pick a mouse position after the event is gone.
+  struct HoverRequest {
+    M3dView view;
+    short x;
+    short y;
+    MPoint rayOrigin;
+    MVector rayDirection;
+  };
+
+  MStatus hover(const HoverRequest& request, Deadline* deadline,
+    bool& refresh);
+  void deferHover(const HoverRequest& request);
+  void stopIdleCallback();
+  static void idleCallback(void* clientData);
+
   MannequinContext* _ctx;
-  MDagPath _highlight;
+  int _highlightRig;
+  int _highlight;
+
+  HoverScheduler _scheduler;
+  HoverRequest _pendingHover;
+  MCallbackId _idleCallback;
+  bool _hasIdleCallback;
 };
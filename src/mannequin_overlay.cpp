@@ -0,0 +1,418 @@
+#include "mannequin_overlay.h"
+#include "mannequin.h"
+
+#include <maya/MFloatPointArray.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnMesh.h>
+#include <maya/MIntArray.h>
+#include <maya/MViewport2Renderer.h>
+
+const MTypeId MannequinOverlay::id = MTypeId(0xcafeb0b);
+const MString MannequinOverlay::drawDbClassification =
+  "drawdb/subscene/mannequinOverlay";
+const MString MannequinOverlay::drawRegistrantId = "MannequinOverlay";
+
+MannequinOverlay::MannequinOverlay()
+  : _ctx(nullptr),
+    _rigId(-1),
+    _hover(-1),
+    _selection(-1),
+    _highlightVersion(0) {}
+
+void MannequinOverlay::setup(MannequinContext* ctx, int rigId) {
+  _ctx = ctx;
+  _rigId = rigId;
+  _hover = -1;
+  _selection = -1;
+  ++_highlightVersion;
+}
+
+MannequinContext* MannequinOverlay::context() const {
+  return _ctx;
+}
+
+int MannequinOverlay::rigId() const {
+  return _rigId;
+}
+
+Rig* MannequinOverlay::rig() const {
+  return _ctx ? _ctx->rig(_rigId) : nullptr;
+}
+
+void MannequinOverlay::setHighlight(int hoverJointId, int selectionJointId) {
+  if (hoverJointId == _hover && selectionJointId == _selection) {
+    return;
+  }
+
+  _hover = hoverJointId;
+  _selection = selectionJointId;
+  ++_highlightVersion;
+}
+
+int MannequinOverlay::hoverJointId() const {
+  return _hover;
+}
+
+int MannequinOverlay::selectionJointId() const {
+  return _selection;
+}
+
+unsigned int MannequinOverlay::highlightVersion() const {
+  return _highlightVersion;
+}
+
+unsigned int MannequinOverlay::geometryVersion() const {
+  Rig* overlayRig = rig();
+  return overlayRig ? overlayRig->geometryVersion() : 0;
+}
+
+unsigned int MannequinOverlay::topologyVersion() const {
+  Rig* overlayRig = rig();
+  return overlayRig ? overlayRig->topologyVersion() : 0;
+}
+
+bool MannequinOverlay::isBounded() const {
+  // The regions follow the mesh wherever it goes, so never cull the locator.
+  return false;
+}
+
+void* MannequinOverlay::creator() {
+  return new MannequinOverlay;
+}
+
+MStatus MannequinOverlay::initialize() {
+  return MS::kSuccess;
+}
+
+MannequinOverlayOverride::MannequinOverlayOverride(const MObject& obj)
+  : MHWRender::MPxSubSceneOverride(obj),
+    _overlay(nullptr),
+    _hoverShader(nullptr),
+    _selectionShader(nullptr),
+    _hoverItem(nullptr),
+    _selectionItem(nullptr),
+    _hoverShown(-1),
+    _selectionShown(-1),
+    _highlightVersion(0),
+    _geometryVersion(0),
+    _topologyVersion(0),
+    _faceVersion(0) {
+  MFnDependencyNode node(obj);
+  _overlay = dynamic_cast<MannequinOverlay*>(node.userNode());
+}
+
+MannequinOverlayOverride::~MannequinOverlayOverride() {
+  MHWRender::MRenderer* renderer = MHWRender::MRenderer::theRenderer();
+  if (!renderer) {
+    return;
+  }
+
+  const MHWRender::MShaderManager* shaderManager =
+    renderer->getShaderManager();
+  if (shaderManager) {
+    if (_hoverShader) {
+      shaderManager->releaseShader(_hoverShader);
+    }
+    if (_selectionShader) {
+      shaderManager->releaseShader(_selectionShader);
+    }
+  }
+}
+
+MHWRender::MPxSubSceneOverride* MannequinOverlayOverride::creator(
+  const MObject& obj) {
+  return new MannequinOverlayOverride(obj);
+}
+
+MHWRender::DrawAPI MannequinOverlayOverride::supportedDrawAPIs() const {
+  return MHWRender::kAllDevices;
+}
+
+bool MannequinOverlayOverride::requiresUpdate(
+  const MHWRender::MSubSceneContainer& container,
+  const MHWRender::MFrameContext& frameContext) const {
+  if (!_overlay) {
+    return false;
+  }
+
+  if (!_hoverItem ||
+      _overlay->highlightVersion() != _highlightVersion ||
+      _overlay->geometryVersion() != _geometryVersion ||
+      _overlay->topologyVersion() != _topologyVersion) {
+    return true;
+  }
+
+  // Weight edits move faces between joints without touching the overlay.
+  // The context applies them; this only sees the version move afterwards.
+  Rig* rig = _overlay->rig();
+  return rig && rig->faceInfluencesVersion() != _faceVersion;
+}
+
+void MannequinOverlayOverride::update(
+  MHWRender::MSubSceneContainer& container,
+  const MHWRender::MFrameContext& frameContext) {
+  if (!_overlay) {
+    return;
+  }
+
+  if (!_hoverItem) {
+    createItems(container);
+  }
+
+  Rig* rig = _overlay->rig();
+  bool rebind = false;
+
+  do {
+    if (!rig) {
+      break;
+    }
+
+    bool reread = !_positions ||
+      _overlay->topologyVersion() != _topologyVersion;
+    if (!reread && _overlay->geometryVersion() != _geometryVersion) {
+      // The bounds passed with the geometry moved along with the points.
+      rebind = true;
+      reread = readPositions(rig->meshDagPath()).error();
+    }
+
+    if (reread) {
+      _indexBuffers.clear();
+      _positions.reset();
+      _vertexBuffers.clear();
+      rebind = true;
+
+      MStatus err = readTriangles(rig->meshDagPath());
+      if (err.error()) {
+        break;
+      }
+      err = readPositions(rig->meshDagPath());
+      if (err.error()) {
+        break;
+      }
+    }
+
+    unsigned int faceVersion = rig->faceInfluencesVersion();
+    if (faceVersion != _faceVersion) {
+      _indexBuffers.clear();
+      _faceVersion = faceVersion;
+      rebind = true;
+    }
+  } while (false);
+
+  _highlightVersion = _overlay->highlightVersion();
+  _geometryVersion = _overlay->geometryVersion();
+  _topologyVersion = _overlay->topologyVersion();
+
+  if (!rig || !_positions) {
+    _hoverItem->enable(false);
+    _selectionItem->enable(false);
+    _hoverShown = -1;
+    _selectionShown = -1;
+    return;
+  }
+
+  // The selected region wins where the two overlap.
+  int selection = _overlay->selectionJointId();
+  int hover = _overlay->hoverJointId();
+  if (hover == selection) {
+    hover = -1;
+  }
+
+  showJoint(rig, _hoverItem, _hoverShown, hover, rebind);
+  showJoint(rig, _selectionItem, _selectionShown, selection, rebind);
+}
+
+void MannequinOverlayOverride::createItems(
+  MHWRender::MSubSceneContainer& container) {
+  MHWRender::MRenderer* renderer = MHWRender::MRenderer::theRenderer();
+  const MHWRender::MShaderManager* shaderManager =
+    renderer ? renderer->getShaderManager() : nullptr;
+
+  if (shaderManager) {
+    const float hoverColor[] = { 0.3f, 0.8f, 0.1f, 0.35f };
+    _hoverShader = shaderManager->getStockShader(
+      MHWRender::MShaderManager::k3dSolidShader);
+    if (_hoverShader) {
+      _hoverShader->setParameter("solidColor", hoverColor);
+      _hoverShader->setIsTransparent(true);
+    }
+
+    const float selectionColor[] = { 1.0f, 0.6f, 0.1f, 0.45f };
+    _selectionShader = shaderManager->getStockShader(
+      MHWRender::MShaderManager::k3dSolidShader);
+    if (_selectionShader) {
+      _selectionShader->setParameter("solidColor", selectionColor);
+      _selectionShader->setIsTransparent(true);
+    }
+  }
+
+  MHWRender::MRenderItem* items[] = {
+    _hoverItem = MHWRender::MRenderItem::Create("mannequinHover",
+      MHWRender::MRenderItem::NonMaterialSceneItem,
+      MHWRender::MGeometry::kTriangles),
+    _selectionItem = MHWRender::MRenderItem::Create("mannequinSelection",
+      MHWRender::MRenderItem::NonMaterialSceneItem,
+      MHWRender::MGeometry::kTriangles)
+  };
+  MHWRender::MShaderInstance* shaders[] = { _hoverShader, _selectionShader };
+
+  for (int i = 0; i < 2; ++i) {
+    // Drawn at wireframe priority so that the regions win the depth test
+    // against the shaded mesh they sit on.
+    items[i]->setDrawMode(MHWRender::MGeometry::kAll);
+    items[i]->depthPriority(MHWRender::MRenderItem::sActiveWireDepthPriority);
+    items[i]->castsShadows(false);
+    items[i]->receivesShadows(false);
+    if (shaders[i]) {
+      items[i]->setShader(shaders[i]);
+    }
+    items[i]->enable(false);
+    container.add(items[i]);
+  }
+}
+
+MStatus MannequinOverlayOverride::readTriangles(const MDagPath& meshDagPath) {
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MIntArray triangleCounts;
+  MIntArray triangleVertices;
+  err = mesh.getTriangles(triangleCounts, triangleVertices);
+  if (err.error()) {
+    return err;
+  }
+
+  unsigned int numFaces = triangleCounts.length();
+  _faceTriangleOffsets.resize(numFaces + 1);
+  _faceTriangleOffsets[0] = 0;
+  for (unsigned int face = 0; face < numFaces; ++face) {
+    _faceTriangleOffsets[face + 1] =
+      _faceTriangleOffsets[face] + triangleCounts[face];
+  }
+
+  _triangleVertices.resize(triangleVertices.length());
+  for (unsigned int i = 0; i < triangleVertices.length(); ++i) {
+    _triangleVertices[i] = triangleVertices[i];
+  }
+
+  return MS::kSuccess;
+}
+
+MStatus MannequinOverlayOverride::readPositions(const MDagPath& meshDagPath) {
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MFloatPointArray points;
+  err = mesh.getPoints(points, MSpace::kWorld);
+  if (err.error()) {
+    return err;
+  }
+
+  // Resizing the buffer would orphan the index buffers' vertex references,
+  // so a changed count is treated like a topology change.
+  unsigned int numPoints = points.length();
+  if (_positions && _positions->vertexCount() != numPoints) {
+    return MS::kFailure;
+  }
+
+  if (!_positions) {
+    MHWRender::MVertexBufferDescriptor descriptor("",
+      MHWRender::MGeometry::kPosition, MHWRender::MGeometry::kFloat, 3);
+    _positions.reset(new MHWRender::MVertexBuffer(descriptor));
+    _vertexBuffers.clear();
+    _vertexBuffers.addBuffer("positions", _positions.get());
+  }
+
+  float* data = static_cast<float*>(_positions->acquire(numPoints, true));
+  if (!data) {
+    _positions.reset();
+    _vertexBuffers.clear();
+    return MS::kFailure;
+  }
+
+  _bounds.clear();
+  for (unsigned int i = 0; i < numPoints; ++i) {
+    data[i * 3] = points[i].x;
+    data[i * 3 + 1] = points[i].y;
+    data[i * 3 + 2] = points[i].z;
+    _bounds.expand(MPoint(points[i]));
+  }
+  _positions->commit(data);
+
+  return MS::kSuccess;
+}
+
+const MHWRender::MIndexBuffer* MannequinOverlayOverride::indexBuffer(
+  Rig* rig, int jointId) {
+  if (jointId < 0) {
+    return nullptr;
+  }
+
+  if (jointId >= (int)_indexBuffers.size()) {
+    _indexBuffers.resize(jointId + 1);
+  }
+
+  if (_indexBuffers[jointId]) {
+    return _indexBuffers[jointId].get();
+  }
+
+  const std::vector<int>& faces = rig->facesForJoint(jointId);
+  unsigned int numFaces = (unsigned int)_faceTriangleOffsets.size() - 1;
+  unsigned int numIndices = 0;
+  for (int face : faces) {
+    if (face >= 0 && face < (int)numFaces) {
+      numIndices += 3 *
+        (_faceTriangleOffsets[face + 1] - _faceTriangleOffsets[face]);
+    }
+  }
+
+  if (numIndices == 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<MHWRender::MIndexBuffer> buffer(
+    new MHWRender::MIndexBuffer(MHWRender::MGeometry::kUnsignedInt32));
+  unsigned int* data = static_cast<unsigned int*>(
+    buffer->acquire(numIndices, true));
+  if (!data) {
+    return nullptr;
+  }
+
+  unsigned int next = 0;
+  for (int face : faces) {
+    if (face >= 0 && face < (int)numFaces) {
+      for (unsigned int i = _faceTriangleOffsets[face] * 3;
+          i < _faceTriangleOffsets[face + 1] * 3; ++i) {
+        data[next++] = _triangleVertices[i];
+      }
+    }
+  }
+  buffer->commit(data);
+
+  _indexBuffers[jointId] = std::move(buffer);
+  return _indexBuffers[jointId].get();
+}
+
+void MannequinOverlayOverride::showJoint(Rig* rig,
+  MHWRender::MRenderItem* item, int& shownJointId, int jointId, bool rebind) {
+  if (jointId == shownJointId && !rebind) {
+    return;
+  }
+
+  shownJointId = jointId;
+
+  const MHWRender::MIndexBuffer* buffer = indexBuffer(rig, jointId);
+  if (!buffer) {
+    item->enable(false);
+    return;
+  }
+
+  setGeometryForRenderItem(*item, _vertexBuffers, *buffer, &_bounds);
+  item->enable(true);
+}
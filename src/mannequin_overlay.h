@@ -0,0 +1,100 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <maya/MPxLocatorNode.h>
+#include <maya/MPxSubSceneOverride.h>
+#include <maya/MBoundingBox.h>
+#include <maya/MDagPath.h>
+#include <maya/MHWGeometry.h>
+#include <maya/MShaderManager.h>
+#include <maya/MTypeId.h>
+
+class MannequinContext;
+class Rig;
+
+// Helper locator that exists while the tool is active and draws the regions
+// of the hovered and selected joints over one rig's mesh in Viewport 2.0. It
+// holds no attributes; the context pushes the joint IDs into it, and the
+// sub-scene override below pulls them and the rig's versions on the next
+// refresh. Rig edits are applied by the context, never during a draw.
+class MannequinOverlay : public MPxLocatorNode {
+public:
+  MannequinOverlay();
+  void setup(MannequinContext* ctx, int rigId);
+  MannequinContext* context() const;
+  int rigId() const;
+  Rig* rig() const;
+
+  void setHighlight(int hoverJointId, int selectionJointId);
+  int hoverJointId() const;
+  int selectionJointId() const;
+
+  unsigned int highlightVersion() const;
+  unsigned int geometryVersion() const;
+  unsigned int topologyVersion() const;
+
+  virtual bool isBounded() const override;
+
+  static void* creator();
+  static MStatus initialize();
+  static const MTypeId id;
+  static const MString drawDbClassification;
+  static const MString drawRegistrantId;
+
+private:
+  MannequinContext* _ctx;
+  int _rigId;
+  int _hover;
+  int _selection;
+  unsigned int _highlightVersion;
+};
+
+// Keeps the deformed mesh points in one vertex buffer and builds an index
+// buffer per joint the first time that joint is shown. Hovering another
+// joint only rebinds the render item to that joint's cached index buffer;
+// the buffers are rebuilt when faces change owners or the topology changes.
+class MannequinOverlayOverride : public MHWRender::MPxSubSceneOverride {
+public:
+  static MHWRender::MPxSubSceneOverride* creator(const MObject& obj);
+  virtual ~MannequinOverlayOverride();
+
+  virtual MHWRender::DrawAPI supportedDrawAPIs() const override;
+  virtual bool requiresUpdate(const MHWRender::MSubSceneContainer& container,
+    const MHWRender::MFrameContext& frameContext) const override;
+  virtual void update(MHWRender::MSubSceneContainer& container,
+    const MHWRender::MFrameContext& frameContext) override;
+
+private:
+  MannequinOverlayOverride(const MObject& obj);
+  void createItems(MHWRender::MSubSceneContainer& container);
+  MStatus readTriangles(const MDagPath& meshDagPath);
+  MStatus readPositions(const MDagPath& meshDagPath);
+  const MHWRender::MIndexBuffer* indexBuffer(Rig* rig, int jointId);
+  void showJoint(Rig* rig, MHWRender::MRenderItem* item,
+    int& shownJointId, int jointId, bool rebind);
+
+  MannequinOverlay* _overlay;
+  MHWRender::MShaderInstance* _hoverShader;
+  MHWRender::MShaderInstance* _selectionShader;
+  MHWRender::MRenderItem* _hoverItem;
+  MHWRender::MRenderItem* _selectionItem;
+  int _hoverShown;
+  int _selectionShown;
+
+  unsigned int _highlightVersion;
+  unsigned int _geometryVersion;
+  unsigned int _topologyVersion;
+  unsigned int _faceVersion;
+
+  std::unique_ptr<MHWRender::MVertexBuffer> _positions;
+  MHWRender::MVertexBufferArray _vertexBuffers;
+  MBoundingBox _bounds;
+
+  // Triangles of each face in CSR form, from the mesh's own triangulation.
+  std::vector<unsigned int> _faceTriangleOffsets;
+  std::vector<unsigned int> _triangleVertices;
+
+  std::vector<std::unique_ptr<MHWRender::MIndexBuffer>> _indexBuffers;
+};
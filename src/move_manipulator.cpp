@@ -1,5 +1,6 @@
 #include "move_manipulator.h"
 #include "util.h"
+#include "stats.h"
 
 #include <limits>
 
@@ -9,54 +10,71 @@
 #include <maya/MGLFunctionTable.h>
 #include <maya/MHardwareRenderer.h>
 #include <maya/MAngle.h>
+#include <maya/MDistance.h>
+#include <maya/MGlobal.h>
 #include <maya/MQuaternion.h>
 
 const MTypeId MannequinMoveManipulator::id = MTypeId(0xcafebee);
 
-MannequinMoveManipulator::MannequinMoveManipulator() {}
+MannequinMoveManipulator::MannequinMoveManipulator()
+  : _manipScale(1.0f),
+    _opValid(false) {}
 
 void MannequinMoveManipulator::postConstructor() {
-  addPointValue("translate", MPoint(0, 0, 0), _translateIndex);
   glFirstHandle(_glPickableItem);
 }
 
-MStatus
-MannequinMoveManipulator::connectToDependNode(const MObject &dependNode) {
-  MStatus status;
-  MFnDependencyNode nodeFn(dependNode, &status);
+void MannequinMoveManipulator::setTarget(const MDagPath& dagPath) {
+  _target = MDagPath();
+  _translatePlug = MPlug();
+  _opValid = false;
 
-  if (!status)
-     return MS::kFailure;
+  MStatus status;
+  MFnDependencyNode nodeFn(dagPath.isValid() ? dagPath.node() :
+    MObject::kNullObj, &status);
+  if (!status) {
+    return;
+  }
 
   MPlug translatePlug = nodeFn.findPlug("translate", &status);
+  if (!status) {
+    return;
+  }
 
-  if (!status)
-     return MS::kFailure;
-
-  int plugIndex = 0;
-  status = connectPlugToValue(translatePlug, _translateIndex, plugIndex);
-
-  if (!status)
-     return MS::kFailure;
-
-  MFnDagNode dagNodeFn(dependNode);
-  MDagPath nodePath;
-  dagNodeFn.getPath(nodePath);
+  _target = dagPath;
+  _translatePlug = translatePlug;
 
-  MTransformationMatrix m(nodePath.exclusiveMatrix());
+  MTransformationMatrix m(dagPath.exclusiveMatrix());
   _parentXform = m;
 
-  MTransformationMatrix n(nodePath.inclusiveMatrix());
+  MTransformationMatrix n(dagPath.inclusiveMatrix());
   _childXform = n;
+}
 
-  finishAddingManips();
-  return MPxManipulatorNode::connectToDependNode(dependNode);
+bool MannequinMoveManipulator::hasTarget() const {
+  return !_translatePlug.isNull();
+}
+
+MPoint MannequinMoveManipulator::translate() const {
+  return MPoint(_translatePlug.child(0).asDouble(),
+    _translatePlug.child(1).asDouble(),
+    _translatePlug.child(2).asDouble());
+}
+
+void MannequinMoveManipulator::setTranslate(const MPoint& translate) {
+  _translatePlug.child(0).setDouble(translate.x);
+  _translatePlug.child(1).setDouble(translate.y);
+  _translatePlug.child(2).setDouble(translate.z);
 }
 
 void MannequinMoveManipulator::draw(M3dView &view,
   const MDagPath &path,
   M3dView::DisplayStyle style,
   M3dView::DisplayStatus status) {
+  if (!hasTarget()) {
+    return;
+  }
+
   static MGLFunctionTable *gGLFT = 0;
   if (0 == gGLFT) {
     gGLFT = MHardwareRenderer::theRenderer()->glFunctionTable();
@@ -135,6 +153,10 @@ void MannequinMoveManipulator::glDrawCone(GLUquadricObj* quadric,
 }
 
 void MannequinMoveManipulator::preDrawUI(const M3dView &view) {
+  if (!hasTarget()) {
+    return;
+  }
+
   recalcMetrics();
 
   _xColor = xColor();
@@ -149,6 +171,11 @@ void MannequinMoveManipulator::preDrawUI(const M3dView &view) {
 
 void MannequinMoveManipulator::drawUI(MHWRender::MUIDrawManager &drawManager,
   const MHWRender::MFrameContext &frameContext) const {
+  // Nothing drawn means nothing to pick while there's no target.
+  if (!hasTarget()) {
+    return;
+  }
+
   float size = _manipScale * MFnManip3D::globalSize();
   float handleSize = MFnManip3D::handleSize() / 100.0f; // Probably on [0, 100].
   float handleHeight = size * handleSize * 0.5f;
@@ -208,7 +235,12 @@ bool MannequinMoveManipulator::shouldDrawHandleAsSelected(int axis) {
 }
 
 MStatus MannequinMoveManipulator::doPress(M3dView& view) {
-  getPointValue(_translateIndex, false, _opValueBegin);
+  if (!hasTarget()) {
+    _opValid = false;
+    return MS::kUnknownParameter;
+  }
+
+  _opValueBegin = translate();
 
   GLuint activeAxis;
   glActiveName(activeAxis);
@@ -275,6 +307,7 @@ MStatus MannequinMoveManipulator::doPress(M3dView& view) {
 }
 
 MStatus MannequinMoveManipulator::doDrag(M3dView& view) {
+  Stats::ScopedTimer timer(Stats::kMoveManipDrag);
   if (!_opValid) {
     return MS::kUnknownParameter;
   }
@@ -314,12 +347,32 @@ MStatus MannequinMoveManipulator::doDrag(M3dView& view) {
     newTranslate = _opValueBegin;
   }
 
-  setPointValue(_translateIndex, newTranslate);
+  setTranslate(newTranslate);
   return MS::kSuccess;
 }
 
 MStatus MannequinMoveManipulator::doRelease(M3dView& view) {
-  return MS::kSuccess;
+  if (!_opValid || !hasTarget()) {
+    return MS::kSuccess;
+  }
+
+  _opValid = false;
+  MPoint endValue = translate();
+  if (endValue.isEquivalent(_opValueBegin)) {
+    return MS::kSuccess;
+  }
+
+  // The drag itself isn't on the undo queue, so put the joint back and
+  // redo the whole drag as one edit, which also handles auto key.
+  setTranslate(_opValueBegin);
+
+  MString command = "mannequinPose -e -translate";
+  for (int i = 0; i < 3; ++i) {
+    command += " -values ";
+    command += MDistance::internalToUI(endValue[i]);
+  }
+  command += " \"" + _target.fullPathName() + "\"";
+  return MGlobal::executeCommand(command, false, true);
 }
 
 void MannequinMoveManipulator::setManipScale(float scale) {
@@ -331,8 +384,7 @@ float MannequinMoveManipulator::manipScale() const {
 }
 
 void MannequinMoveManipulator::recalcMetrics() {
-  MPoint translate;
-  getPointValue(_translateIndex, false, translate);
+  MPoint translate = this->translate();
 
   MMatrix childMatrix = _childXform.asMatrix();
   _x = (MVector::xAxis * childMatrix).normal();
@@ -342,6 +394,10 @@ void MannequinMoveManipulator::recalcMetrics() {
 }
 
 bool MannequinMoveManipulator::intersectManip(MPxManipulatorNode* manip) const {
+  if (!hasTarget()) {
+    return false;
+  }
+
   M3dView view = M3dView::active3dView();
 
   float size = _manipScale * MFnManip3D::globalSize();
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <maya/MPxManipulatorNode.h>
+#include <maya/MDagPath.h>
+#include <maya/MPlug.h>
 #include <maya/MPoint.h>
 #include <maya/MVector.h>
 
@@ -12,10 +14,17 @@
 #include <GL/glu.h>
 #endif
 
+// Translates one transform along its local axes. The manipulator isn't
+// connected to the transform's plugs, so it can be pointed at another joint
+// without being rebuilt: drags write the plug directly and release commits
+// the whole drag as one undoable mannequinPose edit.
 class MannequinMoveManipulator : public MPxManipulatorNode {
 public:
   MannequinMoveManipulator();
 
+  // Points the manipulator at a transform, or at nothing to hide it.
+  void setTarget(const MDagPath& dagPath);
+  bool hasTarget() const;
   void setManipScale(float scale);
   float manipScale() const;
 
@@ -35,7 +44,6 @@ public:
   virtual void preDrawUI(const M3dView &view) override;
   virtual void drawUI(MHWRender::MUIDrawManager &drawManager,
     const MHWRender::MFrameContext &frameContext) const override;
-  virtual MStatus connectToDependNode(const MObject &dependNode) override;
   virtual MStatus doPress(M3dView& view) override;
   virtual MStatus doDrag(M3dView& view) override;
   virtual MStatus doRelease(M3dView& view) override;
@@ -51,7 +59,10 @@ public:
   bool shouldDrawHandleAsSelected(int axis);
 
 private:
-  int _translateIndex;
+  MPoint translate() const;
+  void setTranslate(const MPoint& translate);
+
+  MDagPath _target;
   MPlug _translatePlug;
 
   MTransformationMatrix _parentXform;
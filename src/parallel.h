@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+  // Number of worker threads to use for a requested count; zero or less means
+  // one thread per hardware core.
+  inline unsigned int resolveThreadCount(int requested) {
+    if (requested > 0) {
+      return (unsigned int)requested;
+    }
+
+    unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+  }
+
+  // Splits [0, count) into chunks of at most grainSize items and hands them
+  // out to numThreads workers as they finish their previous chunk, calling
+  // fn(threadIndex, begin, end) for each. The calling thread is worker 0.
+  template<typename Fn>
+  void forRange(unsigned int count,
+                unsigned int grainSize,
+                unsigned int numThreads,
+                Fn fn) {
+    if (count == 0) {
+      return;
+    }
+
+    grainSize = std::max(grainSize, 1u);
+    unsigned int numChunks = (count + grainSize - 1) / grainSize;
+    numThreads = std::max(1u, std::min(numThreads, numChunks));
+
+    std::atomic<unsigned int> nextChunk(0);
+    auto worker = [&](unsigned int threadIndex) {
+      for (;;) {
+        unsigned int chunk = nextChunk++;
+        if (chunk >= numChunks) {
+          break;
+        }
+
+        unsigned int begin = chunk * grainSize;
+        unsigned int end = std::min(begin + grainSize, count);
+        fn(threadIndex, begin, end);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (unsigned int i = 1; i < numThreads; ++i) {
+      threads.emplace_back(worker, i);
+    }
+
+    worker(0);
+
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+}
@@ -0,0 +1,504 @@
+#include "pick_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <maya/MFloatPointArray.h>
+#include <maya/MFnMesh.h>
+#include <maya/MIntArray.h>
+
+namespace {
+  const unsigned int NUM_BINS = 12;
+  const unsigned int MAX_LEAF_SIZE = 4;
+  const unsigned int MAX_DEPTH = 64;
+
+  // Nodes visited between deadline checks, which read the clock.
+  const unsigned int DEADLINE_INTERVAL = 64;
+
+  // Relative cost of one ray-box test against one ray-triangle test.
+  const float TRAVERSAL_COST = 1.0f;
+  const float INTERSECT_COST = 1.0f;
+}
+
+void PickBvh::Bounds::reset() {
+  for (int axis = 0; axis < 3; ++axis) {
+    min[axis] = std::numeric_limits<float>::max();
+    max[axis] = -std::numeric_limits<float>::max();
+  }
+}
+
+void PickBvh::Bounds::grow(const float* point) {
+  for (int axis = 0; axis < 3; ++axis) {
+    min[axis] = std::min(min[axis], point[axis]);
+    max[axis] = std::max(max[axis], point[axis]);
+  }
+}
+
+void PickBvh::Bounds::grow(const Bounds& other) {
+  for (int axis = 0; axis < 3; ++axis) {
+    min[axis] = std::min(min[axis], other.min[axis]);
+    max[axis] = std::max(max[axis], other.max[axis]);
+  }
+}
+
+float PickBvh::Bounds::halfArea() const {
+  float dx = max[0] - min[0];
+  float dy = max[1] - min[1];
+  float dz = max[2] - min[2];
+  if (dx < 0.0f || dy < 0.0f || dz < 0.0f) {
+    return 0.0f;
+  }
+
+  return dx * dy + dy * dz + dz * dx;
+}
+
+PickBvh::PickBvh() {}
+
+MStatus PickBvh::build(const MDagPath& meshDagPath) {
+  clear();
+
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MIntArray triangleCounts;
+  MIntArray triangleVertices;
+  err = mesh.getTriangles(triangleCounts, triangleVertices);
+  if (err.error()) {
+    return err;
+  }
+
+  _triangleVertices.resize(triangleVertices.length());
+  for (unsigned int i = 0; i < triangleVertices.length(); ++i) {
+    _triangleVertices[i] = triangleVertices[i];
+  }
+
+  _triangleFaces.reserve(_triangleVertices.size() / 3);
+  for (unsigned int face = 0; face < triangleCounts.length(); ++face) {
+    _triangleFaces.insert(_triangleFaces.end(), triangleCounts[face], face);
+  }
+
+  err = readPoints(meshDagPath);
+  if (err.error()) {
+    clear();
+    return err;
+  }
+
+  buildNodes();
+  return MS::kSuccess;
+}
+
+MStatus PickBvh::refit(const MDagPath& meshDagPath) {
+  if (_nodes.empty()) {
+    return MS::kFailure;
+  }
+
+  unsigned int numPoints = (unsigned int)_points.size();
+  MStatus err = readPoints(meshDagPath);
+  if (err.error()) {
+    return err;
+  }
+
+  // A different vertex count means the topology changed under us.
+  if (_points.size() != numPoints) {
+    return MS::kFailure;
+  }
+
+  refitNodes();
+  return MS::kSuccess;
+}
+
+void PickBvh::clear() {
+  _points.clear();
+  _triangleVertices.clear();
+  _triangleFaces.clear();
+  _nodes.clear();
+}
+
+bool PickBvh::isEmpty() const {
+  return _nodes.empty();
+}
+
+unsigned int PickBvh::numTriangles() const {
+  return (unsigned int)_triangleFaces.size();
+}
+
+unsigned int PickBvh::numNodes() const {
+  return (unsigned int)_nodes.size();
+}
+
+void PickBvh::bounds(MPoint& min, MPoint& max) const {
+  if (_nodes.empty()) {
+    min = max = MPoint();
+    return;
+  }
+
+  const Bounds& root = _nodes[0].bounds;
+  min = MPoint(root.min[0], root.min[1], root.min[2]);
+  max = MPoint(root.max[0], root.max[1], root.max[2]);
+}
+
+const std::vector<float>& PickBvh::points() const {
+  return _points;
+}
+
+const std::vector<unsigned int>& PickBvh::triangleVertices() const {
+  return _triangleVertices;
+}
+
+const std::vector<int>& PickBvh::triangleFaces() const {
+  return _triangleFaces;
+}
+
+MStatus PickBvh::readPoints(const MDagPath& meshDagPath) {
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MFloatPointArray points;
+  err = mesh.getPoints(points, MSpace::kWorld);
+  if (err.error()) {
+    return err;
+  }
+
+  _points.resize(points.length() * 3);
+  for (unsigned int i = 0; i < points.length(); ++i) {
+    _points[i * 3] = points[i].x;
+    _points[i * 3 + 1] = points[i].y;
+    _points[i * 3 + 2] = points[i].z;
+  }
+
+  return MS::kSuccess;
+}
+
+void PickBvh::triangleBounds(unsigned int triangle, Bounds& bounds) const {
+  bounds.reset();
+  for (unsigned int i = 0; i < 3; ++i) {
+    bounds.grow(&_points[_triangleVertices[triangle * 3 + i] * 3]);
+  }
+}
+
+void PickBvh::buildNodes() {
+  unsigned int numTriangles = (unsigned int)_triangleFaces.size();
+  if (numTriangles == 0) {
+    return;
+  }
+
+  std::vector<Bounds> bounds(numTriangles);
+  std::vector<float> centroids(numTriangles * 3);
+  for (unsigned int i = 0; i < numTriangles; ++i) {
+    triangleBounds(i, bounds[i]);
+    for (int axis = 0; axis < 3; ++axis) {
+      centroids[i * 3 + axis] =
+        0.5f * (bounds[i].min[axis] + bounds[i].max[axis]);
+    }
+  }
+
+  std::vector<unsigned int> order(numTriangles);
+  for (unsigned int i = 0; i < numTriangles; ++i) {
+    order[i] = i;
+  }
+
+  // Nodes are emitted depth-first by always building the left subtree next;
+  // right subtrees wait on the stack and patch their parent when built.
+  struct Task {
+    unsigned int begin;
+    unsigned int end;
+    unsigned int depth;
+    int parent;
+  };
+
+  std::vector<Task> stack;
+  stack.push_back(Task { 0, numTriangles, 0, -1 });
+  _nodes.reserve(2 * numTriangles / MAX_LEAF_SIZE + 1);
+
+  while (!stack.empty()) {
+    Task task = stack.back();
+    stack.pop_back();
+
+    unsigned int nodeIndex = (unsigned int)_nodes.size();
+    if (task.parent >= 0) {
+      _nodes[task.parent].start = nodeIndex;
+    }
+
+    Node node;
+    node.bounds.reset();
+    Bounds centroidBounds;
+    centroidBounds.reset();
+    for (unsigned int i = task.begin; i < task.end; ++i) {
+      node.bounds.grow(bounds[order[i]]);
+      centroidBounds.grow(&centroids[order[i] * 3]);
+    }
+
+    unsigned int count = task.end - task.begin;
+    node.start = task.begin;
+    node.count = count;
+    _nodes.push_back(node);
+
+    if (count <= MAX_LEAF_SIZE || task.depth >= MAX_DEPTH) {
+      continue;
+    }
+
+    // Binned SAH: bucket the centroids along each axis and evaluate the
+    // split planes between buckets.
+    int bestAxis = -1;
+    unsigned int bestBin = 0;
+    float bestCost = INTERSECT_COST * count;
+
+    for (int axis = 0; axis < 3; ++axis) {
+      float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+      if (extent <= 0.0f) {
+        continue;
+      }
+
+      Bounds binBounds[NUM_BINS];
+      unsigned int binCounts[NUM_BINS] = {};
+      for (unsigned int bin = 0; bin < NUM_BINS; ++bin) {
+        binBounds[bin].reset();
+      }
+
+      float scale = NUM_BINS / extent;
+      for (unsigned int i = task.begin; i < task.end; ++i) {
+        float offset = centroids[order[i] * 3 + axis] -
+          centroidBounds.min[axis];
+        unsigned int bin = std::min(NUM_BINS - 1,
+          (unsigned int)(offset * scale));
+        binBounds[bin].grow(bounds[order[i]]);
+        ++binCounts[bin];
+      }
+
+      // Sweep from the right to get the cost of everything past each plane.
+      float rightAreas[NUM_BINS];
+      unsigned int rightCounts[NUM_BINS];
+      Bounds right;
+      right.reset();
+      unsigned int rightCount = 0;
+      for (unsigned int bin = NUM_BINS - 1; bin > 0; --bin) {
+        right.grow(binBounds[bin]);
+        rightCount += binCounts[bin];
+        rightAreas[bin] = right.halfArea();
+        rightCounts[bin] = rightCount;
+      }
+
+      Bounds left;
+      left.reset();
+      unsigned int leftCount = 0;
+      float nodeArea = node.bounds.halfArea();
+      for (unsigned int bin = 0; bin < NUM_BINS - 1; ++bin) {
+        left.grow(binBounds[bin]);
+        leftCount += binCounts[bin];
+        if (leftCount == 0 || rightCounts[bin + 1] == 0) {
+          continue;
+        }
+
+        float cost = TRAVERSAL_COST + INTERSECT_COST *
+          (left.halfArea() * leftCount +
+           rightAreas[bin + 1] * rightCounts[bin + 1]) / nodeArea;
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestBin = bin;
+        }
+      }
+    }
+
+    unsigned int mid;
+    if (bestAxis >= 0) {
+      float extent = centroidBounds.max[bestAxis] -
+        centroidBounds.min[bestAxis];
+      float scale = NUM_BINS / extent;
+      float minCentroid = centroidBounds.min[bestAxis];
+      mid = (unsigned int)(std::partition(order.begin() + task.begin,
+        order.begin() + task.end,
+        [&](unsigned int triangle) {
+          float offset = centroids[triangle * 3 + bestAxis] - minCentroid;
+          return std::min(NUM_BINS - 1, (unsigned int)(offset * scale)) <=
+            bestBin;
+        }) - order.begin());
+    } else if (count > MAX_LEAF_SIZE * 4) {
+      // No split pays off (e.g. coincident centroids), but a huge leaf would
+      // be slow to test, so split down the middle anyway.
+      mid = task.begin + count / 2;
+    } else {
+      continue;
+    }
+
+    _nodes[nodeIndex].count = 0;
+    stack.push_back(Task { mid, task.end, task.depth + 1, (int)nodeIndex });
+    stack.push_back(Task { task.begin, mid, task.depth + 1, -1 });
+  }
+
+  // Store the triangles in leaf order so that leaves are contiguous.
+  std::vector<unsigned int> triangleVertices(_triangleVertices.size());
+  std::vector<int> triangleFaces(numTriangles);
+  for (unsigned int i = 0; i < numTriangles; ++i) {
+    std::copy(_triangleVertices.begin() + order[i] * 3,
+      _triangleVertices.begin() + order[i] * 3 + 3,
+      triangleVertices.begin() + i * 3);
+    triangleFaces[i] = _triangleFaces[order[i]];
+  }
+
+  _triangleVertices.swap(triangleVertices);
+  _triangleFaces.swap(triangleFaces);
+}
+
+void PickBvh::refitNodes() {
+  // Children always come after their parent, so a reverse sweep sees both
+  // children before the parent.
+  for (size_t i = _nodes.size(); i-- > 0;) {
+    Node& node = _nodes[i];
+    if (node.count != 0) {
+      node.bounds.reset();
+      Bounds bounds;
+      for (unsigned int j = node.start; j < node.start + node.count; ++j) {
+        triangleBounds(j, bounds);
+        node.bounds.grow(bounds);
+      }
+    } else {
+      node.bounds = _nodes[i + 1].bounds;
+      node.bounds.grow(_nodes[node.start].bounds);
+    }
+  }
+}
+
+bool PickBvh::intersect(const MPoint& rayOrigin,
+  const MVector& rayDirection,
+  float maxParam,
+  int& hitFace,
+  float* hitParam,
+  Deadline* deadline) const {
+  if (_nodes.empty()) {
+    return false;
+  }
+
+  const float origin[3] = {
+    float(rayOrigin.x), float(rayOrigin.y), float(rayOrigin.z)
+  };
+  const float direction[3] = {
+    float(rayDirection.x), float(rayDirection.y), float(rayDirection.z)
+  };
+  float inverse[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    inverse[axis] = 1.0f / direction[axis];
+  }
+
+  const float MISS = std::numeric_limits<float>::infinity();
+
+  // Slab test; returns the entry distance, or infinity on a miss.
+  auto enter = [&](const Bounds& bounds, float tMax) {
+    float tNear = 0.0f;
+    float tFar = tMax;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t0 = (bounds.min[axis] - origin[axis]) * inverse[axis];
+      float t1 = (bounds.max[axis] - origin[axis]) * inverse[axis];
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      tNear = std::max(tNear, t0);
+      tFar = std::min(tFar, t1);
+    }
+    return tNear <= tFar ? tNear : MISS;
+  };
+
+  float closest = maxParam;
+  int closestTriangle = -1;
+
+  unsigned int stack[MAX_DEPTH * 2 + 2];
+  unsigned int stackSize = 0;
+  if (enter(_nodes[0].bounds, closest) != MISS) {
+    stack[stackSize++] = 0;
+  }
+
+  unsigned int visited = 0;
+  while (stackSize != 0) {
+    if (deadline && ++visited % DEADLINE_INTERVAL == 0 &&
+        deadline->expired()) {
+      return false;
+    }
+
+    const Node& node = _nodes[stack[--stackSize]];
+
+    if (node.count != 0) {
+      for (unsigned int i = node.start; i < node.start + node.count; ++i) {
+        // Moller-Trumbore, accepting hits on both sides of the triangle.
+        const float* p0 = &_points[_triangleVertices[i * 3] * 3];
+        const float* p1 = &_points[_triangleVertices[i * 3 + 1] * 3];
+        const float* p2 = &_points[_triangleVertices[i * 3 + 2] * 3];
+
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float p[3] = {
+          direction[1] * e2[2] - direction[2] * e2[1],
+          direction[2] * e2[0] - direction[0] * e2[2],
+          direction[0] * e2[1] - direction[1] * e2[0]
+        };
+
+        float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (std::fabs(det) < 1e-12f) {
+          continue;
+        }
+
+        float invDet = 1.0f / det;
+        float s[3] = {
+          origin[0] - p0[0], origin[1] - p0[1], origin[2] - p0[2]
+        };
+        float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+        if (u < 0.0f || u > 1.0f) {
+          continue;
+        }
+
+        float q[3] = {
+          s[1] * e1[2] - s[2] * e1[1],
+          s[2] * e1[0] - s[0] * e1[2],
+          s[0] * e1[1] - s[1] * e1[0]
+        };
+        float v = (direction[0] * q[0] + direction[1] * q[1] +
+          direction[2] * q[2]) * invDet;
+        if (v < 0.0f || u + v > 1.0f) {
+          continue;
+        }
+
+        float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+        if (t > 0.0f && t < closest) {
+          closest = t;
+          closestTriangle = (int)i;
+        }
+      }
+      continue;
+    }
+
+    // Visit the nearer child first so that farther subtrees get culled by
+    // the closest hit so far.
+    unsigned int left = (unsigned int)(&node - &_nodes[0]) + 1;
+    unsigned int right = node.start;
+    float tLeft = enter(_nodes[left].bounds, closest);
+    float tRight = enter(_nodes[right].bounds, closest);
+
+    if (tLeft > tRight) {
+      std::swap(left, right);
+      std::swap(tLeft, tRight);
+    }
+
+    if (tRight != MISS) {
+      stack[stackSize++] = right;
+    }
+    if (tLeft != MISS) {
+      stack[stackSize++] = left;
+    }
+  }
+
+  if (closestTriangle < 0) {
+    return false;
+  }
+
+  hitFace = _triangleFaces[closestTriangle];
+  if (hitParam) {
+    *hitParam = closest;
+  }
+  return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MDagPath.h>
+#include <maya/MPoint.h>
+#include <maya/MStatus.h>
+#include <maya/MVector.h>
+
+#include "deadline.h"
+
+// Bounding volume hierarchy over the deformed world-space triangles of a
+// mesh, used to find the face under the mouse. The tree is built once with
+// the surface area heuristic; when the mesh deforms, only the node bounds are
+// refit from the new points, which keeps the topology of the tree intact.
+class PickBvh {
+public:
+  PickBvh();
+  MStatus build(const MDagPath& meshDagPath);
+  MStatus refit(const MDagPath& meshDagPath);
+  void clear();
+
+  bool isEmpty() const;
+  unsigned int numTriangles() const;
+  unsigned int numNodes() const;
+  void bounds(MPoint& min, MPoint& max) const;
+
+  // World-space points and triangles, for consumers that need the same
+  // deformed geometry the tree was fit to.
+  const std::vector<float>& points() const;
+  const std::vector<unsigned int>& triangleVertices() const;
+  const std::vector<int>& triangleFaces() const;
+
+  // Closest hit along the ray with 0 < t <= maxParam; returns the polygon
+  // index of the hit triangle. Reports a miss if the deadline expires before
+  // the traversal finishes.
+  bool intersect(const MPoint& rayOrigin, const MVector& rayDirection,
+    float maxParam, int& hitFace, float* hitParam = nullptr,
+    Deadline* deadline = nullptr) const;
+
+private:
+  struct Bounds {
+    float min[3];
+    float max[3];
+
+    void reset();
+    void grow(const float* point);
+    void grow(const Bounds& other);
+    float halfArea() const;
+  };
+
+  // Nodes are stored depth-first, so the left child of an interior node is
+  // always the next node; start is the right child for interior nodes and
+  // the first triangle for leaves.
+  struct Node {
+    Bounds bounds;
+    unsigned int start;
+    unsigned int count;
+  };
+
+  MStatus readPoints(const MDagPath& meshDagPath);
+  void buildNodes();
+  void refitNodes();
+  void triangleBounds(unsigned int triangle, Bounds& bounds) const;
+
+  std::vector<float> _points;
+  std::vector<unsigned int> _triangleVertices;
+  std::vector<int> _triangleFaces;
+  std::vector<Node> _nodes;
+};
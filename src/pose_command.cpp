@@ -0,0 +1,257 @@
+#include "pose_command.h"
+#include "pose_library.h"
+#include "rig.h"
+
+#include <cmath>
+#include <limits>
+
+#include <maya/MArgDatabase.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MFnSkinCluster.h>
+#include <maya/MGlobal.h>
+
+MannequinPoseCommand::MannequinPoseCommand() : _isEdit(false) {}
+
+void* MannequinPoseCommand::creator() {
+  return new MannequinPoseCommand;
+}
+
+MSyntax MannequinPoseCommand::newSyntax() {
+  MSyntax syn;
+
+  syn.addFlag("-t", "-translate");
+  syn.addFlag("-r", "-rotate");
+  syn.addFlag("-v", "-values", MSyntax::kDouble);
+  syn.makeFlagMultiUse("-v");
+  syn.addFlag("-l", "-library", MSyntax::kString);
+  syn.addFlag("-p", "-pose", MSyntax::kString);
+  syn.addFlag("-b", "-blend", MSyntax::kString);
+  syn.addFlag("-w", "-weight", MSyntax::kDouble);
+
+  syn.setObjectType(MSyntax::kSelectionList, 1);
+  syn.useSelectionAsDefault(true);
+  syn.enableQuery(true);
+  syn.enableEdit(true);
+
+  return syn;
+}
+
+MStatus MannequinPoseCommand::appendJoints(const MSelectionList& list,
+  std::vector<MDagPath>& jointDagPaths) {
+  for (unsigned int i = 0; i < list.length(); ++i) {
+    MDagPath dagPath;
+    MStatus err = list.getDagPath(i, dagPath);
+    if (err.error()) {
+      MGlobal::displayError("Objects must be skinned meshes or transforms");
+      return err;
+    }
+
+    MDagPath shapeDagPath = dagPath;
+    shapeDagPath.extendToShape();
+    if (shapeDagPath.hasFn(MFn::kMesh)) {
+      MObject skinObj = Rig::findSkinCluster(shapeDagPath);
+      if (skinObj.isNull()) {
+        MGlobal::displayError(shapeDagPath.partialPathName() +
+          " has no smooth skin bound");
+        return MS::kInvalidParameter;
+      }
+
+      MFnSkinCluster skin(skinObj);
+      MDagPathArray influenceObjects;
+      unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+      for (unsigned int j = 0; j < numInfluences; ++j) {
+        jointDagPaths.push_back(influenceObjects[j]);
+      }
+    } else if (dagPath.hasFn(MFn::kTransform)) {
+      jointDagPaths.push_back(dagPath);
+    } else {
+      MGlobal::displayError(dagPath.partialPathName() +
+        " is not a skinned mesh or transform");
+      return MS::kInvalidParameter;
+    }
+  }
+
+  return MS::kSuccess;
+}
+
+MStatus MannequinPoseCommand::libraryValues(const MArgDatabase& parse,
+  const std::vector<MDagPath>& jointDagPaths, int channels,
+  std::vector<double>& values) {
+  MString path;
+  MString poseName;
+  if (parse.getFlagArgument("-l", 0, path).error() ||
+      parse.getFlagArgument("-p", 0, poseName).error()) {
+    displayError("-pose needs a -library");
+    return MS::kInvalidParameter;
+  }
+
+  MStatus err;
+  std::shared_ptr<PoseLibrary> library = PoseLibrary::acquire(path, &err);
+  if (!library) {
+    displayError("Could not open pose library " + path);
+    return err;
+  }
+
+  int pose = library->findPose(poseName);
+  if (pose < 0) {
+    displayError("No pose named " + poseName);
+    return MS::kInvalidParameter;
+  }
+
+  int blendPose = -1;
+  double weight = 0.5;
+  if (parse.isFlagSet("-b")) {
+    MString blendPoseName;
+    parse.getFlagArgument("-b", 0, blendPoseName);
+    blendPose = library->findPose(blendPoseName);
+    if (blendPose < 0) {
+      displayError("No pose named " + blendPoseName);
+      return MS::kInvalidParameter;
+    }
+
+    if (parse.isFlagSet("-w")) {
+      parse.getFlagArgument("-w", 0, weight);
+    }
+  }
+
+  // Joints the library doesn't know, and channels a pose doesn't store,
+  // stay NaN and are left alone. If only one of the blended poses stores a
+  // channel, that pose's value is used.
+  unsigned int stride = PoseWriter::numChannels(channels);
+  values.assign(jointDagPaths.size() * stride,
+    std::numeric_limits<double>::quiet_NaN());
+  for (unsigned int i = 0; i < jointDagPaths.size(); ++i) {
+    int j = library->findJoint(PoseLibrary::jointKey(jointDagPaths[i]));
+    if (j < 0) {
+      continue;
+    }
+
+    double* jointValues = &values[i * stride];
+    for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+      if (!(channels & (1 << c))) {
+        continue;
+      }
+
+      double value = library->channelValues(pose, c)[j];
+      if (blendPose >= 0) {
+        double other = library->channelValues(blendPose, c)[j];
+        if (std::isnan(value)) {
+          value = other;
+        } else if (!std::isnan(other)) {
+          value += (other - value) * weight;
+        }
+      }
+      *jointValues++ = value;
+    }
+  }
+
+  return MS::kSuccess;
+}
+
+MStatus MannequinPoseCommand::doIt(const MArgList& args) {
+  MStatus err;
+  MArgDatabase parse(syntax(), args, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MSelectionList list;
+  err = parse.getObjects(list);
+  if (err.error()) {
+    return err;
+  }
+
+  std::vector<MDagPath> jointDagPaths;
+  err = appendJoints(list, jointDagPaths);
+  if (err.error()) {
+    return err;
+  }
+
+  int channels = 0;
+  if (parse.isFlagSet("-t")) {
+    channels |= KeyIndex::kTranslateChannels;
+  }
+  if (parse.isFlagSet("-r")) {
+    channels |= KeyIndex::kRotateChannels;
+  }
+  if (channels == 0) {
+    channels = KeyIndex::kAllChannels;
+  }
+
+  if (parse.isQuery()) {
+    MDoubleArray results;
+    for (const MDagPath& jointDagPath : jointDagPaths) {
+      err = PoseWriter::read(jointDagPath, channels, results);
+      if (err.error()) {
+        return err;
+      }
+    }
+
+    setResult(results);
+    return MS::kSuccess;
+  } else if (!parse.isEdit()) {
+    displayError("Use -query or -edit");
+    return MS::kInvalidParameter;
+  }
+
+  unsigned int stride = PoseWriter::numChannels(channels);
+  std::vector<double> values;
+  PoseWriter::Units units = PoseWriter::kUIUnits;
+  double tolerance = 0.0;
+  if (parse.isFlagSet("-p")) {
+    err = libraryValues(parse, jointDagPaths, channels, values);
+    if (err.error()) {
+      return err;
+    }
+    units = PoseWriter::kInternalUnits;
+    tolerance = PoseLibrary::VALUE_TOLERANCE;
+  } else {
+    unsigned int numValues = parse.numberOfFlagUses("-v");
+    if (numValues != jointDagPaths.size() * stride) {
+      MString errMessage = "Expected ";
+      errMessage += (int)(jointDagPaths.size() * stride);
+      errMessage += " values, got ";
+      errMessage += (int)numValues;
+      displayError(errMessage);
+      return MS::kInvalidParameter;
+    }
+
+    values.resize(numValues);
+    for (unsigned int i = 0; i < numValues; ++i) {
+      MArgList flagArgs;
+      err = parse.getFlagArgumentList("-v", i, flagArgs);
+      if (err.error()) {
+        return err;
+      }
+
+      values[i] = flagArgs.asDouble(0, &err);
+      if (err.error()) {
+        return err;
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < jointDagPaths.size(); ++i) {
+    err = _poseWriter.set(jointDagPaths[i], channels, &values[i * stride],
+      units, tolerance);
+    if (err.error()) {
+      return err;
+    }
+  }
+
+  _isEdit = true;
+  return _poseWriter.doIt();
+}
+
+MStatus MannequinPoseCommand::redoIt() {
+  return _poseWriter.redoIt();
+}
+
+MStatus MannequinPoseCommand::undoIt() {
+  return _poseWriter.undoIt();
+}
+
+bool MannequinPoseCommand::isUndoable() const {
+  return _isEdit;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MArgDatabase.h>
+#include <maya/MArgList.h>
+#include <maya/MDagPath.h>
+#include <maya/MPxCommand.h>
+#include <maya/MSelectionList.h>
+#include <maya/MStatus.h>
+#include <maya/MSyntax.h>
+
+#include "pose_writer.h"
+
+// `mannequinPose` gets or sets the translate and rotate channels of many
+// joints at once as one flat array of doubles in UI units. Skinned meshes
+// stand for all of their influences in joint ID order, the order of
+// `mannequinContext -q -jointInfo`, and transforms stand for themselves.
+// Each joint has translate XYZ then rotate XYZ, or only one of them with
+// -translate or -rotate. An edit is a single undo step:
+//
+//     values = cmds.mannequinPose("body", q=True, rotate=True)
+//     cmds.mannequinPose("body", e=True, rotate=True, values=values)
+//
+// Instead of -values, an edit can take a pose from a PoseLibrary file with
+// -library and -pose, optionally blended toward a second pose with -blend
+// and -weight.
+class MannequinPoseCommand : public MPxCommand
+{
+public:
+  MannequinPoseCommand();
+  static void* creator();
+  static MSyntax newSyntax();
+  virtual MStatus doIt(const MArgList& args) override;
+  virtual MStatus redoIt() override;
+  virtual MStatus undoIt() override;
+  virtual bool isUndoable() const override;
+
+private:
+  static MStatus appendJoints(const MSelectionList& list,
+    std::vector<MDagPath>& jointDagPaths);
+  // The pose named by the flags for the joints, in internal units.
+  static MStatus libraryValues(const MArgDatabase& parse,
+    const std::vector<MDagPath>& jointDagPaths, int channels,
+    std::vector<double>& values);
+
+  PoseWriter _poseWriter;
+  bool _isEdit;
+};
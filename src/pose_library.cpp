@@ -0,0 +1,411 @@
+#include "pose_library.h"
+#include "face_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include <boost/interprocess/file_mapping.hpp>
+
+#include <maya/MFnDependencyNode.h>
+#include <maya/MGlobal.h>
+
+const double PoseLibrary::VALUE_TOLERANCE = 1e-6;
+
+namespace {
+  const char MAGIC[4] = { 'M', 'Q', 'P', 'L' };
+
+  // The header is followed by the joint name offsets, the pose name offsets
+  // and the hash buckets as uint32 arrays, then the pose blocks as float32,
+  // then the string table of NUL-terminated names.
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numJoints;
+    uint32_t numPoses;
+    uint32_t numBuckets;
+    uint32_t stringTableSize;
+  };
+
+  // Every open library, so that the context and the commands it runs share
+  // one mapping. Expired entries are pruned on the next acquire().
+  std::vector<std::weak_ptr<PoseLibrary>> libraryCache;
+
+  uint32_t nameHash(const char* name) {
+    Fingerprint fingerprint;
+    fingerprint.add(name, std::strlen(name));
+    return (uint32_t)fingerprint.value();
+  }
+
+  uint64_t poseBlockSize(uint32_t numJoints) {
+    return uint64_t(KeyIndex::NUM_CHANNELS) * numJoints;
+  }
+
+  uint64_t fileSize(const FileHeader& header) {
+    uint64_t numOffsets =
+      uint64_t(header.numJoints) + header.numPoses + header.numBuckets;
+    return sizeof(FileHeader) + numOffsets * sizeof(uint32_t) +
+      header.numPoses * poseBlockSize(header.numJoints) * sizeof(float) +
+      header.stringTableSize;
+  }
+
+  uint32_t appendString(std::string& strings, const std::string& string) {
+    uint32_t offset = (uint32_t)strings.size();
+    strings.append(string);
+    strings.push_back('\0');
+    return offset;
+  }
+
+  template<typename T>
+  void writeArray(std::ofstream& out, const T* data, size_t count) {
+    out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+  }
+
+  // Moves the file over the destination in one step, so that the
+  // destination is either the old file or the new one. rename() already
+  // does this on POSIX, but fails on Windows if the destination exists.
+  bool replaceFile(const MString& source, const MString& destination) {
+#if defined(_WIN32)
+    return MoveFileExW(source.asWChar(), destination.asWChar(),
+      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(source.asChar(), destination.asChar()) == 0;
+#endif
+  }
+}
+
+PoseLibrary::PoseLibrary(const MString& path)
+  : _path(path),
+    _numJoints(0),
+    _numPoses(0),
+    _numBuckets(0),
+    _stringTableSize(0),
+    _jointNames(nullptr),
+    _poseNames(nullptr),
+    _buckets(nullptr),
+    _channels(nullptr),
+    _strings(nullptr) {}
+
+std::shared_ptr<PoseLibrary> PoseLibrary::acquire(const MString& path,
+  MStatus* err) {
+  std::shared_ptr<PoseLibrary> result;
+
+  auto it = libraryCache.begin();
+  while (it != libraryCache.end()) {
+    std::shared_ptr<PoseLibrary> library = it->lock();
+    if (!library) {
+      it = libraryCache.erase(it);
+      continue;
+    }
+
+    if (!result && library->_path == path) {
+      result = library;
+    }
+    ++it;
+  }
+
+  if (!result) {
+    result.reset(new PoseLibrary(path));
+    MStatus openErr = result->open();
+    if (openErr.error()) {
+      if (err) {
+        *err = openErr;
+      }
+      return nullptr;
+    }
+
+    libraryCache.push_back(result);
+  }
+
+  if (err) {
+    *err = MS::kSuccess;
+  }
+  return result;
+}
+
+MStatus PoseLibrary::open() {
+  using namespace boost::interprocess;
+
+  std::ifstream probe(_path.asChar(), std::ios::binary);
+  if (!probe.good()) {
+    return MS::kNotFound;
+  }
+  probe.close();
+
+  // The region stays mapped after the file mapping goes away.
+  try {
+    file_mapping file(_path.asChar(), read_only);
+    mapped_region region(file, read_only);
+    _region.swap(region);
+  } catch (const interprocess_exception&) {
+    return MS::kFailure;
+  }
+
+  const char* data = static_cast<const char*>(_region.get_address());
+  size_t size = _region.get_size();
+  if (size < sizeof(FileHeader)) {
+    return MS::kFailure;
+  }
+
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(FileHeader));
+
+  // Probing needs an empty bucket to stop at.
+  bool bucketsValid = header.numBuckets == 0 ?
+    header.numPoses == 0 :
+    (header.numBuckets & (header.numBuckets - 1)) == 0 &&
+      header.numBuckets > header.numPoses;
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != FORMAT_VERSION ||
+      fileSize(header) != size ||
+      !bucketsValid ||
+      header.stringTableSize == 0 ||
+      data[size - 1] != '\0') {
+    return MS::kFailure;
+  }
+
+  _numJoints = header.numJoints;
+  _numPoses = header.numPoses;
+  _numBuckets = header.numBuckets;
+  _stringTableSize = header.stringTableSize;
+  _jointNames = reinterpret_cast<const uint32_t*>(data + sizeof(FileHeader));
+  _poseNames = _jointNames + _numJoints;
+  _buckets = _poseNames + _numPoses;
+  _channels = reinterpret_cast<const float*>(_buckets + _numBuckets);
+  _strings = data + size - _stringTableSize;
+
+  _jointIndices.reserve(_numJoints);
+  for (unsigned int i = 0; i < _numJoints; ++i) {
+    _jointIndices.insert(std::make_pair(std::string(jointName(i)), (int)i));
+  }
+
+  return MS::kSuccess;
+}
+
+MStatus PoseLibrary::savePose(const MString& path, const MString& poseName,
+  const std::vector<std::string>& jointNames,
+  const std::vector<double>& values) {
+  std::shared_ptr<PoseLibrary> base;
+  std::ifstream probe(path.asChar(), std::ios::binary);
+  if (probe.good()) {
+    probe.close();
+
+    // Don't write over something that isn't a pose library.
+    MStatus err;
+    base = acquire(path, &err);
+    if (!base) {
+      return err;
+    }
+  }
+
+  std::vector<std::string> libraryJoints;
+  if (base) {
+    for (unsigned int i = 0; i < base->numJoints(); ++i) {
+      libraryJoints.push_back(base->jointName(i));
+    }
+  } else {
+    libraryJoints = jointNames;
+  }
+
+  uint32_t numJoints = (uint32_t)libraryJoints.size();
+  std::vector<float> newPose(poseBlockSize(numJoints),
+    std::numeric_limits<float>::quiet_NaN());
+  for (unsigned int i = 0; i < jointNames.size(); ++i) {
+    int j = base ? base->findJoint(jointNames[i]) : (int)i;
+    if (j < 0) {
+      continue;
+    }
+
+    for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+      newPose[c * numJoints + j] =
+        (float)values[i * KeyIndex::NUM_CHANNELS + c];
+    }
+  }
+
+  // Existing poses are copied straight out of the mapping.
+  std::vector<std::string> poseNames;
+  std::vector<const float*> poses;
+  int replaced = base ? base->findPose(poseName) : -1;
+  for (unsigned int p = 0; base && p < base->numPoses(); ++p) {
+    poseNames.push_back(base->poseName(p));
+    poses.push_back((int)p == replaced ?
+      newPose.data() : base->channelValues(p, 0));
+  }
+  if (replaced < 0) {
+    poseNames.push_back(poseName.asChar());
+    poses.push_back(newPose.data());
+  }
+
+  uint32_t numPoses = (uint32_t)poses.size();
+  uint32_t numBuckets = 1;
+  while (numBuckets < numPoses * 2) {
+    numBuckets <<= 1;
+  }
+
+  std::string strings;
+  std::vector<uint32_t> jointOffsets(numJoints);
+  for (uint32_t i = 0; i < numJoints; ++i) {
+    jointOffsets[i] = appendString(strings, libraryJoints[i]);
+  }
+
+  std::vector<uint32_t> poseOffsets(numPoses);
+  std::vector<uint32_t> buckets(numBuckets, 0);
+  for (uint32_t p = 0; p < numPoses; ++p) {
+    poseOffsets[p] = appendString(strings, poseNames[p]);
+
+    uint32_t bucket = nameHash(poseNames[p].c_str()) & (numBuckets - 1);
+    while (buckets[bucket] != 0) {
+      bucket = (bucket + 1) & (numBuckets - 1);
+    }
+    buckets[bucket] = p + 1;
+  }
+
+  FileHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = FORMAT_VERSION;
+  header.numJoints = numJoints;
+  header.numPoses = numPoses;
+  header.numBuckets = numBuckets;
+  header.stringTableSize = (uint32_t)strings.size();
+
+  // Write to a temporary file and move it into place so that readers never
+  // see a partially written library.
+  MString tempPath = path + ".tmp";
+  {
+    std::ofstream out(tempPath.asChar(), std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+      MGlobal::displayError("Could not write " + tempPath +
+        "; check that the pose library's folder is writable");
+      return MS::kFailure;
+    }
+
+    writeArray(out, &header, 1);
+    writeArray(out, jointOffsets.data(), jointOffsets.size());
+    writeArray(out, poseOffsets.data(), poseOffsets.size());
+    writeArray(out, buckets.data(), buckets.size());
+    for (const float* pose : poses) {
+      writeArray(out, pose, newPose.size());
+    }
+    writeArray(out, strings.data(), strings.size());
+
+    if (!out.good()) {
+      out.close();
+      std::remove(tempPath.asChar());
+      MGlobal::displayError("Could not write " + tempPath +
+        "; check that the disk isn't full");
+      return MS::kFailure;
+    }
+  }
+
+  // Drop the old mapping first; Windows won't replace a mapped file. Anyone
+  // still holding it keeps reading the old poses until they acquire again.
+  base.reset();
+  auto it = libraryCache.begin();
+  while (it != libraryCache.end()) {
+    std::shared_ptr<PoseLibrary> library = it->lock();
+    if (!library || library->_path == path) {
+      it = libraryCache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // The old library stays in place until the new one replaces it. If that
+  // fails, the new library is kept next to it so that nothing is lost.
+  if (!replaceFile(tempPath, path)) {
+    MGlobal::displayError("Could not replace " + path + ", which may be " +
+      "open in another program or Maya session. The library with the new " +
+      "pose was saved as " + tempPath);
+    return MS::kFailure;
+  }
+
+  return MS::kSuccess;
+}
+
+std::string PoseLibrary::jointKey(const MDagPath& jointDagPath) {
+  MFnDependencyNode jointNode(jointDagPath.node());
+  std::string name = jointNode.name().asChar();
+
+  size_t namespaceEnd = name.rfind(':');
+  if (namespaceEnd != std::string::npos) {
+    name.erase(0, namespaceEnd + 1);
+  }
+
+  return name;
+}
+
+const MString& PoseLibrary::path() const {
+  return _path;
+}
+
+unsigned int PoseLibrary::numJoints() const {
+  return _numJoints;
+}
+
+unsigned int PoseLibrary::numPoses() const {
+  return _numPoses;
+}
+
+int PoseLibrary::findJoint(const std::string& jointName) const {
+  auto value = _jointIndices.find(jointName);
+  if (value != _jointIndices.end()) {
+    return value->second;
+  }
+
+  return -1;
+}
+
+int PoseLibrary::findPose(const MString& poseName) const {
+  if (_numBuckets == 0) {
+    return -1;
+  }
+
+  const char* name = poseName.asChar();
+  uint32_t mask = _numBuckets - 1;
+  uint32_t bucket = nameHash(name) & mask;
+  for (uint32_t probes = 0; probes < _numBuckets; ++probes) {
+    uint32_t entry = _buckets[bucket];
+    if (entry == 0) {
+      break;
+    }
+
+    uint32_t poseIndex = entry - 1;
+    if (poseIndex < _numPoses &&
+        std::strcmp(this->poseName(poseIndex), name) == 0) {
+      return (int)poseIndex;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+
+  return -1;
+}
+
+const char* PoseLibrary::jointName(unsigned int jointIndex) const {
+  // The table ends in a NUL, so any offset inside it is a whole string.
+  uint32_t offset = _jointNames[jointIndex];
+  return offset < _stringTableSize ? _strings + offset : "";
+}
+
+const char* PoseLibrary::poseName(unsigned int poseIndex) const {
+  uint32_t offset = _poseNames[poseIndex];
+  return offset < _stringTableSize ? _strings + offset : "";
+}
+
+void PoseLibrary::appendPoseNames(MStringArray& results) const {
+  for (unsigned int i = 0; i < _numPoses; ++i) {
+    results.append(poseName(i));
+  }
+}
+
+const float* PoseLibrary::channelValues(unsigned int poseIndex,
+  unsigned int channel) const {
+  return _channels +
+    (size_t(poseIndex) * KeyIndex::NUM_CHANNELS + channel) * _numJoints;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <maya/MDagPath.h>
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+#include <maya/MStringArray.h>
+
+#include "key_index.h"
+
+// A read-only library of poses for one character, memory-mapped from a
+// binary file so that opening it costs the same however many poses it
+// holds, and applying a pose only pages in that pose. The file has a fixed
+// joint table, then per pose a block of channel data laid out channel by
+// channel across the joints in internal units, with NaN for channels the
+// pose doesn't store. Names live in a string table, and pose names are
+// found through an open-addressed hash table stored in the file.
+// Joints are matched by node name without namespace, so one library serves
+// every reference of the character. Libraries are shared through
+// acquire(), like rigs.
+class PoseLibrary {
+public:
+  // Bump whenever the file layout changes.
+  static const uint32_t FORMAT_VERSION = 1;
+  // Values are stored as floats, so a pose read back can be this far off,
+  // relative to the value, from what was saved.
+  static const double VALUE_TOLERANCE;
+
+  static std::shared_ptr<PoseLibrary> acquire(const MString& path,
+    MStatus* err = nullptr);
+  // Adds a pose to the library at the path, replacing any pose with the
+  // same name, or starts a new library from the given joints. An existing
+  // library keeps its joint table, so joints it doesn't have are dropped.
+  // Values are NUM_CHANNELS per joint in internal units. The file is
+  // replaced in one step; if that fails, the old file is untouched and the
+  // new one is left beside it with a .tmp extension.
+  static MStatus savePose(const MString& path, const MString& poseName,
+    const std::vector<std::string>& jointNames,
+    const std::vector<double>& values);
+  static std::string jointKey(const MDagPath& jointDagPath);
+
+  const MString& path() const;
+  unsigned int numJoints() const;
+  unsigned int numPoses() const;
+  int findJoint(const std::string& jointName) const;
+  int findPose(const MString& poseName) const;
+  const char* jointName(unsigned int jointIndex) const;
+  const char* poseName(unsigned int poseIndex) const;
+  void appendPoseNames(MStringArray& results) const;
+  // The values of one channel of a pose, one per joint.
+  const float* channelValues(unsigned int poseIndex,
+    unsigned int channel) const;
+
+private:
+  PoseLibrary(const MString& path);
+  PoseLibrary(const PoseLibrary&);
+  PoseLibrary& operator=(const PoseLibrary&);
+
+  MStatus open();
+
+  MString _path;
+  boost::interprocess::mapped_region _region;
+
+  unsigned int _numJoints;
+  unsigned int _numPoses;
+  unsigned int _numBuckets;
+  unsigned int _stringTableSize;
+  const uint32_t* _jointNames;
+  const uint32_t* _poseNames;
+  // Pose index + 1 per bucket, or 0 if the bucket is empty.
+  const uint32_t* _buckets;
+  const float* _channels;
+  const char* _strings;
+
+  std::unordered_map<std::string, int> _jointIndices;
+};
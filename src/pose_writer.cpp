@@ -0,0 +1,156 @@
+#include "pose_writer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <maya/MAngle.h>
+#include <maya/MAnimControl.h>
+#include <maya/MDistance.h>
+#include <maya/MFnAnimCurve.h>
+#include <maya/MFnDependencyNode.h>
+
+namespace {
+  // Values round-trip through UI units, so "unchanged" can be off by an ulp.
+  const double VALUE_TOLERANCE = 1e-9;
+
+  bool isRotate(unsigned int channel) {
+    return channel >= KeyIndex::kRotateX;
+  }
+
+  double toUI(unsigned int channel, double value) {
+    return isRotate(channel) ?
+      MAngle::internalToUI(value) : MDistance::internalToUI(value);
+  }
+
+  double toInternal(unsigned int channel, double value) {
+    return isRotate(channel) ?
+      MAngle::uiToInternal(value) : MDistance::uiToInternal(value);
+  }
+}
+
+unsigned int PoseWriter::numChannels(int channels) {
+  unsigned int count = 0;
+  for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+    count += (channels & (1 << c)) ? 1 : 0;
+  }
+  return count;
+}
+
+MStatus PoseWriter::read(const MDagPath& jointDagPath, int channels,
+  MDoubleArray& values, Units units) {
+  MStatus err;
+  MFnDependencyNode jointNode(jointDagPath.node(), &err);
+  if (err.error()) {
+    return err;
+  }
+
+  for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+    if (!(channels & (1 << c))) {
+      continue;
+    }
+
+    MPlug plug = jointNode.findPlug(KeyIndex::attributeName(c), true, &err);
+    if (err.error()) {
+      return err;
+    }
+    double value = plug.asDouble();
+    values.append(units == kUIUnits ? toUI(c, value) : value);
+  }
+
+  return MS::kSuccess;
+}
+
+PoseWriter::PoseWriter() {}
+
+MStatus PoseWriter::set(const MDagPath& jointDagPath, int channels,
+  const double* values, Units units, double relativeTolerance) {
+  MStatus err;
+  MFnDependencyNode jointNode(jointDagPath.node(), &err);
+  if (err.error()) {
+    return err;
+  }
+
+  for (unsigned int c = 0; c < KeyIndex::NUM_CHANNELS; ++c) {
+    if (!(channels & (1 << c))) {
+      continue;
+    }
+
+    double value = *values++;
+    if (std::isnan(value)) {
+      continue;
+    } else if (units == kUIUnits) {
+      value = toInternal(c, value);
+    }
+
+    MPlug plug = jointNode.findPlug(KeyIndex::attributeName(c), true, &err);
+    if (err.error()) {
+      return err;
+    }
+
+    double current = plug.asDouble();
+    double tolerance = std::max(VALUE_TOLERANCE,
+      relativeTolerance * std::max(std::abs(current), std::abs(value)));
+    if (plug.isLocked() || std::abs(current - value) < tolerance) {
+      continue;
+    }
+
+    err = _modifier.newPlugValueDouble(plug, value);
+    if (err.error()) {
+      return err;
+    }
+
+    Change change = { plug, value };
+    _changes.push_back(change);
+  }
+
+  return MS::kSuccess;
+}
+
+unsigned int PoseWriter::numChanges() const {
+  return (unsigned int)_changes.size();
+}
+
+MStatus PoseWriter::doIt() {
+  MStatus err = _modifier.doIt();
+  if (err.error() || !MAnimControl::autoKeyMode()) {
+    return err;
+  }
+
+  // Only curves connected straight to the channel are keyed; channels on
+  // animation layers are left alone, as are channels without keys.
+  MTime time = MAnimControl::currentTime();
+  for (const Change& change : _changes) {
+    MFnAnimCurve animCurve(change.plug, &err);
+    if (err.error()) {
+      continue;
+    }
+
+    unsigned int index;
+    if (animCurve.find(time, index)) {
+      animCurve.setValue(index, change.value, &_curveChange);
+    } else {
+      animCurve.addKey(time, change.value, MFnAnimCurve::kTangentGlobal,
+        MFnAnimCurve::kTangentGlobal, &_curveChange);
+    }
+  }
+
+  return MS::kSuccess;
+}
+
+MStatus PoseWriter::redoIt() {
+  MStatus err = _modifier.doIt();
+  if (err.error()) {
+    return err;
+  }
+
+  return _curveChange.redoIt();
+}
+
+MStatus PoseWriter::undoIt() {
+  MStatus err = _curveChange.undoIt();
+  if (err.error()) {
+    return err;
+  }
+
+  return _modifier.undoIt();
+}
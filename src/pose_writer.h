@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MAnimCurveChange.h>
+#include <maya/MDagPath.h>
+#include <maya/MDGModifier.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MPlug.h>
+#include <maya/MStatus.h>
+
+#include "key_index.h"
+
+// Joint poses as flat arrays of channel values, with the channels of each
+// joint in KeyIndex order, either in UI units, the units that setAttr takes,
+// or in internal units for storage. NaN values are skipped. A writer
+// collects a whole pose and applies it with one MDGModifier, so that it's a
+// single undo step. Channels that wouldn't change are left out, so they're
+// neither dirtied nor keyed, and locked channels are skipped. Like setAttr
+// with auto key on, applying keys the changed channels that already have a
+// curve.
+class PoseWriter {
+public:
+  enum Units {
+    kUIUnits,
+    kInternalUnits
+  };
+
+  // The number of values per joint for a KeyIndex::ChannelMask.
+  static unsigned int numChannels(int channels);
+  // Appends the joint's values for the channels in the mask.
+  static MStatus read(const MDagPath& jointDagPath, int channels,
+    MDoubleArray& values, Units units = kUIUnits);
+
+  PoseWriter();
+
+  // Queues the joint's channels in the mask, taking numChannels(channels)
+  // values. Values within the relative tolerance of the current value count
+  // as unchanged, for values that have lost precision on the way in.
+  MStatus set(const MDagPath& jointDagPath, int channels,
+    const double* values, Units units = kUIUnits,
+    double relativeTolerance = 0.0);
+  unsigned int numChanges() const;
+
+  MStatus doIt();
+  MStatus redoIt();
+  MStatus undoIt();
+
+private:
+  PoseWriter(const PoseWriter&);
+  PoseWriter& operator=(const PoseWriter&);
+
+  // In internal units, for keying.
+  struct Change {
+    MPlug plug;
+    double value;
+  };
+
+  std::vector<Change> _changes;
+  MDGModifier _modifier;
+  MAnimCurveChange _curveChange;
+};
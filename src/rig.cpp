@@ -0,0 +1,559 @@
+#include "rig.h"
+#include "mannequin.h"
+#include "stats.h"
+
+#include <algorithm>
+
+#include <maya/MDagPathArray.h>
+#include <maya/MDGMessage.h>
+#include <maya/MFnDagNode.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnSkinCluster.h>
+#include <maya/MFnTransform.h>
+#include <maya/MItDependencyGraph.h>
+#include <maya/MItDependencyNodes.h>
+#include <maya/MPolyMessage.h>
+
+namespace {
+  // Every live rig, so that sessions on the same mesh share one. Expired
+  // entries are pruned on the next acquire().
+  std::vector<std::weak_ptr<Rig>> rigCache;
+}
+
+Rig::Rig(const MDagPath& meshDagPath, MObject skinObj)
+  : _meshDagPath(meshDagPath),
+    _skinObject(skinObj),
+    _faceCacheEnabled(true),
+    _pickGeometryDirty(false),
+    _pickTopologyDirty(false),
+    _pickGeometryVersion(0),
+    _geometryVersion(0),
+    _topologyVersion(0),
+    _longestJoint(0.0),
+    _jointTableDirty(true),
+    _influencesDirty(false),
+    _editCallback(nullptr),
+    _editClientData(nullptr) {
+  // Track deformation so that the pick BVH can be refit before the next
+  // hover instead of rebuilt, and keep the joint table in step with the
+  // influences, which come and go as connections to the matrix array.
+  MObject meshObj = meshDagPath.node();
+  _callbacks.append(MNodeMessage::addNodeDirtyCallback(meshObj,
+    Rig::meshDirtyCallback, this));
+  _callbacks.append(MDGMessage::addTimeChangeCallback(
+    Rig::timeChangeCallback, this));
+  _callbacks.append(MPolyMessage::addPolyTopologyChangedCallback(meshObj,
+    Rig::topologyChangedCallback, this));
+  _callbacks.append(MNodeMessage::addAttributeChangedCallback(skinObj,
+    Rig::skinAttributeChangedCallback, this));
+}
+
+Rig::~Rig() {
+  MMessage::removeCallbacks(_callbacks);
+  _callbacks.clear();
+}
+
+std::shared_ptr<Rig> Rig::acquire(const MDagPath& meshDagPath,
+  MObject skinObj) {
+  std::shared_ptr<Rig> result;
+
+  auto it = rigCache.begin();
+  while (it != rigCache.end()) {
+    std::shared_ptr<Rig> rig = it->lock();
+    if (!rig) {
+      it = rigCache.erase(it);
+      continue;
+    }
+
+    if (!result && rig->_meshDagPath == meshDagPath &&
+        rig->_skinObject == skinObj) {
+      result = rig;
+    }
+    ++it;
+  }
+
+  if (!result) {
+    result.reset(new Rig(meshDagPath, skinObj));
+    rigCache.push_back(result);
+  }
+
+  return result;
+}
+
+bool Rig::skinDeformsMesh(MObject skinObj, MObject meshObj) {
+  MStatus err;
+  MFnSkinCluster skinCluster(skinObj, &err);
+  if (err.error()) {
+    return false;
+  }
+
+  unsigned int numGeoms = skinCluster.numOutputConnections();
+  for (unsigned int i = 0; i < numGeoms; ++i) {
+    unsigned int index = skinCluster.indexForOutputConnection(i);
+    MObject output = skinCluster.outputShapeAtIndex(index);
+    if (output == meshObj) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+MObject Rig::findSkinCluster(const MDagPath& meshDagPath) {
+  MObject meshObj = meshDagPath.node();
+
+  // The skin is normally in the deformer chain feeding the mesh, so walk
+  // upstream from inMesh instead of visiting every skin in the scene.
+  MStatus err;
+  MFnDependencyNode meshNode(meshObj);
+  MPlug inMeshPlug = meshNode.findPlug("inMesh", true, &err);
+  if (!err.error()) {
+    MItDependencyGraph graphIter(inMeshPlug, MFn::kSkinClusterFilter,
+      MItDependencyGraph::kUpstream, MItDependencyGraph::kDepthFirst,
+      MItDependencyGraph::kNodeLevel, &err);
+    for (; !err.error() && !graphIter.isDone(); graphIter.next()) {
+      MObject node = graphIter.currentItem();
+      if (skinDeformsMesh(node, meshObj)) {
+        return node;
+      }
+    }
+  }
+
+  // Fall back to checking every skin, e.g. if the history is unusual.
+  MItDependencyNodes depNodeIter(MFn::kSkinClusterFilter);
+  for (; !depNodeIter.isDone(); depNodeIter.next()) {
+    MObject node = depNodeIter.item();
+    if (skinDeformsMesh(node, meshObj)) {
+      return node;
+    }
+  }
+
+  return MObject::kNullObj;
+}
+
+bool Rig::isValid() const {
+  if (!_meshDagPath.isValid() || !_meshDagPath.hasFn(MFn::kMesh)) {
+    return false;
+  }
+
+  MStatus err;
+  MFnSkinCluster skinCluster(_skinObject, &err);
+  return !err.error();
+}
+
+MDagPath Rig::meshDagPath() const {
+  return _meshDagPath;
+}
+
+MObject Rig::skinObject() const {
+  return _skinObject;
+}
+
+void Rig::setup(unsigned int numThreads, bool faceCacheEnabled) {
+  _faceCacheEnabled = faceCacheEnabled;
+
+  // Renames and reparenting aren't watched while the tool is off, so the
+  // joint table is always interned again; it's the cheap part.
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupJointTable);
+    calculateJointTable();
+  }
+
+  // Calculate the max influences for each face.
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupFaceInfluences);
+    calculateMaxInfluences(numThreads);
+    _influencesDirty = false;
+  }
+
+  // Determine the longest joint length in the rig.
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupLongestJoint);
+    calculateLongestJoint();
+  }
+
+  // Build the hover hit-testing BVH, or refit it if the rig was already
+  // set up and has only deformed since.
+  {
+    Stats::ScopedTimer stageTimer(Stats::kSetupPickBvh);
+    updatePickGeometry();
+  }
+}
+
+void Rig::calculateJointTable() {
+  MFnSkinCluster skin(_skinObject);
+  MDagPathArray influenceObjects;
+  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+
+  _jointDagPaths.resize(numInfluences);
+  _jointNames.resize(numInfluences);
+  _jointFullNames.resize(numInfluences);
+  _jointStyles.resize(numInfluences);
+  _jointIds.clear();
+  _jointIds.reserve(numInfluences);
+  _jointIdsByName.clear();
+  _jointIdsByName.reserve(numInfluences);
+
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    MDagPath dagPath = influenceObjects[i];
+    _jointDagPaths[i] = dagPath;
+    _jointNames[i] = dagPath.partialPathName();
+    _jointFullNames[i] = dagPath.fullPathName();
+    _jointIds[_jointFullNames[i].asChar()] = i;
+    _jointIdsByName[_jointNames[i].asChar()] = i;
+    _jointStyles[i] = dagPath.childCount() == 0 ?
+#ifdef TERMINAL_JOINTS_ROTATE
+      JointPresentationStyle::TRANSLATE | JointPresentationStyle::ROTATE :
+      JointPresentationStyle::ROTATE;
+#else
+      JointPresentationStyle::TRANSLATE : JointPresentationStyle::ROTATE;
+#endif
+  }
+
+  // Full path names of the parents are already hashed, so linking the
+  // hierarchy is one lookup per joint.
+  _jointParents.assign(numInfluences, -1);
+  _jointChildOffsets.assign(numInfluences + 1, 0);
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    MDagPath parentPath = _jointDagPaths[i];
+    parentPath.pop();
+    int parent = jointIdForDagPath(parentPath);
+    _jointParents[i] = parent;
+    if (parent >= 0) {
+      ++_jointChildOffsets[parent + 1];
+    }
+  }
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    _jointChildOffsets[i + 1] += _jointChildOffsets[i];
+  }
+
+  _jointChildren.resize(_jointChildOffsets[numInfluences]);
+  std::vector<unsigned int> next(_jointChildOffsets.begin(),
+    _jointChildOffsets.end() - 1);
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    if (_jointParents[i] >= 0) {
+      _jointChildren[next[_jointParents[i]]++] = i;
+    }
+  }
+
+  _keyIndex.setJoints(_jointDagPaths);
+
+  _skinMatrixAttr = skin.attribute("matrix");
+  _jointTableDirty = false;
+}
+
+bool Rig::jointTableDirty() const {
+  return _jointTableDirty || _influencesDirty;
+}
+
+void Rig::updateJointTable(unsigned int numThreads) {
+  if (!jointTableDirty()) {
+    return;
+  }
+
+  calculateJointTable();
+
+  if (_influencesDirty) {
+    _influencesDirty = false;
+    calculateMaxInfluences(numThreads);
+    calculateLongestJoint();
+    _pickTopologyDirty = true;
+  }
+}
+
+void Rig::updateFaceInfluences(unsigned int numThreads) {
+  _faceInfluences.update(numThreads);
+}
+
+void Rig::markJointTableDirty() {
+  _jointTableDirty = true;
+  notifyEdit();
+}
+
+void Rig::markGeometryDirty() {
+  _pickGeometryDirty = true;
+  ++_geometryVersion;
+}
+
+void Rig::markTopologyDirty() {
+  _pickTopologyDirty = true;
+  ++_topologyVersion;
+}
+
+void Rig::setEditCallback(EditCallback callback, void* clientData) {
+  _editCallback = callback;
+  _editClientData = clientData;
+  _faceInfluences.setEditCallback(callback, clientData);
+}
+
+void Rig::notifyEdit() {
+  if (_editCallback) {
+    _editCallback(_editClientData);
+  }
+}
+
+void Rig::calculateMaxInfluences(unsigned int numThreads) {
+  // The map keeps watching the rig after the tool exits, so coming back to
+  // the same rig only reclassifies what was edited in the meantime.
+  if (_faceInfluences.isBuiltFor(_meshDagPath, _skinObject)) {
+    _faceInfluences.update(numThreads);
+    return;
+  }
+
+  _faceInfluences.build(_meshDagPath, _skinObject, numThreads,
+    _faceCacheEnabled);
+}
+
+void Rig::calculateLongestJoint() {
+  MFnSkinCluster skin(_skinObject);
+
+  MDagPathArray influenceObjects;
+  unsigned int numInfluences = skin.influenceObjects(influenceObjects);
+
+  double maxLength = 0.0;
+  for (unsigned int i = 0; i < numInfluences; ++i) {
+    MDagPath jointDagPath = influenceObjects[i];
+    unsigned int children = jointDagPath.childCount();
+
+    // We're looking through the children instead of at the actual joint
+    // because we want to avoid the root transform. We end up looking at the
+    // same number of objects since a transform can have only one parent.
+    for (unsigned int i = 0; i < children; ++i) {
+      MObject child = jointDagPath.child(i);
+      if (child.hasFn(MFn::kJoint)) {
+        MFnDagNode dagNode(child);
+        MDagPath childDagPath;
+        dagNode.getPath(childDagPath);
+        MFnTransform childXform(childDagPath);
+        maxLength = std::max(maxLength,
+          childXform.getTranslation(MSpace::kObject).length());
+      }
+    }
+  }
+
+  _longestJoint = maxLength;
+}
+
+const std::vector<int>& Rig::maxInfluences() const {
+  return _faceInfluences.maxInfluences();
+}
+
+const std::vector<int>& Rig::facesForJoint(int jointId) const {
+  return _faceInfluences.facesForInfluence(jointId);
+}
+
+unsigned int Rig::faceInfluencesVersion() const {
+  return _faceInfluences.version();
+}
+
+unsigned int Rig::geometryVersion() const {
+  return _geometryVersion;
+}
+
+unsigned int Rig::topologyVersion() const {
+  return _topologyVersion;
+}
+
+double Rig::longestJoint() const {
+  return _longestJoint;
+}
+
+void Rig::appendKeyedChannels(const MTime& time, MIntArray& results) {
+  _keyIndex.appendKeyedChannels(time, results);
+}
+
+void Rig::updatePickGeometry() {
+  // Deformation only moves the triangles, so refitting is enough unless the
+  // topology changed as well.
+  if (_pickTopologyDirty || _pickBvh.isEmpty()) {
+    _pickBvh.build(_meshDagPath);
+    ++_pickGeometryVersion;
+  } else if (_pickGeometryDirty) {
+    MStatus err = _pickBvh.refit(_meshDagPath);
+    if (err.error()) {
+      _pickBvh.build(_meshDagPath);
+    }
+    ++_pickGeometryVersion;
+  }
+
+  _pickGeometryDirty = false;
+  _pickTopologyDirty = false;
+}
+
+bool Rig::pickFace(const MPoint& rayOrigin,
+  const MVector& rayDirection,
+  int& hitFace,
+  float& hitParam,
+  Deadline* deadline) {
+  updatePickGeometry();
+  if (deadline && deadline->expired()) {
+    return false;
+  }
+
+  return _pickBvh.intersect(rayOrigin, rayDirection, 1000.0f, hitFace,
+    &hitParam, deadline);
+}
+
+bool Rig::pickFaceInView(const MMatrix& worldToClip, int width, int height,
+  short x, short y,
+  unsigned int numThreads,
+  int& hitFace,
+  Deadline* deadline) {
+  updatePickGeometry();
+  if (deadline && deadline->expired()) {
+    return false;
+  }
+
+  FaceIdBuffer::Reason reason = _faceIdBuffer.staleReason(worldToClip,
+    width, height, _pickGeometryVersion);
+  if (reason != FaceIdBuffer::kNone) {
+    // A redraw can't be interrupted, so skip it if the last one wouldn't
+    // have fit in what's left of the budget.
+    if (deadline && _faceIdBuffer.numRebuilds() != 0 &&
+        _faceIdBuffer.lastRebuildTime() > deadline->remainingMs()) {
+      deadline->expire();
+      return false;
+    }
+
+    _faceIdBuffer.rebuild(worldToClip, width, height, _pickGeometryVersion,
+      _pickBvh.points(), _pickBvh.triangleVertices(),
+      _pickBvh.triangleFaces(), numThreads, reason);
+  }
+
+  hitFace = _faceIdBuffer.faceAt(x, y);
+  return hitFace >= 0;
+}
+
+void Rig::clearPickBuffer() {
+  _faceIdBuffer.clear();
+}
+
+MString Rig::pickBufferInfo() const {
+  MString result = "rebuilds: ";
+  result += _faceIdBuffer.numRebuilds();
+  result += ", last reason: ";
+  result += FaceIdBuffer::reasonName(_faceIdBuffer.lastReason());
+  result += ", last rebuild: ";
+  result += _faceIdBuffer.lastRebuildTime();
+  result += " ms at ";
+  result += _faceIdBuffer.width();
+  result += "x";
+  result += _faceIdBuffer.height();
+  return result;
+}
+
+int Rig::jointIdForDagPath(const MDagPath& dagPath) const {
+  if (!dagPath.isValid()) {
+    return -1;
+  }
+
+  auto value = _jointIds.find(dagPath.fullPathName().asChar());
+  if (value != _jointIds.end()) {
+    return value->second;
+  }
+
+  return -1;
+}
+
+int Rig::jointIdForName(const MString& name) const {
+  auto value = _jointIds.find(name.asChar());
+  if (value != _jointIds.end()) {
+    return value->second;
+  }
+
+  value = _jointIdsByName.find(name.asChar());
+  if (value != _jointIdsByName.end()) {
+    return value->second;
+  }
+
+  return -1;
+}
+
+unsigned int Rig::numJoints() const {
+  return (unsigned int)_jointDagPaths.size();
+}
+
+MDagPath Rig::jointDagPath(int jointId) const {
+  if (jointId < 0 || jointId >= (int)_jointDagPaths.size()) {
+    return MDagPath();
+  }
+
+  return _jointDagPaths[jointId];
+}
+
+const MString& Rig::jointName(int jointId) const {
+  static const MString empty;
+  if (jointId < 0 || jointId >= (int)_jointNames.size()) {
+    return empty;
+  }
+
+  return _jointNames[jointId];
+}
+
+const MString& Rig::jointFullName(int jointId) const {
+  static const MString empty;
+  if (jointId < 0 || jointId >= (int)_jointFullNames.size()) {
+    return empty;
+  }
+
+  return _jointFullNames[jointId];
+}
+
+int Rig::jointStyle(int jointId) const {
+  if (jointId < 0 || jointId >= (int)_jointStyles.size()) {
+    return JointPresentationStyle::NONE;
+  }
+
+  return _jointStyles[jointId];
+}
+
+int Rig::jointParent(int jointId) const {
+  if (jointId < 0 || jointId >= (int)_jointParents.size()) {
+    return -1;
+  }
+
+  return _jointParents[jointId];
+}
+
+unsigned int Rig::numJointChildren(int jointId) const {
+  if (jointId < 0 || jointId >= (int)_jointParents.size()) {
+    return 0;
+  }
+
+  return _jointChildOffsets[jointId + 1] - _jointChildOffsets[jointId];
+}
+
+int Rig::jointChild(int jointId, unsigned int index) const {
+  if (index >= numJointChildren(jointId)) {
+    return -1;
+  }
+
+  return _jointChildren[_jointChildOffsets[jointId] + index];
+}
+
+void Rig::meshDirtyCallback(void* clientData) {
+  Rig* rig = static_cast<Rig*>(clientData);
+  rig->markGeometryDirty();
+}
+
+void Rig::timeChangeCallback(MTime& time, void* clientData) {
+  Rig* rig = static_cast<Rig*>(clientData);
+  rig->markGeometryDirty();
+}
+
+void Rig::topologyChangedCallback(MObject& node, void* clientData) {
+  Rig* rig = static_cast<Rig*>(clientData);
+  rig->markTopologyDirty();
+}
+
+void Rig::skinAttributeChangedCallback(
+  MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug& otherPlug,
+  void* clientData) {
+  Rig* rig = static_cast<Rig*>(clientData);
+  if ((msg & (MNodeMessage::kConnectionMade |
+      MNodeMessage::kConnectionBroken)) &&
+      plug.attribute() == rig->_skinMatrixAttr) {
+    rig->_influencesDirty = true;
+    rig->notifyEdit();
+  }
+}
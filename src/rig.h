@@ -0,0 +1,145 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <maya/MCallbackIdArray.h>
+#include <maya/MDagPath.h>
+#include <maya/MIntArray.h>
+#include <maya/MMatrix.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MObject.h>
+#include <maya/MPoint.h>
+#include <maya/MString.h>
+#include <maya/MTime.h>
+#include <maya/MVector.h>
+
+#include "face_influence_map.h"
+#include "key_index.h"
+#include "pick_bvh.h"
+#include "face_id_buffer.h"
+#include "deadline.h"
+
+// Everything derived from one skinned mesh: the joint table, the face
+// influences and the pick accelerators. Rigs are shared through acquire(),
+// so every session that touches the same mesh reuses one set of tables, and
+// a rig is freed once no session holds it. The rig watches its own mesh and
+// skin for as long as it lives, so coming back to it only redoes what was
+// edited in the meantime.
+class Rig {
+public:
+  typedef FaceInfluenceMap::EditCallback EditCallback;
+
+  ~Rig();
+
+  static std::shared_ptr<Rig> acquire(const MDagPath& meshDagPath,
+    MObject skinObj);
+  static bool skinDeformsMesh(MObject skinObj, MObject meshObj);
+  static MObject findSkinCluster(const MDagPath& meshDagPath);
+
+  bool isValid() const;
+  MDagPath meshDagPath() const;
+  MObject skinObject() const;
+
+  void setup(unsigned int numThreads, bool faceCacheEnabled);
+  void calculateJointTable();
+  bool jointTableDirty() const;
+  void updateJointTable(unsigned int numThreads);
+  void updateFaceInfluences(unsigned int numThreads);
+  void markJointTableDirty();
+  void markGeometryDirty();
+  void markTopologyDirty();
+  // Called whenever an edit leaves the joint table or the face influences
+  // out of date, so that the owner can schedule updateJointTable() and
+  // updateFaceInfluences() outside of dirty propagation and drawing.
+  void setEditCallback(EditCallback callback, void* clientData);
+
+  const std::vector<int>& maxInfluences() const;
+  const std::vector<int>& facesForJoint(int jointId) const;
+  unsigned int faceInfluencesVersion() const;
+  unsigned int geometryVersion() const;
+  unsigned int topologyVersion() const;
+  double longestJoint() const;
+
+  // Keyed channels of every joint at the time, as KeyIndex bitmasks in joint
+  // ID order.
+  void appendKeyedChannels(const MTime& time, MIntArray& results);
+
+  // Closest hit along the ray; hitParam is the ray parameter of the hit so
+  // that hits on different rigs can be compared.
+  bool pickFace(const MPoint& rayOrigin, const MVector& rayDirection,
+    int& hitFace, float& hitParam, Deadline* deadline = nullptr);
+  bool pickFaceInView(const MMatrix& worldToClip, int width, int height,
+    short x, short y, unsigned int numThreads, int& hitFace,
+    Deadline* deadline = nullptr);
+  void updatePickGeometry();
+  void clearPickBuffer();
+  MString pickBufferInfo() const;
+
+  int jointIdForDagPath(const MDagPath& dagPath) const;
+  int jointIdForName(const MString& name) const;
+  unsigned int numJoints() const;
+  MDagPath jointDagPath(int jointId) const;
+  const MString& jointName(int jointId) const;
+  const MString& jointFullName(int jointId) const;
+  int jointStyle(int jointId) const;
+  int jointParent(int jointId) const;
+  unsigned int numJointChildren(int jointId) const;
+  int jointChild(int jointId, unsigned int index) const;
+
+private:
+  Rig(const MDagPath& meshDagPath, MObject skinObj);
+  Rig(const Rig&);
+  Rig& operator=(const Rig&);
+
+  void calculateMaxInfluences(unsigned int numThreads);
+  void calculateLongestJoint();
+
+  void notifyEdit();
+
+  static void meshDirtyCallback(void* clientData);
+  static void timeChangeCallback(MTime& time, void* clientData);
+  static void topologyChangedCallback(MObject& node, void* clientData);
+  static void skinAttributeChangedCallback(
+    MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug& otherPlug,
+    void* clientData);
+
+  MDagPath _meshDagPath;
+  MObject _skinObject;
+  bool _faceCacheEnabled;
+  FaceInfluenceMap _faceInfluences;
+  KeyIndex _keyIndex;
+  PickBvh _pickBvh;
+  FaceIdBuffer _faceIdBuffer;
+  bool _pickGeometryDirty;
+  bool _pickTopologyDirty;
+  unsigned int _pickGeometryVersion;
+  unsigned int _geometryVersion;
+  unsigned int _topologyVersion;
+  double _longestJoint;
+
+  // Influences interned to dense joint IDs, which are their influence
+  // indices. Full path names are only hashed at the API boundary.
+  std::vector<MDagPath> _jointDagPaths;
+  std::vector<MString> _jointNames;
+  std::vector<MString> _jointFullNames;
+  std::vector<int> _jointStyles;
+  std::unordered_map<std::string, int> _jointIds;
+  std::unordered_map<std::string, int> _jointIdsByName;
+  // Parent joint, or -1 if the DAG parent isn't an influence, and the
+  // influence children of each joint in CSR form.
+  std::vector<int> _jointParents;
+  std::vector<unsigned int> _jointChildOffsets;
+  std::vector<int> _jointChildren;
+  // Renames and reparenting only change the names and hierarchy; adding or
+  // removing influences renumbers the joints and their faces too.
+  bool _jointTableDirty;
+  bool _influencesDirty;
+  MObject _skinMatrixAttr;
+
+  EditCallback _editCallback;
+  void* _editClientData;
+  MCallbackIdArray _callbacks;
+};
@@ -0,0 +1,61 @@
+#include "selection_event.h"
+
+#include <maya/MEventMessage.h>
+#include <maya/MUserEventMessage.h>
+
+namespace SelectionEvent {
+  const MString NAME = "mannequinSelectionChanged";
+
+  namespace {
+    Payload pending = { -1, -1, 0, MString() };
+    Payload posted = { -1, -1, 0, MString() };
+    MCallbackId idleCallbackId = 0;
+    bool hasIdleCallback = false;
+
+    void stopIdleCallback() {
+      if (hasIdleCallback) {
+        MMessage::removeCallback(idleCallbackId);
+        hasIdleCallback = false;
+      }
+    }
+
+    void idleCallback(void* clientData) {
+      stopIdleCallback();
+
+      // Listeners may select again, which schedules another post.
+      posted = pending;
+      MUserEventMessage::postUserEvent(NAME, &posted);
+    }
+  }
+
+  MStatus initialize() {
+    if (MUserEventMessage::isUserEvent(NAME)) {
+      return MS::kSuccess;
+    }
+
+    return MUserEventMessage::registerUserEvent(NAME);
+  }
+
+  void uninitialize() {
+    stopIdleCallback();
+
+    if (MUserEventMessage::isUserEvent(NAME)) {
+      MUserEventMessage::deregisterUserEvent(NAME);
+    }
+  }
+
+  void post(const Payload& payload) {
+    pending = payload;
+
+    if (!hasIdleCallback) {
+      MStatus err;
+      idleCallbackId = MEventMessage::addEventCallback("idle", idleCallback,
+        nullptr, &err);
+      hasIdleCallback = !err.error();
+    }
+  }
+
+  const Payload& last() {
+    return posted;
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+
+// Selection changes are announced on a Maya user event instead of running
+// Python source on the click path. The event is posted from the next idle,
+// so listeners never run inside a press, and several changes within one
+// interaction reach listeners as the last one. C++ listeners receive a
+// const Payload* as their client data; scripts can query the selection
+// with `mannequinContext -q -selection` when the event fires.
+namespace SelectionEvent {
+  extern const MString NAME;
+
+  struct Payload {
+    int rigId;
+    int jointId;
+    int style;
+    MString fullPathName;
+  };
+
+  MStatus initialize();
+  void uninitialize();
+
+  void post(const Payload& payload);
+  const Payload& last();
+}
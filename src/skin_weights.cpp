@@ -0,0 +1,298 @@
+#include "skin_weights.h"
+
+#include <algorithm>
+
+#include <maya/MFnSkinCluster.h>
+#include <maya/MFnMesh.h>
+#include <maya/MFnSingleIndexedComponent.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MIntArray.h>
+#include <maya/MPlug.h>
+
+SkinWeights::SkinWeights()
+  : _numInfluences(0), _maxRowLength(0), _numNonzeros(0),
+    _canUpdateRows(false) {}
+
+MStatus SkinWeights::read(const MDagPath& meshDagPath, MObject skinObj) {
+  clear();
+
+  MStatus err;
+  MFnMesh mesh(meshDagPath, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MFnSkinCluster skin(skinObj, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  unsigned int numVertices = mesh.numVertices();
+
+  // The weightList plug is only indexed by vertex when the skin deforms a
+  // single geometry; otherwise let Maya resolve the indices for us.
+  if (skin.numOutputConnections() == 1) {
+    err = readPlugs(skinObj, numVertices);
+    _canUpdateRows = true;
+  } else {
+    err = readDense(meshDagPath, skinObj, numVertices);
+  }
+
+  if (err.error()) {
+    clear();
+  } else {
+    _numNonzeros = (unsigned int)_influences.size();
+    updateMaxRowLength();
+  }
+
+  return err;
+}
+
+MStatus SkinWeights::readPlugs(MObject skinObj, unsigned int numVertices) {
+  MStatus err;
+  MFnSkinCluster skin(skinObj);
+
+  MDagPathArray influenceObjects;
+  _numInfluences = skin.influenceObjects(influenceObjects, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  // Weights are keyed by the logical index of each influence's matrix plug,
+  // which can have holes, so translate them back to influence indices.
+  _logicalToInfluence.clear();
+  for (unsigned int i = 0; i < _numInfluences; ++i) {
+    unsigned int logical = skin.indexForInfluenceObject(influenceObjects[i],
+      &err);
+    if (err.error()) {
+      return err;
+    }
+
+    if (logical >= _logicalToInfluence.size()) {
+      _logicalToInfluence.resize(logical + 1, -1);
+    }
+    _logicalToInfluence[logical] = i;
+  }
+
+  MPlug weightListPlug = skin.findPlug("weightList", &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MObject weightsAttr = skin.attribute("weights", &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MIntArray vtxIndicesArray;
+  weightListPlug.getExistingArrayAttributeIndices(vtxIndicesArray);
+
+  std::vector<unsigned int> vtxIndices(vtxIndicesArray.length());
+  for (unsigned int i = 0; i < vtxIndicesArray.length(); ++i) {
+    vtxIndices[i] = vtxIndicesArray[i];
+  }
+  std::sort(vtxIndices.begin(), vtxIndices.end());
+
+  // Vertices without a weightList entry keep empty rows.
+  _rowBegin.assign(numVertices, 0);
+  _rowEnd.assign(numVertices, 0);
+
+  for (unsigned int vtx : vtxIndices) {
+    if (vtx >= numVertices) {
+      break;
+    }
+
+    MPlug vtxWeightsPlug =
+      weightListPlug.elementByLogicalIndex(vtx).child(weightsAttr);
+
+    _rowBegin[vtx] = (unsigned int)_influences.size();
+    readRow(vtxWeightsPlug);
+    _rowEnd[vtx] = (unsigned int)_influences.size();
+  }
+
+  return MS::kSuccess;
+}
+
+void SkinWeights::readRow(MPlug& vtxWeightsPlug) {
+  MIntArray influenceIndices;
+  vtxWeightsPlug.getExistingArrayAttributeIndices(influenceIndices);
+
+  for (unsigned int i = 0; i < influenceIndices.length(); ++i) {
+    unsigned int logical = influenceIndices[i];
+    if (logical >= _logicalToInfluence.size() ||
+        _logicalToInfluence[logical] < 0) {
+      continue;
+    }
+
+    float weight = float(
+      vtxWeightsPlug.elementByLogicalIndex(logical).asDouble());
+    if (weight == 0.0f) {
+      continue;
+    }
+
+    _influences.push_back(_logicalToInfluence[logical]);
+    _weights.push_back(weight);
+  }
+}
+
+MStatus SkinWeights::updateRows(MObject skinObj,
+  const std::vector<unsigned int>& vertices) {
+  if (!_canUpdateRows) {
+    return MS::kInvalidParameter;
+  }
+
+  MStatus err;
+  MFnSkinCluster skin(skinObj, &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MPlug weightListPlug = skin.findPlug("weightList", &err);
+  if (err.error()) {
+    return err;
+  }
+
+  MObject weightsAttr = skin.attribute("weights", &err);
+  if (err.error()) {
+    return err;
+  }
+
+  for (unsigned int vtx : vertices) {
+    if (vtx >= numVertices()) {
+      continue;
+    }
+
+    // Read the new row onto the end of the arrays, then move it back into
+    // the old slot if it still fits there.
+    unsigned int oldLength = _rowEnd[vtx] - _rowBegin[vtx];
+    unsigned int newBegin = (unsigned int)_influences.size();
+    MPlug vtxWeightsPlug =
+      weightListPlug.elementByLogicalIndex(vtx).child(weightsAttr);
+    readRow(vtxWeightsPlug);
+    unsigned int newLength = (unsigned int)_influences.size() - newBegin;
+
+    if (newLength <= oldLength) {
+      std::copy(_influences.begin() + newBegin, _influences.end(),
+        _influences.begin() + _rowBegin[vtx]);
+      std::copy(_weights.begin() + newBegin, _weights.end(),
+        _weights.begin() + _rowBegin[vtx]);
+      _influences.resize(newBegin);
+      _weights.resize(newBegin);
+    } else {
+      _rowBegin[vtx] = newBegin;
+    }
+
+    _rowEnd[vtx] = _rowBegin[vtx] + newLength;
+    _numNonzeros = _numNonzeros - oldLength + newLength;
+
+    // Shrinking rows can't lower the maximum without a full scan, but an
+    // overestimate only costs the classifier its fastest kernels.
+    _maxRowLength = std::max(_maxRowLength, newLength);
+  }
+
+  if (_influences.size() > 2 * size_t(_numNonzeros) + 1024) {
+    compact();
+  }
+
+  return MS::kSuccess;
+}
+
+void SkinWeights::compact() {
+  std::vector<unsigned int> influences;
+  std::vector<float> weights;
+  influences.reserve(_numNonzeros);
+  weights.reserve(_numNonzeros);
+
+  for (unsigned int vtx = 0; vtx < numVertices(); ++vtx) {
+    unsigned int begin = (unsigned int)influences.size();
+    influences.insert(influences.end(), _influences.begin() + _rowBegin[vtx],
+      _influences.begin() + _rowEnd[vtx]);
+    weights.insert(weights.end(), _weights.begin() + _rowBegin[vtx],
+      _weights.begin() + _rowEnd[vtx]);
+    _rowBegin[vtx] = begin;
+    _rowEnd[vtx] = (unsigned int)influences.size();
+  }
+
+  _influences.swap(influences);
+  _weights.swap(weights);
+}
+
+MStatus SkinWeights::readDense(const MDagPath& meshDagPath, MObject skinObj,
+  unsigned int numVertices) {
+  MStatus err;
+  MFnSkinCluster skin(skinObj);
+
+  MFnSingleIndexedComponent comp;
+  MObject compObj = comp.create(MFn::kMeshVertComponent);
+  comp.setCompleteData(numVertices);
+
+  MDoubleArray dense;
+  err = skin.getWeights(meshDagPath, compObj, dense, _numInfluences);
+  if (err.error()) {
+    return err;
+  }
+
+  _rowBegin.assign(numVertices, 0);
+  _rowEnd.assign(numVertices, 0);
+  for (unsigned int vtx = 0; vtx < numVertices; ++vtx) {
+    _rowBegin[vtx] = (unsigned int)_influences.size();
+    for (unsigned int i = 0; i < _numInfluences; ++i) {
+      float weight = float(dense[vtx * _numInfluences + i]);
+      if (weight != 0.0f) {
+        _influences.push_back(i);
+        _weights.push_back(weight);
+      }
+    }
+    _rowEnd[vtx] = (unsigned int)_influences.size();
+  }
+
+  return MS::kSuccess;
+}
+
+void SkinWeights::updateMaxRowLength() {
+  _maxRowLength = 0;
+  for (unsigned int vtx = 0; vtx < numVertices(); ++vtx) {
+    _maxRowLength = std::max(_maxRowLength, rowEnd(vtx) - rowBegin(vtx));
+  }
+}
+
+bool SkinWeights::canUpdateRows() const {
+  return _canUpdateRows;
+}
+
+void SkinWeights::clear() {
+  _numInfluences = 0;
+  _maxRowLength = 0;
+  _numNonzeros = 0;
+  _canUpdateRows = false;
+  _logicalToInfluence.clear();
+  _rowBegin.clear();
+  _rowEnd.clear();
+  _influences.clear();
+  _weights.clear();
+}
+
+unsigned int SkinWeights::numVertices() const {
+  return (unsigned int)_rowBegin.size();
+}
+
+unsigned int SkinWeights::numInfluences() const {
+  return _numInfluences;
+}
+
+unsigned int SkinWeights::numNonzeros() const {
+  return _numNonzeros;
+}
+
+unsigned int SkinWeights::maxRowLength() const {
+  return _maxRowLength;
+}
+
+const std::vector<unsigned int>& SkinWeights::influences() const {
+  return _influences;
+}
+
+const std::vector<float>& SkinWeights::weights() const {
+  return _weights;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include <maya/MDagPath.h>
+#include <maya/MObject.h>
+#include <maya/MPlug.h>
+#include <maya/MStatus.h>
+
+// Skin weights stored sparsely in compressed sparse row (CSR) form.
+// The nonzero weights of vertex v are the entries [rowBegin(v), rowEnd(v)) of
+// influences() and weights(), so memory scales with the number of nonzeros
+// instead of numVertices * numInfluences.
+// Rows can be re-read individually after a weight edit; a row that grows is
+// moved to the end of the arrays, and the arrays are compacted once more than
+// half of them is dead space.
+class SkinWeights {
+public:
+  SkinWeights();
+  MStatus read(const MDagPath& meshDagPath, MObject skinObj);
+  MStatus updateRows(MObject skinObj,
+    const std::vector<unsigned int>& vertices);
+  bool canUpdateRows() const;
+  void clear();
+
+  unsigned int numVertices() const;
+  unsigned int numInfluences() const;
+  unsigned int numNonzeros() const;
+  unsigned int maxRowLength() const;
+  unsigned int rowBegin(unsigned int vtx) const;
+  unsigned int rowEnd(unsigned int vtx) const;
+  const std::vector<unsigned int>& influences() const;
+  const std::vector<float>& weights() const;
+
+private:
+  MStatus readPlugs(MObject skinObj, unsigned int numVertices);
+  MStatus readDense(const MDagPath& meshDagPath, MObject skinObj,
+    unsigned int numVertices);
+  void readRow(MPlug& vtxWeightsPlug);
+  void compact();
+  void updateMaxRowLength();
+
+  unsigned int _numInfluences;
+  unsigned int _maxRowLength;
+  unsigned int _numNonzeros;
+  bool _canUpdateRows;
+  std::vector<int> _logicalToInfluence;
+  std::vector<unsigned int> _rowBegin;
+  std::vector<unsigned int> _rowEnd;
+  std::vector<unsigned int> _influences;
+  std::vector<float> _weights;
+};
+
+// Row accessors are inline since the face classification kernels call them
+// for every face vertex.
+inline unsigned int SkinWeights::rowBegin(unsigned int vtx) const {
+  return _rowBegin[vtx];
+}
+
+inline unsigned int SkinWeights::rowEnd(unsigned int vtx) const {
+  return _rowEnd[vtx];
+}
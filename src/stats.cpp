@@ -0,0 +1,165 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <maya/MString.h>
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+  ++_counts[bucketFor(nanoseconds)];
+  ++_count;
+  _sum += nanoseconds;
+  _max = std::max(_max, nanoseconds);
+}
+
+void LatencyHistogram::reset() {
+  std::fill(_counts, _counts + NUM_BUCKETS, 0);
+  _count = 0;
+  _sum = 0;
+  _max = 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+  return _count;
+}
+
+uint64_t LatencyHistogram::maxValue() const {
+  return _max;
+}
+
+double LatencyHistogram::mean() const {
+  return _count == 0 ? 0.0 : double(_sum) / double(_count);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+  if (_count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(fraction * double(_count));
+  rank = std::max<uint64_t>(1, std::min(rank, _count));
+
+  uint64_t seen = 0;
+  for (unsigned int bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+    seen += _counts[bucket];
+    if (seen >= rank) {
+      // The top bucket is no tighter than the largest sample.
+      return std::min(bucketUpperBound(bucket), _max);
+    }
+  }
+
+  return _max;
+}
+
+unsigned int LatencyHistogram::bucketFor(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return (unsigned int)value;
+  }
+
+  unsigned int msb = 0;
+  for (unsigned int shift = 32; shift != 0; shift /= 2) {
+    if (value >> (msb + shift)) {
+      msb += shift;
+    }
+  }
+
+  unsigned int sub = (unsigned int)(value >> (msb - SUB_BUCKET_BITS)) &
+    (SUB_BUCKETS - 1);
+  return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+
+  unsigned int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t next = SUB_BUCKETS + bucket % SUB_BUCKETS + 1;
+  if (shift >= 64 - (SUB_BUCKET_BITS + 1)) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+
+  return (next << shift) - 1;
+}
+
+namespace Stats {
+  namespace {
+    LatencyHistogram histograms[NUM_METRICS];
+
+    MString formatMicroseconds(double nanoseconds) {
+      MString result;
+      result += nanoseconds / 1000.0;
+      result += " us";
+      return result;
+    }
+  }
+
+  const char* metricName(Metric metric) {
+    switch (metric) {
+      case kMove: return "doMove";
+      case kMoveRay: return "doMove.ray";
+      case kMoveIntersect: return "doMove.intersect";
+      case kMoveManipTest: return "doMove.manipTest";
+      case kMoveHighlight: return "doMove.highlight";
+      case kHighlight: return "highlight";
+      case kSelect: return "select";
+      case kSelectManipulators: return "select.manipulators";
+      case kPress: return "doPress";
+      case kSetup: return "toolOnSetup";
+      case kSetupFindSkin: return "toolOnSetup.findSkin";
+      case kSetupJointTable: return "toolOnSetup.jointTable";
+      case kSetupFaceInfluences: return "toolOnSetup.faceInfluences";
+      case kSetupLongestJoint: return "toolOnSetup.longestJoint";
+      case kSetupPickBvh: return "toolOnSetup.pickBvh";
+      case kSetupOverlay: return "toolOnSetup.overlay";
+      case kSetupManipulator: return "toolOnSetup.manipulator";
+      case kMoveManipDrag: return "moveManipulator.doDrag";
+      case kKeyStatus: return "keyStatus";
+      case NUM_METRICS: break;
+    }
+
+    return "unknown";
+  }
+
+  void record(Metric metric, uint64_t nanoseconds) {
+    histograms[metric].record(nanoseconds);
+  }
+
+  const LatencyHistogram& histogram(Metric metric) {
+    return histograms[metric];
+  }
+
+  void reset() {
+    for (LatencyHistogram& histogram : histograms) {
+      histogram.reset();
+    }
+  }
+
+  void report(MStringArray& results) {
+    for (int i = 0; i < NUM_METRICS; ++i) {
+      const LatencyHistogram& histogram = histograms[i];
+      if (histogram.count() == 0) {
+        continue;
+      }
+
+      MString line = metricName(Metric(i));
+      line += ": count ";
+      line += (unsigned int)histogram.count();
+      line += ", mean ";
+      line += formatMicroseconds(histogram.mean());
+      line += ", p50 ";
+      line += formatMicroseconds((double)histogram.percentile(0.5));
+      line += ", p95 ";
+      line += formatMicroseconds((double)histogram.percentile(0.95));
+      line += ", p99 ";
+      line += formatMicroseconds((double)histogram.percentile(0.99));
+      line += ", max ";
+      line += formatMicroseconds((double)histogram.maxValue());
+      results.append(line);
+    }
+  }
+}
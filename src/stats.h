@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <maya/MStringArray.h>
+
+#include "trace.h"
+
+// Fixed-size latency histogram with log-linear buckets: every power of two
+// is split into 8 linear buckets, so a percentile read back from it is
+// within 12.5% of the true value. Recording is a few integer ops and never
+// allocates, so histograms can stay on in hot paths.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+  void record(uint64_t nanoseconds);
+  void reset();
+
+  uint64_t count() const;
+  uint64_t maxValue() const;
+  double mean() const;
+  // Upper bound of the bucket holding the given fraction of samples.
+  uint64_t percentile(double fraction) const;
+
+private:
+  static const unsigned int SUB_BUCKET_BITS = 3;
+  static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const unsigned int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) *
+    SUB_BUCKETS;
+
+  static unsigned int bucketFor(uint64_t value);
+  static uint64_t bucketUpperBound(unsigned int bucket);
+
+  uint64_t _counts[NUM_BUCKETS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+namespace Stats {
+  // Instrumented spans; the histograms are only touched from the main thread.
+  enum Metric {
+    kMove,
+    kMoveRay,
+    kMoveIntersect,
+    kMoveManipTest,
+    kMoveHighlight,
+    kHighlight,
+    kSelect,
+    kSelectManipulators,
+    kPress,
+    kSetup,
+    kSetupFindSkin,
+    kSetupJointTable,
+    kSetupFaceInfluences,
+    kSetupLongestJoint,
+    kSetupPickBvh,
+    kSetupOverlay,
+    kSetupManipulator,
+    kMoveManipDrag,
+    kKeyStatus,
+    NUM_METRICS
+  };
+
+  const char* metricName(Metric metric);
+  void record(Metric metric, uint64_t nanoseconds);
+  const LatencyHistogram& histogram(Metric metric);
+  void reset();
+
+  // One line per metric that has samples, with percentiles in microseconds.
+  void report(MStringArray& results);
+
+  // Times the enclosing scope into its histogram and emits it as a trace
+  // span under the metric's name.
+  class ScopedTimer {
+  public:
+    explicit ScopedTimer(Metric metric)
+      : _metric(metric),
+        _profilerEvent(Trace::beginEvent(metricName(metric))),
+        _start(Trace::Clock::now()) {}
+
+    ~ScopedTimer() {
+      Trace::Clock::time_point end = Trace::Clock::now();
+      std::chrono::nanoseconds elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - _start);
+      record(_metric, (uint64_t)elapsed.count());
+      Trace::endEvent(_profilerEvent, metricName(_metric), _start, end);
+    }
+
+  private:
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+
+    Metric _metric;
+    int _profilerEvent;
+    Trace::Clock::time_point _start;
+  };
+}
@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#include <fstream>
+#include <vector>
+
+#include <maya/MProfiler.h>
+
+namespace Trace {
+  namespace {
+    // Spans are buffered and written in batches so that tracing doesn't
+    // add file I/O to every event.
+    const size_t FLUSH_THRESHOLD = 4096;
+
+    struct Event {
+      const char* name;
+      Clock::time_point start;
+      Clock::time_point end;
+    };
+
+    int categoryId = -1;
+    std::ofstream file;
+    MString filePath;
+    Clock::time_point fileStart;
+    std::vector<Event> pending;
+    bool firstEvent = true;
+
+    double microsecondsSinceStart(Clock::time_point time) {
+      std::chrono::duration<double, std::micro> elapsed = time - fileStart;
+      return elapsed.count();
+    }
+
+    void flush() {
+      for (const Event& event : pending) {
+        std::chrono::duration<double, std::micro> duration =
+          event.end - event.start;
+        file << (firstEvent ? "\n" : ",\n")
+          << "{\"name\":\"" << event.name << "\","
+          << "\"cat\":\"mannequin\",\"ph\":\"X\","
+          << "\"ts\":" << microsecondsSinceStart(event.start) << ","
+          << "\"dur\":" << duration.count() << ","
+          << "\"pid\":1,\"tid\":1}";
+        firstEvent = false;
+      }
+
+      pending.clear();
+      file.flush();
+    }
+  }
+
+  void initialize() {
+#if MAYA_API_VERSION >= 201600
+    categoryId = MProfiler::addCategory("Mannequin");
+#endif
+  }
+
+  void uninitialize() {
+    stop();
+
+#if MAYA_API_VERSION >= 201600
+    if (categoryId >= 0) {
+      MProfiler::removeCategory("Mannequin");
+      categoryId = -1;
+    }
+#endif
+  }
+
+  MStatus start(const MString& path) {
+    stop();
+
+    file.open(path.asChar(), std::ios::trunc);
+    if (!file) {
+      return MS::kFailure;
+    }
+
+    filePath = path;
+    fileStart = Clock::now();
+    firstEvent = true;
+    pending.reserve(FLUSH_THRESHOLD);
+
+    file.precision(3);
+    file << std::fixed
+      << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      << "\"args\":{\"name\":\"Maya (Mannequin)\"}}";
+    firstEvent = false;
+    return MS::kSuccess;
+  }
+
+  void stop() {
+    if (!file.is_open()) {
+      return;
+    }
+
+    flush();
+    file << "\n]}\n";
+    file.close();
+    filePath = "";
+  }
+
+  const MString& path() {
+    return filePath;
+  }
+
+  int beginEvent(const char* name) {
+#if MAYA_API_VERSION >= 201600
+    if (categoryId >= 0 && MProfiler::isCategoryEnabled(categoryId)) {
+      return MProfiler::eventBegin(categoryId, MProfiler::kColorE_L1, name);
+    }
+#endif
+
+    return -1;
+  }
+
+  void endEvent(int profilerEvent, const char* name,
+    Clock::time_point start, Clock::time_point end) {
+#if MAYA_API_VERSION >= 201600
+    if (profilerEvent >= 0) {
+      MProfiler::eventEnd(profilerEvent);
+    }
+#endif
+
+    if (file.is_open()) {
+      pending.push_back(Event { name, start, end });
+      if (pending.size() >= FLUSH_THRESHOLD) {
+        flush();
+      }
+    }
+  }
+}
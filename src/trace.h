@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+
+// Per-event timelines for the instrumented spans. Every span is sent to
+// Maya's profiler under the "Mannequin" category, so it lines up with DG
+// evaluation in the Profiler window, and can also be written to a Chrome
+// trace-event JSON file for viewing offline in chrome://tracing or
+// Perfetto. Spans are normally emitted by Stats::ScopedTimer.
+namespace Trace {
+  typedef std::chrono::steady_clock Clock;
+
+  void initialize();
+  void uninitialize();
+
+  // Starts writing spans to a trace file, replacing any trace in progress.
+  MStatus start(const MString& path);
+  // Flushes and closes the trace file, if any.
+  void stop();
+  const MString& path();
+
+  // Returns a profiler event ID, or -1 if the category is disabled.
+  int beginEvent(const char* name);
+  void endEvent(int profilerEvent, const char* name,
+    Clock::time_point start, Clock::time_point end);
+}
@@ -0,0 +1,325 @@
+"""Benchmarks the Mannequin tool and its commands.
+
+Builds scenes with N simple skinned characters and runs these benchmarks:
+
+- Tool entry: enters the Mannequin tool on one character a few times. Prints
+  the skin discovery and total setup times from `mannequinContext -q -stats`.
+- Selection: selects joints in turn with `mannequinContext -e -selection`,
+  which takes the same path as a click. Prints the selection and manipulator
+  times.
+- Key status: times the `-keyStatus` query while scrubbing.
+- Poses: times getting and setting every character's pose with
+  `mannequinPose`.
+- Pose libraries: times opening a library and applying or blending poses
+  from it. These should stay flat as the library grows.
+- Palette: in an interactive session only, times opening the joint palette
+  for every character at once. This should stay flat as the joint count
+  grows.
+- Playback: in an interactive session only, measures playback fps with the
+  palette closed and open at several `-paletteRate` settings.
+
+Run inside Maya's Script Editor or with mayapy:
+
+    mayapy test/mannequin_bench.py [count ...]
+"""
+
+from maya import cmds
+from maya import mel
+
+import os
+import re
+import sys
+import tempfile
+import time
+
+
+CONTEXT = "mannequinBenchContext"
+DEFAULT_COUNTS = [1, 10, 50, 100, 250]
+ENTRIES = 5
+JOINTS_PER_CHARACTER = 8
+METRICS = ["toolOnSetup.findSkin", "toolOnSetup"]
+SELECT_ROUNDS = 20
+SELECT_METRICS = ["select", "select.manipulators", "keyStatus"]
+LIBRARY_SIZES = [10, 100, 1000]
+PLAYBACK_FRAMES = 120
+# None plays with the palette closed; a high rate updates it every frame.
+PLAYBACK_RATES = [(None, "no palette"), (1000.0, "every frame"),
+                  (10.0, "10 Hz"), (0.0, "suspended")]
+
+
+def makeCharacter(index):
+    spacing = 4.0
+    x = (index % 20) * spacing
+    z = (index // 20) * spacing
+
+    mesh = cmds.polyCylinder(name="benchMesh%d" % index, height=8.0,
+                             subdivisionsHeight=JOINTS_PER_CHARACTER * 2,
+                             subdivisionsAxis=16)[0]
+    cmds.move(x, 4.0, z, mesh)
+
+    cmds.select(clear=True)
+    joints = []
+    step = 8.0 / (JOINTS_PER_CHARACTER - 1)
+    for i in range(JOINTS_PER_CHARACTER):
+        joints.append(cmds.joint(name="benchJoint%d_%d" % (index, i),
+                                 position=(x, i * step, z)))
+
+    cmds.skinCluster(joints[0], mesh, toSelectedBones=False,
+                     maximumInfluences=2)
+    return mesh
+
+
+def makeScene(count):
+    cmds.file(new=True, force=True)
+    return [makeCharacter(i) for i in range(count)]
+
+
+def parseStats(lines):
+    means = {}
+    for line in lines or []:
+        match = re.match(r"([\w.]+): count \d+, mean ([\d.e+-]+) us", line)
+        if match:
+            means[match.group(1)] = float(match.group(2))
+    return means
+
+
+def measure(count):
+    meshes = makeScene(count)
+    if not cmds.mannequinContext(CONTEXT, exists=True):
+        cmds.mannequinContext(CONTEXT)
+
+    # Enter on the last character, which is the worst case for a scan.
+    target = meshes[-1]
+    cmds.mannequinContext(CONTEXT, e=True, stats=True)
+    for _ in range(ENTRIES):
+        cmds.select(target, replace=True)
+        cmds.setToolTo(CONTEXT)
+        cmds.setToolTo("selectSuperContext")
+
+    return parseStats(cmds.mannequinContext(CONTEXT, q=True, stats=True))
+
+
+def measureSelect():
+    makeScene(1)
+    if not cmds.mannequinContext(CONTEXT, exists=True):
+        cmds.mannequinContext(CONTEXT)
+
+    cmds.select("benchMesh0", replace=True)
+    cmds.setToolTo(CONTEXT)
+    cmds.mannequinContext(CONTEXT, e=True, stats=True)
+
+    # Walk the chain, asking for rotate and translate in turn. Only the tip
+    # joint can translate; the other joints fall back to rotate.
+    for i in range(SELECT_ROUNDS):
+        for j in range(JOINTS_PER_CHARACTER):
+            style = "t" if j % 2 else "r"
+            cmds.mannequinContext(CONTEXT, e=True,
+                                  selection=("benchJoint0_%d" % j, style))
+
+    # Key every other frame, then scrub and fetch the key status as the
+    # palette does.
+    for j in range(JOINTS_PER_CHARACTER):
+        for frame in range(0, SELECT_ROUNDS, 2):
+            cmds.setKeyframe("benchJoint0_%d" % j, attribute="rotate",
+                             time=frame)
+    for frame in range(SELECT_ROUNDS):
+        cmds.currentTime(frame)
+        cmds.mannequinContext(CONTEXT, q=True, keyStatus=True)
+
+    means = parseStats(cmds.mannequinContext(CONTEXT, q=True, stats=True))
+    cmds.setToolTo("selectSuperContext")
+    return means
+
+
+def measurePose(count):
+    meshes = makeScene(count)
+
+    # Round-trip the whole pose, nudged so that every channel changes.
+    getTime = 0.0
+    setTime = 0.0
+    for i in range(ENTRIES):
+        start = time.time()
+        values = cmds.mannequinPose(meshes, q=True)
+        getTime += time.time() - start
+
+        values = [v + 1.0 for v in values]
+        start = time.time()
+        cmds.mannequinPose(meshes, e=True, values=values)
+        setTime += time.time() - start
+
+    return (getTime / ENTRIES * 1000.0, setTime / ENTRIES * 1000.0)
+
+
+def measurePoseLibrary(size):
+    makeScene(1)
+    if not cmds.mannequinContext(CONTEXT, exists=True):
+        cmds.mannequinContext(CONTEXT)
+
+    cmds.select("benchMesh0", replace=True)
+    cmds.setToolTo(CONTEXT)
+
+    path = os.path.join(tempfile.gettempdir(), "mannequinBench.mpl")
+    if os.path.exists(path):
+        os.remove(path)
+
+    cmds.mannequinContext(CONTEXT, e=True, poseLibrary=path)
+    for i in range(size):
+        cmds.setAttr("benchJoint0_1.rotateZ", i % 90)
+        cmds.mannequinContext(CONTEXT, e=True, savePose="pose%d" % i)
+
+    # Close it first so that opening maps it again.
+    openTime = 0.0
+    for _ in range(ENTRIES):
+        cmds.mannequinContext(CONTEXT, e=True, poseLibrary="")
+        start = time.time()
+        cmds.mannequinContext(CONTEXT, e=True, poseLibrary=path)
+        openTime += time.time() - start
+
+    applyTime = 0.0
+    blendTime = 0.0
+    for i in range(ENTRIES):
+        start = time.time()
+        cmds.mannequinContext(CONTEXT, e=True,
+                              applyPose="pose%d" % (i * size // ENTRIES))
+        applyTime += time.time() - start
+
+        start = time.time()
+        cmds.mannequinContext(CONTEXT, e=True,
+                              blendPoses=("pose0", "pose%d" % (size - 1)),
+                              blendWeight=0.25)
+        blendTime += time.time() - start
+
+    cmds.mannequinContext(CONTEXT, e=True, poseLibrary="")
+    os.remove(path)
+    cmds.setToolTo("selectSuperContext")
+    return (openTime / ENTRIES * 1000.0, applyTime / ENTRIES * 1000.0,
+            blendTime / ENTRIES * 1000.0)
+
+
+def measurePalette(count):
+    meshes = makeScene(count)
+    if not cmds.mannequinContext(CONTEXT, exists=True):
+        cmds.mannequinContext(CONTEXT)
+
+    cmds.select(meshes, replace=True)
+    cmds.setToolTo(CONTEXT)
+
+    # Entering the tool opens the palette; reopen it to time it alone.
+    elapsed = 0.0
+    for _ in range(ENTRIES):
+        mel.eval("mannequinPaletteFinish")
+        start = time.time()
+        mel.eval("mannequinPaletteBegin")
+        elapsed += time.time() - start
+
+    cmds.setToolTo("selectSuperContext")
+    return elapsed / ENTRIES * 1000.0
+
+
+def animateScene(count):
+    for i in range(count):
+        for j in range(JOINTS_PER_CHARACTER):
+            joint = "benchJoint%d_%d" % (i, j)
+            cmds.setKeyframe(joint, attribute="rotateZ", time=0, value=0.0)
+            cmds.setKeyframe(joint, attribute="rotateZ",
+                             time=PLAYBACK_FRAMES, value=30.0)
+
+
+def measurePlayback(count, rate):
+    meshes = makeScene(count)
+    animateScene(count)
+    if not cmds.mannequinContext(CONTEXT, exists=True):
+        cmds.mannequinContext(CONTEXT)
+
+    cmds.select(meshes, replace=True)
+    cmds.setToolTo(CONTEXT)
+    if rate is None:
+        mel.eval("mannequinPaletteFinish")
+    else:
+        cmds.mannequinContext(CONTEXT, e=True, paletteRate=rate)
+        mel.eval("mannequinPaletteBegin")
+
+    # Play every frame as fast as possible, once through.
+    cmds.playbackOptions(minTime=0, maxTime=PLAYBACK_FRAMES, loop="once",
+                         playbackSpeed=0, maxPlaybackSpeed=0)
+    cmds.currentTime(0)
+    start = time.time()
+    cmds.play(wait=True)
+    elapsed = time.time() - start
+
+    cmds.setToolTo("selectSuperContext")
+    return (PLAYBACK_FRAMES + 1) / elapsed
+
+
+def run(counts=DEFAULT_COUNTS):
+    if not cmds.pluginInfo("mannequin", q=True, loaded=True):
+        cmds.loadPlugin("mannequin")
+
+    header = "%10s" % "characters"
+    for metric in METRICS:
+        header += "  %24s" % (metric + " (us)")
+    print(header)
+
+    for count in counts:
+        means = measure(count)
+        row = "%10d" % count
+        for metric in METRICS:
+            row += "  %24.1f" % means.get(metric, float("nan"))
+        print(row)
+
+    print("")
+    means = measureSelect()
+    for metric in SELECT_METRICS:
+        print("%24s  %10.1f us" % (metric, means.get(metric, float("nan"))))
+
+    print("")
+    print("%10s  %10s  %18s  %18s" % ("characters", "joints", "pose get (ms)",
+                                      "pose set (ms)"))
+    for count in counts:
+        getTime, setTime = measurePose(count)
+        print("%10d  %10d  %18.2f  %18.2f" % (count,
+                                              count * JOINTS_PER_CHARACTER,
+                                              getTime, setTime))
+
+    print("")
+    print("%10s  %14s  %14s  %14s" % ("poses", "open (ms)", "apply (ms)",
+                                      "blend (ms)"))
+    for size in LIBRARY_SIZES:
+        print("%10d  %14.2f  %14.2f  %14.2f" % ((size,) +
+                                                measurePoseLibrary(size)))
+
+    # The palette is a dock, so it needs the GUI.
+    if not cmds.about(batch=True):
+        print("")
+        print("%10s  %10s  %24s" % ("characters", "joints",
+                                    "palette open (ms)"))
+        for count in counts:
+            print("%10d  %10d  %24.1f" % (count, count * JOINTS_PER_CHARACTER,
+                                         measurePalette(count)))
+
+        if not cmds.mannequinContext(CONTEXT, exists=True):
+            cmds.mannequinContext(CONTEXT)
+        paletteRate = cmds.mannequinContext(CONTEXT, q=True, paletteRate=True)
+
+        print("")
+        header = "%10s" % "characters"
+        for _, label in PLAYBACK_RATES:
+            header += "  %18s" % (label + " (fps)")
+        print(header)
+        for count in counts:
+            row = "%10d" % count
+            for rate, _ in PLAYBACK_RATES:
+                row += "  %18.1f" % measurePlayback(count, rate)
+            print(row)
+
+        cmds.mannequinContext(CONTEXT, e=True, paletteRate=paletteRate)
+
+    cmds.deleteUI(CONTEXT)
+
+
+if __name__ == "__main__":
+    import maya.standalone
+    maya.standalone.initialize()
+    counts = [int(arg) for arg in sys.argv[1:]] or DEFAULT_COUNTS
+    run(counts)
+    maya.standalone.uninitialize()